@@ -1,25 +1,14 @@
 ﻿#include "OEP.h"
+#include "waksman.h"
 
 #include <iostream>
 #include "RNG.h"
 #include "party.h"
+#include "threadpool.h"
 #include <cassert>
 
 namespace SECYAN
 {
-    // "On Arbitrary Waksman Networks and their Vulnerability"
-
-    uint8_t gateNumMap[] = {0, 0, 1, 3, 5, 8, 11, 14, 17, 21, 25, 29, 33, 37,
-                            41, 45, 49, 54, 59, 64, 69, 74, 79, 84, 89, 94, 99};
-    // return sum(ceil(log2(i))) for i=1 to N
-    uint32_t ComputeGateNum(int N)
-    {
-        if (N < sizeof(gateNumMap) / sizeof(uint8_t))
-            return gateNumMap[N];
-        int power = floor_log2(N) + 1;
-        return power * N + 1 - (1 << power);
-    }
-
     inline uint64_t pack(uint32_t a, uint32_t b)
     {
         return (uint64_t)a << 32 | b;
@@ -39,271 +28,24 @@ namespace SECYAN
         uint32_t output2;
     };
 
-    struct GateBlinder
-    {
-        uint32_t upper;
-        uint32_t lower;
-    };
-
-    void GenSelectionBits(const uint32_t *permuIndices, int size, bool *bits)
-    {
-        if (size == 2)
-            bits[0] = permuIndices[0];
-        if (size <= 2)
-            return;
-
-        uint32_t *invPermuIndices = new uint32_t[size];
-        for (int i = 0; i < size; i++)
-            invPermuIndices[permuIndices[i]] = i;
-
-        bool odd = size & 1;
-
-        // Solve the edge coloring problem
-
-        // flag=0: non-specified; flag=1: upperNetwork; flag=2: lowerNetwork
-        char *leftFlag = new char[size]();
-        char *rightFlag = new char[size]();
-        int rightPointer = size - 1;
-        int leftPointer;
-        while (rightFlag[rightPointer] == 0)
-        {
-            rightFlag[rightPointer] = 2;
-            leftPointer = permuIndices[rightPointer];
-            leftFlag[leftPointer] = 2;
-            if (odd && leftPointer == size - 1)
-                break;
-            leftPointer = leftPointer & 1 ? leftPointer - 1 : leftPointer + 1;
-            leftFlag[leftPointer] = 1;
-            rightPointer = invPermuIndices[leftPointer];
-            rightFlag[rightPointer] = 1;
-            rightPointer = rightPointer & 1 ? rightPointer - 1 : rightPointer + 1;
-        }
-        for (int i = 0; i < size - 1; i++)
-        {
-            rightPointer = i;
-            while (rightFlag[rightPointer] == 0)
-            {
-                rightFlag[rightPointer] = 2;
-                leftPointer = permuIndices[rightPointer];
-                leftFlag[leftPointer] = 2;
-                leftPointer = leftPointer & 1 ? leftPointer - 1 : leftPointer + 1;
-                leftFlag[leftPointer] = 1;
-                rightPointer = invPermuIndices[leftPointer];
-
-                rightFlag[rightPointer] = 1;
-                rightPointer = rightPointer & 1 ? rightPointer - 1 : rightPointer + 1;
-            }
-        }
-        delete[] invPermuIndices;
-
-        // Determine bits on left gates
-        int halfSize = size / 2;
-        for (int i = 0; i < halfSize; i++)
-            bits[i] = leftFlag[2 * i] == 2;
-
-        int upperIndex = halfSize;
-        int uppergateNum = ComputeGateNum(halfSize);
-        int lowerIndex = upperIndex + uppergateNum;
-        int rightGateIndex = lowerIndex + (odd ? ComputeGateNum(halfSize + 1) : uppergateNum);
-        // Determine bits on right gates
-        for (int i = 0; i < halfSize - 1; i++)
-            bits[rightGateIndex + i] = rightFlag[2 * i] == 2;
-        if (odd)
-            bits[rightGateIndex + halfSize - 1] = rightFlag[size - 2] == 1;
-
-        delete[] leftFlag;
-        delete[] rightFlag;
-
-        // Compute upper network
-        uint32_t *upperIndices = new uint32_t[halfSize];
-        for (int i = 0; i < halfSize - 1 + odd; i++)
-            upperIndices[i] = permuIndices[2 * i + bits[rightGateIndex + i]] / 2;
-        if (!odd)
-            upperIndices[halfSize - 1] = permuIndices[size - 2] / 2;
-        GenSelectionBits(upperIndices, halfSize, bits + upperIndex);
-        delete[] upperIndices;
-
-        // Compute lower network
-        int lowerSize = halfSize + odd;
-        uint32_t *lowerIndices = new uint32_t[lowerSize];
-        for (int i = 0; i < halfSize - 1 + odd; i++)
-            lowerIndices[i] = permuIndices[2 * i + 1 - bits[rightGateIndex + i]] / 2;
-        if (odd)
-            lowerIndices[halfSize] = permuIndices[size - 1] / 2;
-        else
-            lowerIndices[halfSize - 1] = permuIndices[2 * halfSize - 1] / 2;
-        GenSelectionBits(lowerIndices, lowerSize, bits + lowerIndex);
-        delete[] lowerIndices;
-    }
-
-    // Inputs of the gate: v0=x0-r1, v1=x1-r2
-    // Outputs of the gate: if bit==1 then v0=x1-r3, v1=x0-r4; otherwise v0=x0-r3, v1=x1-r4
-    // m0=r1-r3, m1=r2-r4
-    void EvaluateGate(uint32_t &v0, uint32_t &v1, GateBlinder blinder, uint8_t bit)
-    {
-        if (bit)
-        {
-            uint32_t temp = v1 + blinder.upper;
-            v1 = v0 + blinder.lower;
-            v0 = temp;
-        }
-        else
-        {
-            v0 += blinder.upper;
-            v1 += blinder.lower;
-        }
-    }
-
-    // If you want to apply the original exchange operation, set blinders to be 0;
-    void EvaluateNetwork(uint32_t *values, int size, const bool *bits, const GateBlinder *blinders)
-    {
-        if (size == 2)
-            EvaluateGate(values[0], values[1], blinders[0], bits[0]);
-        if (size <= 2)
-            return;
-
-        int odd = size & 1;
-        int halfSize = size / 2;
-
-        // Compute left gates
-        for (int i = 0; i < halfSize; i++)
-            EvaluateGate(values[2 * i], values[2 * i + 1], blinders[i], bits[i]);
-        bits += halfSize;
-        blinders += halfSize;
-
-        // Compute upper subnetwork
-        uint32_t *upperValues = new uint32_t[halfSize];
-        for (int i = 0; i < halfSize; i++)
-            upperValues[i] = values[i * 2];
-        EvaluateNetwork(upperValues, halfSize, bits, blinders);
-        int uppergateNum = ComputeGateNum(halfSize);
-        bits += uppergateNum;
-        blinders += uppergateNum;
-
-        // Compute lower subnetwork
-        int lowerSize = halfSize + odd;
-        uint32_t *lowerValues = new uint32_t[lowerSize];
-        for (int i = 0; i < halfSize; i++)
-            lowerValues[i] = values[i * 2 + 1];
-        if (odd) // the last element
-            lowerValues[lowerSize - 1] = values[size - 1];
-        EvaluateNetwork(lowerValues, lowerSize, bits, blinders);
-        int lowergateNum = odd ? ComputeGateNum(lowerSize) : uppergateNum;
-        bits += lowergateNum;
-        blinders += lowergateNum;
-
-        // Deal with outputs of subnetworks
-        for (int i = 0; i < halfSize; i++)
-        {
-            values[2 * i] = upperValues[i];
-            values[2 * i + 1] = lowerValues[i];
-        }
-        if (odd) // the last element
-            values[size - 1] = lowerValues[lowerSize - 1];
-
-        // Compute right gates
-        for (int i = 0; i < halfSize - 1 + odd; i++)
-            EvaluateGate(values[2 * i], values[2 * i + 1], blinders[i], bits[i]);
-
-        delete[] upperValues;
-        delete[] lowerValues;
-    }
-
-    void WriteGateLabels(uint32_t *inputLabel, int size, Label *gateLabels)
-    {
-        if (size == 2)
-        {
-            gateLabels[0].input1 = inputLabel[0];
-            gateLabels[0].input2 = inputLabel[1];
-            gateLabels[0].output1 = gRNG.NextUInt32();
-            gateLabels[0].output2 = gRNG.NextUInt32();
-            inputLabel[0] = gateLabels[0].output1;
-            inputLabel[1] = gateLabels[0].output2;
-        }
-
-        if (size <= 2)
-            return;
-
-        int odd = size & 1;
-        int halfSize = size / 2;
-
-        // Compute left gates
-        for (int i = 0; i < halfSize; i++)
-        {
-            gateLabels[i].input1 = inputLabel[2 * i];
-            gateLabels[i].input2 = inputLabel[2 * i + 1];
-            gateLabels[i].output1 = gRNG.NextUInt32();
-            gateLabels[i].output2 = gRNG.NextUInt32();
-            inputLabel[2 * i] = gateLabels[i].output1;
-            inputLabel[2 * i + 1] = gateLabels[i].output2;
-        }
-        gateLabels += halfSize;
-
-        // Compute upper subnetwork
-        uint32_t *upperInputs = new uint32_t[halfSize];
-        for (int i = 0; i < halfSize; i++)
-            upperInputs[i] = inputLabel[2 * i];
-        WriteGateLabels(upperInputs, halfSize, gateLabels);
-        int uppergateNum = ComputeGateNum(halfSize);
-        gateLabels += uppergateNum;
-
-        // Compute lower subnetwork
-        int lowerSize = halfSize + odd;
-        uint32_t *lowerInputs = new uint32_t[lowerSize];
-        for (int i = 0; i < halfSize; i++)
-            lowerInputs[i] = inputLabel[2 * i + 1];
-        if (odd) // the last element
-            lowerInputs[lowerSize - 1] = inputLabel[size - 1];
-        WriteGateLabels(lowerInputs, lowerSize, gateLabels);
-        int lowergateNum = odd ? ComputeGateNum(lowerSize) : uppergateNum;
-        gateLabels += lowergateNum;
-
-        // Deal with outputs of subnetworks
-        for (int i = 0; i < halfSize; i++)
-        {
-            inputLabel[2 * i] = upperInputs[i];
-            inputLabel[2 * i + 1] = lowerInputs[i];
-        }
-        if (odd) // the last element
-            inputLabel[size - 1] = lowerInputs[lowerSize - 1];
-
-        // Compute right gates
-        for (int i = 0; i < halfSize - 1 + odd; i++)
-        {
-            gateLabels[i].input1 = inputLabel[2 * i];
-            gateLabels[i].input2 = inputLabel[2 * i + 1];
-            gateLabels[i].output1 = gRNG.NextUInt32();
-            gateLabels[i].output2 = gRNG.NextUInt32();
-            inputLabel[2 * i] = gateLabels[i].output1;
-            inputLabel[2 * i + 1] = gateLabels[i].output2;
-        }
-        delete[] upperInputs;
-        delete[] lowerInputs;
-    }
-
     // The data sender
     std::vector<uint32_t> SenderPermute(std::vector<uint32_t> &values)
     {
         auto size = values.size();
-        uint32_t gateNum = ComputeGateNum(size);
-        // Sender generates blinded inputs
-        Label *gateLabels = new Label[gateNum];
+        WaksmanNetwork network(size, 2);
+        uint32_t gateNum = network.GateNum();
+        // Sender generates blinded inputs: random output labels of the gates (in the order of the gates), stored as two arrays
+        uint32_t *output1 = network.GateArray(0), *output2 = network.GateArray(1);
+        gParty.RandomLabels(output1, output2, gateNum);
 
         std::vector<uint32_t> out = values;
-        // Locally randomly writes labels for each gate
-        WriteGateLabels(&out[0], size, gateLabels);
         std::vector<uint64_t> msg0(gateNum);
         std::vector<uint64_t> msg1(gateNum);
-
-        for (uint32_t i = 0; i < gateNum; i++)
-        {
-            Label label = gateLabels[i];
-            msg0[i] = pack(label.input1 - label.output1, label.input2 - label.output2);
-            msg1[i] = pack(label.input2 - label.output1, label.input1 - label.output2);
-        }
+        // The input labels of a gate are the labels on its wires, which its output labels replace
+        network.Run(out.data(), [&](uint32_t firstGate, uint32_t n, const uint32_t *in0, const uint32_t *in1, uint32_t *out0, uint32_t *out1) {
+            WriteLayerLabels(output1, output2, msg0.data(), msg1.data(), firstGate, n, in0, in1, out0, out1);
+        });
         gParty.OTSend(msg0, msg1);
-
-        delete[] gateLabels;
         return out;
     }
 
@@ -317,32 +59,38 @@ namespace SECYAN
         for (auto f : flag)
             assert(f && "Not a permutation!");
         assert(size == permutorValues.size());
-        uint32_t gateNum = ComputeGateNum(size);
-        bool *selectBits_arr = new bool[gateNum];
-        GenSelectionBits(indices.data(), size, selectBits_arr);
-        std::vector<uint32_t> selectBits(selectBits_arr, selectBits_arr + gateNum);
+        WaksmanNetwork network(size, 2);
+        uint32_t gateNum = network.GateNum();
+        std::vector<uint32_t> selectBits(gateNum);
+        network.GenSelectionBits(indices.data(), selectBits.data());
         auto msg = gParty.OTRecv(selectBits);
-        GateBlinder *gateBlinders = new GateBlinder[gateNum];
-        for (uint32_t i = 0; i < gateNum; i++)
-            unpack(msg[i], gateBlinders[i].upper, gateBlinders[i].lower);
+        // The blinders of the gates, stored as two arrays
+        uint32_t *upper = network.GateArray(0), *lower = network.GateArray(1);
+        gThreadPool.ParallelRange(gateNum, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+                unpack(msg[i], upper[i], lower[i]);
+        }, WaksmanNetwork::parallelCutoff);
         std::vector<uint32_t> out = permutorValues;
-        EvaluateNetwork(&out[0], size, selectBits_arr, gateBlinders);
-        delete[] gateBlinders;
-        delete[] selectBits_arr;
+        network.Run(out.data(), [&](uint32_t firstGate, uint32_t n, const uint32_t *in0, const uint32_t *in1, uint32_t *out0, uint32_t *out1) {
+            EvaluateLayer(selectBits.data(), upper, lower, firstGate, n, in0, in1, out0, out1);
+        });
         return out;
     }
 
     std::vector<uint32_t> SenderReplicate(std::vector<uint32_t> &values)
     {
         auto size = values.size();
+        if (size <= 1)
+            return values;
         Label *labels = new Label[size - 1];
-        std::vector<uint32_t> out(size);
+        std::vector<uint32_t> out(size), output1(size - 1), output2(size - 1);
+        gParty.RandomLabels(output1.data(), output2.data(), size - 1);
         for (uint32_t i = 0; i < size - 1; i++)
         {
             labels[i].input1 = i == 0 ? values[0] : labels[i - 1].output2;
             labels[i].input2 = values[i + 1];
-            out[i] = labels[i].output1 = gRNG.NextUInt32();
-            labels[i].output2 = gRNG.NextUInt32();
+            out[i] = labels[i].output1 = output1[i];
+            labels[i].output2 = output2[i];
         }
         out[size - 1] = labels[size - 2].output2;
         std::vector<uint64_t> msg0(size - 1);
@@ -361,6 +109,8 @@ namespace SECYAN
     {
         auto size = repBits.size() + 1;
         assert(size == permutorValues.size());
+        if (size <= 1)
+            return permutorValues;
         auto msg = gParty.OTRecv(repBits);
         std::vector<uint32_t> out(size);
         Label *labels = new Label[size - 1];
@@ -405,7 +155,7 @@ namespace SECYAN
         }
         std::vector<uint32_t> firstPermu(M);
         uint32_t dummyIndex = 0, fPIndex = 0;
-        std::vector<uint32_t> repBits(N - 1);
+        std::vector<uint32_t> repBits(N > 0 ? N - 1 : 0);
 
         // We call those index with indicesCount[index]==0 as dummy index
         for (uint32_t i = 0; i < M; i++)
@@ -454,17 +204,29 @@ namespace SECYAN
         return PermutorPermute(secondPermu, out);
     }
 
+    size_t ExtendedPermuteBytes(size_t M, size_t N)
+    {
+        // The permutations run one at a time on max(M, N) values. Per gate: the two label (or blinder) arrays, the selection bit,
+        // the two OT messages and the two 128-bit blocks of the OT extension. Per value: the scratch of the network and the
+        // index, count and value arrays of the extended permutation
+        size_t size = std::max(M, N);
+        const size_t gateBytes = 3 * sizeof(uint32_t) + 2 * sizeof(uint64_t) + 2 * 16;
+        const size_t valueBytes = 3 * sizeof(uint32_t) + 8 * sizeof(uint32_t);
+        return (size_t)ComputeGateNum(size) * gateBytes + size * valueBytes;
+    }
+
     std::vector<uint32_t> SenderAggregate(std::vector<uint32_t> &values)
     {
         auto size = values.size();
         Label *labels = new Label[size - 1];
-        std::vector<uint32_t> out(size);
+        std::vector<uint32_t> out(size), output1(size - 1), output2(size - 1);
+        gParty.RandomLabels(output1.data(), output2.data(), size - 1);
         for (uint32_t i = 0; i < size - 1; i++)
         {
             labels[i].input1 = i == 0 ? values[0] : labels[i - 1].output2;
             labels[i].input2 = values[i + 1];
-            out[i] = labels[i].output1 = gRNG.NextUInt32();
-            labels[i].output2 = gRNG.NextUInt32();
+            out[i] = labels[i].output1 = output1[i];
+            labels[i].output2 = output2[i];
         }
         out[size - 1] = labels[size - 2].output2;
         std::vector<uint64_t> msg0(size - 1);
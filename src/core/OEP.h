@@ -1,6 +1,7 @@
 ﻿#pragma once
 #include <vector>
 #include <cstdint>
+#include <cstddef>
 
 namespace SECYAN
 {
@@ -13,6 +14,8 @@ namespace SECYAN
     // oblivious extended permutation (M values to N values)
     std::vector<uint32_t> SenderExtendedPermute(std::vector<uint32_t> &values, uint32_t N);
     std::vector<uint32_t> PermutorExtendedPermute(std::vector<uint32_t> &indices, std::vector<uint32_t> &permutorValues);
+    // An upper bound of the bytes either party allocates in an extended permutation of M values to N values
+    size_t ExtendedPermuteBytes(size_t M, size_t N);
 
     // aggregate (sum) neighbor values according to aggBits
     std::vector<uint32_t> SenderAggregate(std::vector<uint32_t> &values);
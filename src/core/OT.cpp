@@ -1,19 +1,27 @@
 #include "OT.h"
 #include "party.h"
 #include <array>
+#include <thread>
+#include <algorithm>
+#include <cstring>
 #include "RNG.h"
 #include "cryptoTools/Common/BitVector.h"
+#include "cryptoTools/Crypto/AES.h"
 
 using namespace osuCrypto;
 
 namespace SECYAN
 {
 
-    void OT::Init(Channel &chl, bool isServer)
+    void OT::Init(std::vector<Channel> &chls, bool isServer)
     {
-        this->chl = chl;
-        kkrtsender.configure(false, 40, 64);
-        kkrtreceiver.configure(false, 40, 64);
+        chl = chls[0];
+        this->isServer = isServer;
+        laneChls = chls;
+        kkrtsenders.resize(1);
+        kkrtreceivers.resize(1);
+        kkrtsenders[0].configure(false, 40, 64);
+        kkrtreceivers[0].configure(false, 40, 64);
         if (isServer)
         {
             GenBaseOTs1();
@@ -24,24 +32,41 @@ namespace SECYAN
             GenBaseOTs2();
             GenBaseOTs1();
         }
+        // Splitting derives new base OTs locally, in the same order on both sides
+        for (size_t t = 1; t < laneChls.size(); t++)
+        {
+            kkrtsenders.push_back(kkrtsenders[0].splitBase());
+            kkrtreceivers.push_back(kkrtreceivers[0].splitBase());
+        }
+        numThreads = laneChls.size();
+    }
+
+    void OT::SetNumThreads(uint32_t numThreads)
+    {
+        this->numThreads = std::min<uint32_t>(std::max(1u, numThreads), laneChls.size());
+    }
+
+    uint32_t OT::GetNumThreads()
+    {
+        return numThreads;
     }
 
     void OT::GenBaseOTs1()
     {
-        auto count = kkrtreceiver.getBaseOTCount();
+        auto count = kkrtreceivers[0].getBaseOTCount();
         std::vector<std::array<block, 2>> msgs(count);
         iknpsender.send(msgs, gPRNG, chl);
-        kkrtreceiver.setBaseOts(msgs, gPRNG, chl);
+        kkrtreceivers[0].setBaseOts(msgs, gPRNG, chl);
     }
 
     void OT::GenBaseOTs2()
     {
-        auto count = kkrtsender.getBaseOTCount();
+        auto count = kkrtsenders[0].getBaseOTCount();
         std::vector<block> msgs(count);
         BitVector bv(count);
         bv.randomize(gPRNG);
         iknpreceiver.receive(bv, msgs, gPRNG, chl);
-        kkrtsender.setBaseOts(msgs, bv, chl);
+        kkrtsenders[0].setBaseOts(msgs, bv, chl);
     }
 
     void OT::Send(std::vector<uint64_t> &msg0, std::vector<uint64_t> &msg1)
@@ -49,6 +74,26 @@ namespace SECYAN
         // The number of OTs.
         auto n = msg0.size();
 
+        if (n <= sendPool0.size() - sendPoolUsed)
+        {
+            // Derandomize: with e = b ^ c for the choice bit b and the random choice bit c of the receiver,
+            // send (m0 ^ r_e, m1 ^ r_(1-e)), from which it unmasks m_b = r_c
+            std::vector<uint64_t> flips((n + 63) / 64), masked(2 * n);
+            if (n > 0)
+                chl.recv(flips.data(), flips.size());
+            auto r0 = &sendPool0[sendPoolUsed], r1 = &sendPool1[sendPoolUsed];
+            for (size_t i = 0; i < n; i++)
+            {
+                bool e = flips[i / 64] >> (i % 64) & 1;
+                masked[2 * i] = msg0[i] ^ (e ? r1[i] : r0[i]);
+                masked[2 * i + 1] = msg1[i] ^ (e ? r0[i] : r1[i]);
+            }
+            if (n > 0)
+                chl.send(masked);
+            sendPoolUsed += n;
+            return;
+        }
+
         // Choose which messages should be sent.
         std::vector<std::array<block, 2>> sendMessages(n);
         for (int i = 0; i < n; i++)
@@ -63,6 +108,25 @@ namespace SECYAN
         // The number of OTs.
         auto n = selectBits.size();
 
+        if (n <= recvPool.size() - recvPoolUsed)
+        {
+            // Derandomize (see Send)
+            std::vector<uint64_t> flips((n + 63) / 64), masked(2 * n), out(n);
+            auto choices = &recvChoices[recvPoolUsed];
+            for (size_t i = 0; i < n; i++)
+                flips[i / 64] |= (uint64_t)((selectBits[i] & 1) ^ choices[i]) << (i % 64);
+            if (n > 0)
+            {
+                chl.send(flips);
+                chl.recv(masked.data(), masked.size());
+            }
+            auto r = &recvPool[recvPoolUsed];
+            for (size_t i = 0; i < n; i++)
+                out[i] = masked[2 * i + (selectBits[i] & 1)] ^ r[i];
+            recvPoolUsed += n;
+            return out;
+        }
+
         // Choose which messages should be received.
         BitVector choices(n);
         for (int i = 0; i < n; i++)
@@ -79,37 +143,209 @@ namespace SECYAN
         return out;
     }
 
-    std::vector<std::vector<uint64_t>> OT::OPRFSend(std::vector<std::vector<uint64_t>> &inputs)
+    void OT::ANDTriples(size_t numWords, std::vector<uint64_t> &a, std::vector<uint64_t> &b, std::vector<uint64_t> &c)
     {
-        auto outputs = inputs;
-        auto n = inputs.size();
-        kkrtsender.init(n, gPRNG, chl);
+        // A random OT gives the sender m0, m1 and the receiver r, m_r, so with x = lsb(m0 ^ m1), u = lsb(m0), v = lsb(m_r): x & r = u ^ v.
+        // a is x of the OTs this party sends, b is r of the OTs it receives, and c = a & b ^ u ^ v,
+        // then the cross terms a & b' and a' & b of (a ^ a') & (b ^ b') are u ^ v' and u' ^ v
+        const size_t chunkWords = 1 << 14; // 2^20 OTs at a time
+        a.resize(numWords);
+        b.resize(numWords);
+        c.resize(numWords);
+        std::vector<uint64_t> u(numWords), v(numWords);
+        auto sendOTs = [&]() {
+            std::vector<std::array<block, 2>> msgs;
+            for (size_t begin = 0; begin < numWords; begin += chunkWords)
+            {
+                size_t words = std::min(chunkWords, numWords - begin);
+                msgs.resize(words * 64);
+                iknpsender.send(msgs, gPRNG, chl);
+                for (size_t w = 0; w < words; w++)
+                {
+                    uint64_t x = 0, m = 0;
+                    for (int i = 0; i < 64; i++)
+                    {
+                        uint64_t m0 = (uint64_t)_mm_cvtsi128_si64x(msgs[w * 64 + i][0]) & 1;
+                        uint64_t m1 = (uint64_t)_mm_cvtsi128_si64x(msgs[w * 64 + i][1]) & 1;
+                        x |= (m0 ^ m1) << i;
+                        m |= m0 << i;
+                    }
+                    a[begin + w] = x;
+                    u[begin + w] = m;
+                }
+            }
+        };
+        auto recvOTs = [&]() {
+            std::vector<block> msgs;
+            for (size_t begin = 0; begin < numWords; begin += chunkWords)
+            {
+                size_t words = std::min(chunkWords, numWords - begin);
+                BitVector choices(words * 64);
+                choices.randomize(gPRNG);
+                msgs.resize(words * 64);
+                iknpreceiver.receive(choices, msgs, gPRNG, chl);
+                memcpy(&b[begin], choices.data(), words * sizeof(uint64_t));
+                for (size_t w = 0; w < words; w++)
+                {
+                    uint64_t m = 0;
+                    for (int i = 0; i < 64; i++)
+                        m |= ((uint64_t)_mm_cvtsi128_si64x(msgs[w * 64 + i]) & 1) << i;
+                    v[begin + w] = m;
+                }
+            }
+        };
+        // The sender of one party runs with the receiver of the other
+        if (isServer)
+        {
+            sendOTs();
+            recvOTs();
+        }
+        else
+        {
+            recvOTs();
+            sendOTs();
+        }
+        for (size_t w = 0; w < numWords; w++)
+            c[w] = (a[w] & b[w]) ^ u[w] ^ v[w];
+    }
+
+    void OT::Preprocess(size_t numOTs)
+    {
+        // Drop the used OTs, then add random OTs up to numOTs in each direction. The OTs this party sends
+        // are those the other party receives, so each batch is sized by the pool of its own direction
+        sendPool0.erase(sendPool0.begin(), sendPool0.begin() + sendPoolUsed);
+        sendPool1.erase(sendPool1.begin(), sendPool1.begin() + sendPoolUsed);
+        recvPool.erase(recvPool.begin(), recvPool.begin() + recvPoolUsed);
+        recvChoices.erase(recvChoices.begin(), recvChoices.begin() + recvPoolUsed);
+        sendPoolUsed = recvPoolUsed = 0;
+        size_t numNewSend = numOTs > sendPool0.size() ? numOTs - sendPool0.size() : 0;
+        size_t numNewRecv = numOTs > recvPool.size() ? numOTs - recvPool.size() : 0;
+        const size_t chunkOTs = 1 << 20;
+        auto sendOTs = [&]() {
+            std::vector<std::array<block, 2>> msgs;
+            for (size_t begin = 0; begin < numNewSend; begin += chunkOTs)
+            {
+                msgs.resize(std::min(chunkOTs, numNewSend - begin));
+                iknpsender.send(msgs, gPRNG, chl);
+                for (auto &msg : msgs)
+                {
+                    sendPool0.push_back((uint64_t)_mm_cvtsi128_si64x(msg[0]));
+                    sendPool1.push_back((uint64_t)_mm_cvtsi128_si64x(msg[1]));
+                }
+            }
+        };
+        auto recvOTs = [&]() {
+            std::vector<block> msgs;
+            for (size_t begin = 0; begin < numNewRecv; begin += chunkOTs)
+            {
+                size_t count = std::min(chunkOTs, numNewRecv - begin);
+                BitVector choices(count);
+                choices.randomize(gPRNG);
+                msgs.resize(count);
+                iknpreceiver.receive(choices, msgs, gPRNG, chl);
+                for (size_t i = 0; i < count; i++)
+                {
+                    recvChoices.push_back(choices[i]);
+                    recvPool.push_back((uint64_t)_mm_cvtsi128_si64x(msgs[i]));
+                }
+            }
+        };
+        // The sender of one party runs with the receiver of the other
+        if (isServer)
+        {
+            sendOTs();
+            recvOTs();
+        }
+        else
+        {
+            recvOTs();
+            sendOTs();
+        }
+    }
 
-        kkrtsender.recvCorrection(chl, n);
+    size_t OT::PooledSendOTs()
+    {
+        return sendPool0.size() - sendPoolUsed;
+    }
 
-        for (uint32_t i = 0; i < n; i++)
+    size_t OT::PooledRecvOTs()
+    {
+        return recvPool.size() - recvPoolUsed;
+    }
+
+    void OT::RunLanes(size_t n, const std::function<void(uint32_t, size_t, size_t)> &func)
+    {
+        // Both parties know n, so they split the bins in the same way
+        const size_t minBinsPerLane = 4096;
+        uint32_t numLanes = std::max<size_t>(1, std::min<size_t>(numThreads, n / minBinsPerLane));
+        std::vector<std::thread> threads;
+        for (uint32_t t = 1; t < numLanes; t++)
+            threads.emplace_back(func, t, n * t / numLanes, n * (t + 1) / numLanes);
+        func(0, 0, n / numLanes);
+        for (auto &thread : threads)
+            thread.join();
+    }
+
+    // Word 0 is the OPRF output itself, word w > 0 is the fixed-key AES hash AES(w, out) ^ (w, out)
+    inline void ExpandOPRFOutput(uint64_t out, uint64_t *dest, uint32_t outputWords)
+    {
+        dest[0] = out;
+        for (uint32_t w = 1; w < outputWords; w++)
         {
-            for (uint32_t j = 0; j < inputs[i].size(); j++)
+            block b = toBlock(w, out);
+            dest[w] = (uint64_t)_mm_cvtsi128_si64x(mAesFixedKey.ecbEncBlock(b) ^ b);
+        }
+    }
+
+    std::vector<uint64_t> OT::OPRFSend(const std::vector<uint64_t> &inputs, const std::vector<uint32_t> &offsets, uint32_t outputWords)
+    {
+        std::vector<uint64_t> outputs(inputs.size() * outputWords);
+        auto n = offsets.size() - 1;
+        std::vector<block> seeds(numThreads);
+        for (auto &seed : seeds)
+            seed = gPRNG.get<block>();
+
+        // Each lane receives the corrections of its bins on its own channel
+        RunLanes(n, [&](uint32_t t, size_t begin, size_t end) {
+            auto &sender = kkrtsenders[t];
+            PRNG prng(seeds[t]);
+            sender.init(end - begin, prng, laneChls[t]);
+            sender.recvCorrection(laneChls[t], end - begin);
+            for (size_t i = begin; i < end; i++)
             {
-                kkrtsender.encode(i, &inputs[i][j], &outputs[i][j], sizeof(uint64_t));
+                for (uint32_t k = offsets[i]; k < offsets[i + 1]; k++)
+                {
+                    uint64_t out;
+                    sender.encode(i - begin, &inputs[k], &out, sizeof(uint64_t));
+                    ExpandOPRFOutput(out, &outputs[(size_t)k * outputWords], outputWords);
+                }
             }
-        }
+        });
 
         return outputs;
     }
 
-    std::vector<uint64_t> OT::OPRFRecv(std::vector<uint64_t> &inputs)
+    std::vector<uint64_t> OT::OPRFRecv(std::vector<uint64_t> &inputs, uint32_t outputWords)
     {
-        auto outputs = inputs;
+        std::vector<uint64_t> outputs(inputs.size() * outputWords);
         auto n = inputs.size();
-        kkrtreceiver.init(n, gPRNG, chl);
+        std::vector<block> seeds(numThreads);
+        for (auto &seed : seeds)
+            seed = gPRNG.get<block>();
 
-        for (size_t i = 0; i < n; i++)
-        {
-            kkrtreceiver.encode(i, &inputs[i], &outputs[i], sizeof(uint64_t));
-        }
+        RunLanes(n, [&](uint32_t t, size_t begin, size_t end) {
+            auto &receiver = kkrtreceivers[t];
+            PRNG prng(seeds[t]);
+            receiver.init(end - begin, prng, laneChls[t]);
+            for (size_t i = begin; i < end; i++)
+            {
+                uint64_t out;
+                receiver.encode(i - begin, &inputs[i], &out, sizeof(uint64_t));
+                ExpandOPRFOutput(out, &outputs[i * outputWords], outputWords);
+            }
+            receiver.sendCorrection(laneChls[t], end - begin);
+        });
 
-        kkrtreceiver.sendCorrection(chl, n);
         return outputs;
     }
 
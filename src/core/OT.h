@@ -6,6 +6,7 @@
 #include "libOTe/NChooseOne/Kkrt/KkrtNcoOtReceiver.h"
 #include "libOTe/NChooseOne/Kkrt/KkrtNcoOtSender.h"
 #include <vector>
+#include <functional>
 
 namespace SECYAN
 {
@@ -13,18 +14,47 @@ namespace SECYAN
 	class OT
 	{
 	public:
-		void Init(osuCrypto::Channel &chl, bool isServer);
+		// chls[0] is used for the base OTs and the IKNP OTs, each channel is a lane of the OPRF
+		void Init(std::vector<osuCrypto::Channel> &chls, bool isServer);
 		void Send(std::vector<uint64_t> &msg0, std::vector<uint64_t> &msg1);
 		std::vector<uint64_t> Recv(std::vector<uint32_t> &selectBits);
-		std::vector<std::vector<uint64_t>> OPRFSend(std::vector<std::vector<uint64_t>> &inputs);
-		std::vector<uint64_t> OPRFRecv(std::vector<uint64_t> &inputs);
+		// numWords * 64 random AND triples of XOR shares packed 64 per word, (a ^ a') & (b ^ b') = c ^ c' with the other party's a', b', c'
+		// Both parties call it with the same numWords
+		void ANDTriples(size_t numWords, std::vector<uint64_t> &a, std::vector<uint64_t> &b, std::vector<uint64_t> &c);
+		// Offline phase: fill the pool up to numOTs random OTs in each direction. While the pool has enough OTs for a call,
+		// Send and Recv derandomize pooled OTs instead of running the OT extension: the receiver sends its choice bits xor
+		// the random ones, and the sender answers with its messages masked by the random ones. Both parties call it with the same numOTs
+		void Preprocess(size_t numOTs);
+		// The random OTs left in the pool as the sender and as the receiver. The sender pool of one party
+		// matches the receiver pool of the other
+		size_t PooledSendOTs();
+		size_t PooledRecvOTs();
+		// Bin i holds inputs[offsets[i], offsets[i + 1]), the outputs have the same layout
+		// Input k has outputWords independent output words outputs[k * outputWords, (k + 1) * outputWords)
+		std::vector<uint64_t> OPRFSend(const std::vector<uint64_t> &inputs, const std::vector<uint32_t> &offsets, uint32_t outputWords = 1);
+		std::vector<uint64_t> OPRFRecv(std::vector<uint64_t> &inputs, uint32_t outputWords = 1);
+		// The number of lanes (threads) used by OPRFSend and OPRFRecv, at most the number of channels given to Init
+		// Both parties must use the same number
+		void SetNumThreads(uint32_t numThreads);
+		uint32_t GetNumThreads();
 
 	private:
 		osuCrypto::Channel chl;
+		bool isServer;
+		// Pooled random OTs from index poolUsed on: as the sender the messages sendPool0[i], sendPool1[i],
+		// as the receiver the choice bits recvChoices[i] and the messages recvPool[i] = (recvChoices[i] ? sendPool1 : sendPool0)[i] of the other party
+		std::vector<uint64_t> sendPool0, sendPool1, recvPool;
+		std::vector<uint8_t> recvChoices;
+		size_t sendPoolUsed = 0, recvPoolUsed = 0;
 		osuCrypto::IknpOtExtSender iknpsender;
 		osuCrypto::IknpOtExtReceiver iknpreceiver;
-		osuCrypto::KkrtNcoOtSender kkrtsender;
-		osuCrypto::KkrtNcoOtReceiver kkrtreceiver;
+		// One KKRT instance per lane, split from the first one after the base OTs
+		std::vector<osuCrypto::Channel> laneChls;
+		std::vector<osuCrypto::KkrtNcoOtSender> kkrtsenders;
+		std::vector<osuCrypto::KkrtNcoOtReceiver> kkrtreceivers;
+		uint32_t numThreads = 1;
+		// Split n bins into lanes and run func(lane, begin, end) for each lane on its own thread
+		void RunLanes(size_t n, const std::function<void(uint32_t, size_t, size_t)> &func);
 		void GenBaseOTs1();
 		void GenBaseOTs2();
 	};
@@ -1,5 +1,6 @@
 #include "PSI.h"
 #include "poly.h"
+#include "cuckoo.h"
 #include "MurmurHash3.h"
 #include "OEP.h"
 #include <algorithm>
@@ -10,110 +11,126 @@
 #include <iostream>
 #include "RNG.h"
 #include "party.h"
+#include "threadpool.h"
+#include <random>
 #include <cassert>
 
 namespace SECYAN
 {
 	using namespace std;
 
-	// In the hash arrays, we use the first 3 elements as values of 3 hash functions that assgin elements to different bins
-	// We use the last element as the value of second level hashing that maps elements to domain 2^32, which is only expected to have no collision for each bin
-	inline void SingleHash(uint64_t ele, uint32_t *outarr)
+	// The first numHashes words of the hash array of an element are its hash values for the cuckoo and simple hashing
+	inline void SingleHash(uint64_t ele, uint32_t seed, uint32_t *outarr)
 	{
-		MurmurHash3_x64_128((char *)&ele, 8, 14131, outarr);
+		MurmurHash3_x64_128((char *)&ele, 8, seed, outarr);
 		// Must use the same seed for both SERVER and CLIENT!
 	}
 
-	void PSI::AliceCuckooHash(uint32_t **AliceHashArrs, int threshold)
+	bool PSI::AliceCuckooHash(const uint32_t *AliceHashArrs)
 	{
-		int totalThreshold = threshold * AliceSetSize;
-		AliceIndicesHashed.resize(bucketSize, EMPTY_BUCKET);
-		for (int i = 0; i < AliceSetSize; i++)
-		{
-			int index = i;
-			int bin_id;
-			uint8_t hash_id;
-			bool finished = false;
-			while (1)
-			{
-				for (hash_id = 0; hash_id < 3; hash_id++)
-				{
-					bin_id = AliceHashArrs[index][hash_id] % bucketSize;
-					if (AliceIndicesHashed[bin_id] == EMPTY_BUCKET)
-					{
-						finished = true;
-						AliceIndicesHashed[bin_id] = index;
-						break;
-					}
-				}
-				if (finished)
-					break;
-				if(totalThreshold-- < 0)
-				{
-					std::cerr << "Threshold exceeded in Cuckoo Hashing!" << std::endl;
-					std::exit(1);
-				}
-				hash_id = gRNG.NextUInt16() % 3;
-				bin_id = AliceHashArrs[index][hash_id] % bucketSize;
-				swap(index, AliceIndicesHashed[bin_id]);
-			}
-		}
+		// Without a stash: a stashed element would have to be compared with all of Bob's elements
+		CuckooTable table(bucketSize);
+		// The walk seed is private, it only changes where Alice's elements are placed
+		bool placed = table.Build(AliceHashArrs, AliceSetSize, gRNG.NextUInt64());
+		AliceIndicesHashed = table.Bins();
+		unplacedElements = table.Unplaced();
+		return placed;
 	}
 
-	void PSI::BobSimpleHash(uint32_t **BobHashArrs)
+	void PSI::BobSimpleHash(const uint32_t *BobHashArrs)
 	{
-		int locations[3];
-		BobIndexVectorsHashed.resize(bucketSize);
+		// Every element goes to its numHashes candidate bins (which are distinct), counted in the first pass and placed in the second
+		const int numHashes = CuckooTable::numHashes;
+		uint32_t partBins = bucketSize / numHashes;
+		auto binOf = [&](int i, int h) { return CuckooTable::CandidateBin(BobHashArrs[(size_t)CuckooTable::hashWords * i + h], h, partBins); };
+		simpleOffsets.assign(bucketSize + 1, 0);
 		for (int i = 0; i < BobSetSize; i++)
-		{
-			for (uint8_t hash_id = 0; hash_id < 3; hash_id++)
-			{
-				int loc = BobHashArrs[i][hash_id] % bucketSize;
-				locations[hash_id] = loc;
-				bool inserted = false;
-				for (int j = 0; j < hash_id; j++)
-					if (locations[j] == loc)
-						inserted = true;
-				if (!inserted)
-					BobIndexVectorsHashed[loc].push_back(i);
-			}
-		}
+			for (int h = 0; h < numHashes; h++)
+				simpleOffsets[binOf(i, h) + 1]++;
+		for (int j = 0; j < bucketSize; j++)
+			simpleOffsets[j + 1] += simpleOffsets[j];
+		vector<uint32_t> next(simpleOffsets.begin(), simpleOffsets.end() - 1);
+		BobIndicesHashed.resize(simpleOffsets[bucketSize]);
+		for (int i = 0; i < BobSetSize; i++)
+			for (int h = 0; h < numHashes; h++)
+				BobIndicesHashed[next[binOf(i, h)]++] = i;
 	}
 
-	PSI::PSI(const vector<uint64_t> &data, uint32_t AliceSetSize, uint32_t BobSetSize, Role role)
+	int MaxBinLoad(int m, int n)
+	{
+		if (n <= 1)
+			return m;
+		double logn = log2(n);
+		int load;
+		if (m > n * logn * 4) // Throw m balls into n bins, see  "Balls into Bins" A Simple and Tight Analysis
+			load = std::ceil((double)m / n + sqrt(2 * logn * m / n));
+		else
+			load = std::ceil(1.41 * m / n + 1.04 * logn);
+		return load + std::ceil(40 / logn * (1 - 1.0 / n));
+	}
+
+	uint64_t PSI::NumBins(uint32_t AliceSetSize, uint32_t BobSetSize)
+	{
+		// The elements fail to fit only if some s of them have fewer than s candidate bins. The smallest such set is 4 elements
+		// with the same 3 candidates, with probability at most C(n, 4) / partBins^9, and the sets of 5 or more elements add
+		// little to it: the bins of a part are chosen such that this is at most 2^-41. Beyond about 700 elements the expansion
+		// alone gives less, since the failure probability of cuckoo hashing below the load threshold (0.91 for 3 hash
+		// functions) decreases polynomially in n
+		const int numHashes = CuckooTable::numHashes;
+		double n = AliceSetSize;
+		double smallSetBins = std::ceil(std::pow(n * (n - 1) * (n - 2) * (n - 3) / 24 * std::pow(2.0, 41), 1.0 / 9));
+		uint64_t partBins = max({(uint64_t)std::ceil(cuckooExpansion * AliceSetSize / numHashes), (uint64_t)smallSetBins,
+								 ((uint64_t)BobSetSize / 256 + numHashes) / numHashes});
+		return numHashes * partBins;
+	}
+
+	bool PSI::Fits(uint32_t AliceSetSize, uint32_t BobSetSize)
+	{
+		return NumBins(AliceSetSize, BobSetSize) <= (uint64_t)maxBucketSize && (uint64_t)CuckooTable::numHashes * BobSetSize <= UINT32_MAX;
+	}
+
+	size_t PSI::MemoryBytes(uint32_t AliceSetSize, uint32_t BobSetSize, int numPayloadOutputs)
+	{
+		size_t numBins = NumBins(AliceSetSize, BobSetSize);
+		size_t gamma = 40 + floor_log2(numBins);
+		size_t numOutputs = (gamma + indicatorLaneBits - 1) / indicatorLaneBits + numPayloadOutputs;
+		// Per bin: the OPRF code word (512 bits) with its correction, the outputs and masks, and the bit planes of the equality
+		// test with their AND triples
+		size_t binBytes = 2 * 64 + 2 * numOutputs * sizeof(uint64_t) + 4 * gamma / 8;
+		// Alice: the hash arrays and the cuckoo table. Bob: the hash arrays and the simple table with its OPRF outputs, which
+		// are encoded into about as many slots or coefficients
+		size_t aliceBytes = AliceSetSize * CuckooTable::hashWords * sizeof(uint32_t) + numBins * (3 * sizeof(uint32_t) + sizeof(uint64_t) + binBytes);
+		size_t bobBytes = BobSetSize * CuckooTable::hashWords * sizeof(uint32_t) + numBins * (sizeof(uint32_t) + binBytes) +
+						  (size_t)CuckooTable::numHashes * BobSetSize * (sizeof(uint32_t) + sizeof(uint64_t) + 2 * numOutputs * sizeof(uint64_t));
+		return max(aliceBytes, bobBytes);
+	}
+
+	PSI::PSI(const vector<uint64_t> &data, uint32_t AliceSetSize, uint32_t BobSetSize, Role role, int numPayloadOutputs, Backend backendType)
 	{
 		this->AliceSetSize = AliceSetSize;
 		this->BobSetSize = BobSetSize;
 		this->role = role;
-		if(AliceSetSize < 30 && BobSetSize < 30)
+		if(AliceSetSize < minSetSize && BobSetSize < minSetSize)
 		{
-			std::cerr << "Error: Intersect two sets with both sizes less than 30!" << std::endl;
+			std::cerr << "Error: Intersect two sets with both sizes less than " << minSetSize << "!" << std::endl;
 			std::exit(1);
 		}
-		bucketSize = max((uint32_t)(1.27 * AliceSetSize), 1 + BobSetSize / 256);
-		int logBucketSize = floor_log2(bucketSize);
-		if(logBucketSize >= 61 - 40)
+		if (!Fits(AliceSetSize, BobSetSize))
 		{
-			std::cerr << "Error: Bucket size exceeded in PSI!" << std::endl;
+			std::cerr << "Error: Set sizes exceed the limits of the PSI (2^31 - 1 bins)!" << std::endl;
 			std::exit(1);
 		}
-		int numBinsInMegabin = max((int)(bucketSize * log2(bucketSize) / BobSetSize), 1);
-		numMegabins = (bucketSize + numBinsInMegabin - 1) / numBinsInMegabin;
-		int m = 3 * BobSetSize;
-		int n = numMegabins;
-		double logn = 0;
-		if (n > 1)
-			logn = log2(n);
-		if (m > n * logn * 4) // Throw m balls into n bins, see  "Balls into Bins" A Simple and Tight Analysis
-			megaBinLoad = std::ceil((double)m / n + sqrt(2 * logn * m / n));
+		const int numHashes = CuckooTable::numHashes;
+		bucketSize = NumBins(AliceSetSize, BobSetSize);
+		// Every element of Bob has numHashes keys (one per candidate bin)
+		if (backendType == OKVS)
+			backend.reset(new OKVSBackend(numHashes * BobSetSize));
 		else
-			megaBinLoad = std::ceil(1.41 * m / n + 1.04 * logn);
-		if (n > 1)
-			megaBinLoad += std::ceil(40 / logn * (1 - 1.0 / n));
-		else
-			megaBinLoad = m;
-		// In any case, the load is at most 3*256+20=778
-		gamma = 40 + logBucketSize;
+			backend.reset(new PolynomialBackend(bucketSize, numHashes * BobSetSize, BobSetSize));
+		// A false match in any bin with probability at most 2^-40, the masks are compared on 61 bits per lane
+		gamma = 40 + floor_log2(bucketSize);
+		indicatorLanes = (gamma + indicatorLaneBits - 1) / indicatorLaneBits;
+		numOutputs = indicatorLanes + numPayloadOutputs;
 		if (role == Alice)
 			AlicePrepare(data);
 		else
@@ -124,24 +141,20 @@ namespace SECYAN
 	{
 		//gParty.Tick("OPRF");
 		// Alice builds hash table
-		uint32_t **AliceHashArrs = new uint32_t *[AliceSetSize];
+		vector<uint32_t> AliceHashArrs((size_t)CuckooTable::hashWords * AliceSetSize);
 		for (int i = 0; i < AliceSetSize; i++)
-		{
-			AliceHashArrs[i] = new uint32_t[4];
-			SingleHash(AliceSet[i], AliceHashArrs[i]);
-		}
-
-		AliceCuckooHash(AliceHashArrs);
+			SingleHash(AliceSet[i], hashSeed, &AliceHashArrs[(size_t)CuckooTable::hashWords * i]);
+		// With negligible probability some elements do not fit, then they are not found in the intersection, like an element
+		// whose equality test fails (see CuckooToAliceArray). Exiting or rehashing would leak Alice's set
+		if (!AliceCuckooHash(AliceHashArrs.data()))
+			std::cerr << "Warning: " << unplacedElements.size() << " elements do not fit in the cuckoo table!" << std::endl;
 		cuckooTable.resize(bucketSize);
 		for (int i = 0; i < bucketSize; i++)
 		{
 			int index = AliceIndicesHashed[i];
 			cuckooTable[i] = index == EMPTY_BUCKET ? EMPTY_BUCKET : AliceSet[index];
 		}
-		encCuckooTable = gParty.OPRFRecv(cuckooTable);
-		for (int i = 0; i < AliceSetSize; i++)
-			delete[] AliceHashArrs[i];
-		delete[] AliceHashArrs;
+		encCuckooTable = gParty.OPRFRecv(cuckooTable, numOutputs);
 		//gParty.Tick("OPRF");
 	}
 
@@ -149,126 +162,115 @@ namespace SECYAN
 	{
 		//gParty.Tick("OPRF");
 		// Bob builds hash table
-		uint32_t **BobHashArrs = new uint32_t *[BobSetSize];
+		vector<uint32_t> BobHashArrs((size_t)CuckooTable::hashWords * BobSetSize);
 		for (int i = 0; i < BobSetSize; i++)
-		{
-			BobHashArrs[i] = new uint32_t[4];
-			SingleHash(BobSet[i], BobHashArrs[i]);
-		}
-		BobSimpleHash(BobHashArrs);
-		simpleTable.resize(bucketSize);
-		for (int i = 0; i < bucketSize; i++)
-		{
-			simpleTable[i].reserve(BobIndexVectorsHashed[i].size());
-			for (int index : BobIndexVectorsHashed[i])
-				simpleTable[i].push_back(BobSet[index]);
-		}
-		encSimpleTable = gParty.OPRFSend(simpleTable);
-		for (int i = 0; i < BobSetSize; i++)
-			delete[] BobHashArrs[i];
-		delete[] BobHashArrs;
+			SingleHash(BobSet[i], hashSeed, &BobHashArrs[(size_t)CuckooTable::hashWords * i]);
+		BobSimpleHash(BobHashArrs.data());
+		simpleTable.resize(BobIndicesHashed.size());
+		for (size_t k = 0; k < BobIndicesHashed.size(); k++)
+			simpleTable[k] = BobSet[BobIndicesHashed[k]];
+		encSimpleTable = gParty.OPRFSend(simpleTable, simpleOffsets, numOutputs);
 		//gParty.Tick("OPRF");
 	}
 
-	inline uint64_t PSI_combine(uint64_t v, uint64_t j)
+	vector<vector<uint64_t>> PSI::AliceIntersect(int numResults)
 	{
-		return (v & 0x1ffffffffff) | (j << 40);
+		vector<int> bins;
+		vector<uint64_t> elements;
+		for (int j = 0; j < bucketSize; j++)
+			if (AliceIndicesHashed[j] != EMPTY_BUCKET)
+			{
+				bins.push_back(j);
+				elements.push_back(cuckooTable[j]);
+			}
+		auto values = backend->Decode(bins, elements, numResults);
+		size_t n = elements.size();
+		vector<vector<uint64_t>> AliceT(numResults, vector<uint64_t>(bucketSize));
+		for (int t = 0; t < numResults; t++)
+			for (size_t k = 0; k < n; k++)
+				AliceT[t][bins[k]] = values[t * n + k] ^ encCuckooTable[(size_t)bins[k] * numOutputs + t];
+		return AliceT;
 	}
 
 	vector<uint64_t> PSI::AliceIntersect()
 	{
-		auto circ = gParty.GetCircuit(S_BOOL);
-		vector<uint64_t> AliceT(bucketSize);
-		uint64_t *coeff = new uint64_t[numMegabins * megaBinLoad];
-		uint32_t bitlen, nvals;
-		gParty.Recv(coeff, numMegabins * megaBinLoad);
-		int remainder = bucketSize % numMegabins;
-		int division = bucketSize / numMegabins;
-		int startBinId = 0;
-		for (int i = 0; i < numMegabins; i++)
-		{
-			int endBinId = startBinId + division + (i < remainder);
-			for (int j = startBinId; j < endBinId; j++)
-				if (AliceIndicesHashed[j] != EMPTY_BUCKET)
-					AliceT[j] = poly_eval(coeff + i * megaBinLoad, PSI_combine(cuckooTable[j], j), megaBinLoad) ^ encCuckooTable[j];
-			startBinId = endBinId;
-		}
-		delete[] coeff;
-		return AliceT;
+		return std::move(AliceIntersect(1)[0]);
 	}
 
-	vector<uint64_t> PSI::BobIntersect(vector<uint32_t> &payload, bool arith)
+	vector<vector<uint64_t>> PSI::BobIntersect(const vector<const vector<uint32_t> *> &payloads, const vector<bool> &arith)
 	{
-		vector<uint64_t> BobT(bucketSize);
-		// polynomial communication
-		uint64_t *pointX = new uint64_t[megaBinLoad];
-		uint64_t *pointY = new uint64_t[megaBinLoad];
-		uint64_t *coeff = new uint64_t[megaBinLoad * numMegabins];
-		for (int i = 0; i < bucketSize; i++)
-			BobT[i] = gRNG.NextUInt64();
-
-		int remainder = bucketSize % numMegabins;
-		int division = bucketSize / numMegabins;
-		int startBinId = 0;
-		for (int i = 0; i < numMegabins; i++)
-		{
-			int endBinId = startBinId + division + (i < remainder);
-			int pointId = 0;
-			for (int j = startBinId; j < endBinId; j++)
-			{
-				for (int k = 0; k < simpleTable[j].size(); k++)
+		int numResults = payloads.size();
+		vector<vector<uint64_t>> BobT(numResults, vector<uint64_t>(bucketSize));
+		for (int j = 0; j < bucketSize; j++)
+			for (int t = 0; t < numResults; t++)
+				BobT[t][j] = gRNG.NextUInt64();
+		// Key k of bin j has the values OPRF(key) ^ (payload - BobT[t][j]) (or ^ (payload ^ BobT[t][j]) if !arith[t])
+		size_t n = simpleTable.size();
+		vector<uint64_t> values(numResults * n);
+		gThreadPool.ParallelRange(bucketSize, [&](size_t begin, size_t end) {
+			for (size_t j = begin; j < end; j++)
+				for (uint32_t k = simpleOffsets[j]; k < simpleOffsets[j + 1]; k++)
 				{
-					pointX[pointId] = PSI_combine(simpleTable[j][k], j);
-					auto tmp = arith ? payload[BobIndexVectorsHashed[j][k]] - BobT[j] : payload[BobIndexVectorsHashed[j][k]] ^ BobT[j];
-					pointY[pointId] = (encSimpleTable[j][k] ^ tmp) & poly_modulus;
-					pointId++;
+					for (int t = 0; t < numResults; t++)
+					{
+						// A null payload is all zero
+						uint32_t value = payloads[t] ? (*payloads[t])[BobIndicesHashed[k]] : 0;
+						auto tmp = arith[t] ? value - BobT[t][j] : value ^ BobT[t][j];
+						values[t * n + k] = encSimpleTable[(size_t)k * numOutputs + t] ^ tmp;
+					}
 				}
-			}
-			if(pointId > megaBinLoad)
-			{
-				std::cerr << "Error: Mega-bin load not enough!" << std::endl;
-				std::exit(1);
-			}
-			while (pointId < megaBinLoad)
-			{
-				pointX[pointId] = poly_modulus - pointId;
-				pointY[pointId] = gRNG.NextUInt32();
-				pointId++;
-			}
-			interpolate(pointX, pointY, megaBinLoad, coeff + i * megaBinLoad);
-			startBinId = endBinId;
-		}
-		gParty.Send(coeff, megaBinLoad * numMegabins);
-		delete[] pointX;
-		delete[] pointY;
-		delete[] coeff;
+		});
+		backend->Encode(simpleOffsets, simpleTable, values, numResults);
 		return BobT;
 	}
 
+	vector<uint64_t> PSI::BobIntersect(vector<uint32_t> &payload, bool arith)
+	{
+		return std::move(BobIntersect({&payload}, {arith})[0]);
+	}
+
+	int PSI::QueueEqualityTest(EqualityTester &tester, vector<vector<uint64_t>> &masks)
+	{
+		// The masks of all lanes must be equal, gamma bits in total
+		vector<int> laneBits(indicatorLanes);
+		for (int l = 0; l < indicatorLanes; l++)
+			laneBits[l] = min(indicatorLaneBits, gamma - l * indicatorLaneBits);
+		return tester.Add(masks, laneBits);
+	}
+
+	vector<uint32_t> PSI::EqualityIndicator(vector<vector<uint64_t>> &masks)
+	{
+		EqualityTester tester;
+		int handle = QueueEqualityTest(tester, masks);
+		tester.Execute();
+		return tester.Result(handle);
+	}
+
 	// return the indicator
 	vector<uint32_t> PSI::Intersect()
 	{
 		//gParty.Tick("Intersection");
-		auto circ = gParty.GetCircuit(S_BOOL);
-		vector<uint32_t> payload(BobSetSize, 0);
-		vector<uint64_t> mask;
+		EqualityTester tester;
+		QueueIntersect(tester);
+		tester.Execute();
+		//gParty.Tick("Intersection");
+		return IntersectResult(tester);
+	}
+
+	void PSI::QueueIntersect(EqualityTester &tester)
+	{
+		vector<vector<uint64_t>> masks;
 		if (role == Alice)
-			mask = AliceIntersect();
+			masks = AliceIntersect(indicatorLanes);
 		else
-			mask = BobIntersect(payload, false);
-		auto s1 = circ->PutSIMDINGate(bucketSize, mask.data(), gamma, SERVER);
-		auto s2 = circ->PutSIMDINGate(bucketSize, mask.data(), gamma, CLIENT);
-		auto eq = circ->PutEQGate(s1, s2);
-		auto s_out = circ->PutSharedOUTGate(eq);
-		gParty.ExecCircuit();
-		uint32_t *indicator;
-		uint32_t nvals, bitlen;
-		s_out->get_clear_value_vec(&indicator, &bitlen, &nvals);
-		vector<uint32_t> v_indicator(indicator, indicator + bucketSize);
-		gParty.Reset();
-		delete[] indicator;
-		//gParty.Tick("Intersection");
-		return v_indicator;
+			masks = BobIntersect(vector<const vector<uint32_t> *>(indicatorLanes, nullptr), vector<bool>(indicatorLanes, false));
+		eqHandle = QueueEqualityTest(tester, masks);
+	}
+
+	vector<uint32_t> PSI::IntersectResult(const EqualityTester &tester)
+	{
+		assert(eqHandle >= 0);
+		return tester.Result(eqHandle);
 	}
 
 	// return the payload_mask
@@ -293,24 +295,21 @@ namespace SECYAN
 		return result;
 	}
 
-	vector<uint32_t> PSI::BobPermutePayloadAlicePart(vector<uint32_t> &indicator)
+	void PSI::BobRandomPermutation(vector<uint32_t> &rp1, vector<uint32_t> &invrp1)
 	{
-		vector<uint32_t> tmp(bucketSize);
 		int extendShareSize = BobSetSize + bucketSize;
-
-		vector<uint32_t> rp1(extendShareSize), invrp1(extendShareSize);
+		rp1.resize(extendShareSize);
+		invrp1.resize(extendShareSize);
 		for (int i = 0; i < extendShareSize; ++i)
 			rp1[i] = i;
 
 		shuffle(rp1.begin(), rp1.end(), gRNG.stdrng);
 		for (int i = 0; i < extendShareSize; ++i)
 			invrp1[rp1[i]] = i;
+	}
 
-		std::vector<uint32_t> zero(extendShareSize, 0);
-		auto out = PermutorPermute(rp1, zero);
-
-		vector<uint64_t> BobRev = BobIntersect(invrp1, false);
-
+	void PSI::BobRevealIndices(vector<uint32_t> &invrp1, vector<uint64_t> &BobRev, vector<uint32_t> &indicator)
+	{
 		// modify PSI, if indicator1[i] ^ indicator2[i] = true, remain (AliceRev, BobRev); else change AliceRev + BobRev = pi^-1(B+i)
 		auto circ = gParty.GetCircuit(S_BOOL);
 		auto s_m0 = circ->PutSIMDINGate(bucketSize, invrp1.data() + BobSetSize, 32, gParty.GetRole());
@@ -320,18 +319,10 @@ namespace SECYAN
 		circ->PutOUTGate(s_mux, gParty.GetRevRole());
 		gParty.ExecCircuit();
 		gParty.Reset();
-		return SenderExtendedPermute(out, bucketSize);
 	}
 
-	vector<uint32_t> PSI::AlicePermutePayloadAlicePart(vector<uint32_t> &payload, vector<uint32_t> &indicator)
+	vector<uint32_t> PSI::AliceRevealIndices(vector<uint64_t> &AliceRev, vector<uint32_t> &indicator)
 	{
-		int extendShareSize = BobSetSize + bucketSize;
-
-		// each party extend the shares
-		vector<uint32_t> extendValueShare(payload);
-		extendValueShare.resize(extendShareSize, 0);
-		auto out = SenderPermute(extendValueShare);
-		vector<uint64_t> AliceRev = AliceIntersect();
 		auto circ = gParty.GetCircuit(S_BOOL);
 		auto s_m0 = circ->PutDummySIMDINGate(bucketSize, 32);
 		auto s_m1 = circ->PutSharedSIMDINGate(bucketSize, AliceRev.data(), 32);
@@ -343,6 +334,32 @@ namespace SECYAN
 		s_k->get_clear_value_vec(&ki, &bitlen, &nvals);
 		gParty.Reset();
 		std::vector<uint32_t> vki(ki, ki + bucketSize);
+		delete[] ki;
+		return vki;
+	}
+
+	vector<uint32_t> PSI::BobPermutePayloadAlicePart(vector<uint32_t> &indicator)
+	{
+		vector<uint32_t> rp1, invrp1;
+		BobRandomPermutation(rp1, invrp1);
+		std::vector<uint32_t> zero(rp1.size(), 0);
+		auto out = PermutorPermute(rp1, zero);
+
+		vector<uint64_t> BobRev = BobIntersect(invrp1, false);
+		BobRevealIndices(invrp1, BobRev, indicator);
+		return SenderExtendedPermute(out, bucketSize);
+	}
+
+	vector<uint32_t> PSI::AlicePermutePayloadAlicePart(vector<uint32_t> &payload, vector<uint32_t> &indicator)
+	{
+		int extendShareSize = BobSetSize + bucketSize;
+
+		// each party extend the shares
+		vector<uint32_t> extendValueShare(payload);
+		extendValueShare.resize(extendShareSize, 0);
+		auto out = SenderPermute(extendValueShare);
+		vector<uint64_t> AliceRev = AliceIntersect();
+		auto vki = AliceRevealIndices(AliceRev, indicator);
 		return PermutorExtendedPermute(vki, out);
 	}
 
@@ -376,16 +393,92 @@ namespace SECYAN
 		return payload2;
 	}
 
+	vector<uint32_t> PSI::IntersectWithPayloads(const vector<vector<uint32_t> *> &payloads, bool sharedPayloads, vector<vector<uint32_t>> &results)
+	{
+		int numPayloads = payloads.size();
+		int numResults = indicatorLanes + NumPayloadOutputs(numPayloads, sharedPayloads);
+		if (numResults > numOutputs)
+		{
+			std::cerr << "Error: Not enough PSI outputs for the payloads!" << std::endl;
+			std::exit(1);
+		}
+		// The first results are the lanes of the indicator, then payload t is result indicatorLanes + t,
+		// and if the payloads are shared, the last result is invrp1
+		vector<vector<uint64_t>> masks;
+		vector<uint32_t> rp1, invrp1;
+		if (role == Alice)
+			masks = AliceIntersect(numResults);
+		else
+		{
+			vector<const vector<uint32_t> *> BobPayloads(indicatorLanes, nullptr);
+			vector<bool> arith(indicatorLanes, false);
+			for (auto payload : payloads)
+			{
+				BobPayloads.push_back(payload);
+				arith.push_back(true);
+			}
+			if (sharedPayloads)
+			{
+				BobRandomPermutation(rp1, invrp1);
+				BobPayloads.push_back(&invrp1);
+				arith.push_back(false);
+			}
+			masks = BobIntersect(BobPayloads, arith);
+		}
+		auto indicator = EqualityIndicator(masks);
+		results.resize(numPayloads);
+		for (int t = 0; t < numPayloads; t++)
+			results[t].assign(masks[indicatorLanes + t].begin(), masks[indicatorLanes + t].end());
+		if (!sharedPayloads)
+			return indicator;
+
+		// As CombineSharedPayload, but all payloads are permuted by the same rp1, so the indices are revealed once
+		int extendShareSize = BobSetSize + bucketSize;
+		vector<vector<uint32_t>> permuted(numPayloads);
+		for (int t = 0; t < numPayloads; t++)
+		{
+			if (role == Alice)
+			{
+				vector<uint32_t> extendValueShare(*payloads[t]);
+				extendValueShare.resize(extendShareSize, 0);
+				permuted[t] = SenderPermute(extendValueShare);
+			}
+			else
+			{
+				vector<uint32_t> zero(extendShareSize, 0);
+				permuted[t] = PermutorPermute(rp1, zero);
+			}
+		}
+		vector<uint32_t> vki;
+		if (role == Alice)
+			vki = AliceRevealIndices(masks[indicatorLanes + numPayloads], indicator);
+		else
+			BobRevealIndices(invrp1, masks[indicatorLanes + numPayloads], indicator);
+		for (int t = 0; t < numPayloads; t++)
+		{
+			auto payload2 = role == Alice ? PermutorExtendedPermute(vki, permuted[t]) : SenderExtendedPermute(permuted[t], bucketSize);
+			for (int i = 0; i < bucketSize; i++)
+				results[t][i] += payload2[i];
+		}
+		return indicator;
+	}
+
 	vector<uint32_t> PSI::CuckooToAliceArray()
 	{
 		assert(role == Alice);
 		vector<uint32_t> permutedIndices(AliceSetSize);
+		int emptyBin = 0;
 		for (int i = 0; i < bucketSize; i++)
 		{
 			int index = AliceIndicesHashed[i];
 			if (index != EMPTY_BUCKET)
 				permutedIndices[index] = i;
+			else
+				emptyBin = i;
 		}
+		// The elements that do not fit take the results of an empty bin (not in the intersection)
+		for (auto index : unplacedElements)
+			permutedIndices[index] = emptyBin;
 		return permutedIndices;
 	}
 
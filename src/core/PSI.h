@@ -1,13 +1,27 @@
 #pragma once
 #include <vector>
 #include <cstdint>
+#include <memory>
+#include "psibackend.h"
+#include "eqtest.h"
 
 namespace SECYAN
 {
+	// An upper bound of the maximum load when throwing m balls into n bins (except with probability about 2^-40)
+	int MaxBinLoad(int m, int n);
+
 	class PSI
 	{
 	public:
 		const int EMPTY_BUCKET = -1;
+		// Cuckoo hashing (see cuckoo.h): the bins per element of Alice. The hash functions are public, so the table is sized for
+		// a negligible failure probability (see NumBins) instead of rehashing, which would leak Alice's set
+		static constexpr double cuckooExpansion = 1.27;
+		// One of the sets must have at least this many elements
+		static const uint32_t minSetSize = 30;
+		// Bins are indexed by int, the elements of a bin are identified by hashing them with the bin (see psibackend.h)
+		// So a PSI has at most 2^31 - 1 bins, i.e. about 1.69G elements of Alice (see NumBins)
+		static const int maxBucketSize = INT32_MAX;
 		int bucketSize;
 
 		enum Role
@@ -15,30 +29,73 @@ namespace SECYAN
 			Alice,
 			Bob
 		};
-		PSI(const std::vector<uint64_t> &data, uint32_t AliceSetSize, uint32_t BobSetSize, Role role);
+		// How Bob encodes his OPRF values for Alice (see psibackend.h), both parties must choose the same
+		enum Backend
+		{
+			Polynomial,
+			OKVS
+		};
+		// numPayloadOutputs: the number of payload results one encoding can carry besides the indicator (see IntersectWithPayloads)
+		PSI(const std::vector<uint64_t> &data, uint32_t AliceSetSize, uint32_t BobSetSize, Role role, int numPayloadOutputs = 0, Backend backendType = Polynomial);
 		// Without payload, return indicator: indicator[i](Alice) + indicator[i](Bob) = 1 iff A[i]\in B
 		std::vector<uint32_t> Intersect();
+		// Intersect in two steps, so that the equality tests of several PSIs share one execution of tester:
+		// QueueIntersect for every PSI, then tester.Execute(), then IntersectResult for every PSI
+		void QueueIntersect(EqualityTester &tester);
+		std::vector<uint32_t> IntersectResult(const EqualityTester &tester);
 		// (Called by Alice) With payload, result[i](Alice) + result[i](Bob) = payload[j] if A[i]=B[j]
 		std::vector<uint32_t> IntersectWithPayload();
 		// Called by Bob. If called by Alice, then payload will be ignored
 		std::vector<uint32_t> IntersectWithPayload(std::vector<uint32_t> &payload);
 		std::vector<uint32_t> CombineSharedPayload(std::vector<uint32_t> &payload, std::vector<uint32_t> &indicator);
+		// The indicator (as Intersect) and results[t] for payloads[t] (as IntersectWithPayload, or as CombineSharedPayload if
+		// sharedPayloads) from a single encoding. The PSI needs NumPayloadOutputs(payloads.size(), sharedPayloads) payload outputs
+		// If the payloads are Bob's, Alice passes null pointers (one per payload)
+		std::vector<uint32_t> IntersectWithPayloads(const std::vector<std::vector<uint32_t> *> &payloads, bool sharedPayloads, std::vector<std::vector<uint32_t>> &results);
+		static int NumPayloadOutputs(int numPayloads, bool sharedPayloads) { return numPayloads + (sharedPayloads ? 1 : 0); }
+		// The number of bins of the cuckoo table (bucketSize)
+		static uint64_t NumBins(uint32_t AliceSetSize, uint32_t BobSetSize);
+		// Whether the sets are within the limits of the PSI: at most maxBucketSize bins and 2^32 - 1 entries of Bob's simple
+		// hashing table
+		static bool Fits(uint32_t AliceSetSize, uint32_t BobSetSize);
+		// An estimate of the bytes a party allocates in a PSI (the larger of the two roles): the hash tables, the OPRF, the
+		// encoding of Bob's OPRF values and the equality test
+		static size_t MemoryBytes(uint32_t AliceSetSize, uint32_t BobSetSize, int numPayloadOutputs);
 		std::vector<uint32_t> CuckooToAliceArray();
 		std::vector<uint32_t> GetIndicators(std::vector<uint64_t> &mask);
 
 	private:
-		int AliceSetSize, BobSetSize, numMegabins, megaBinLoad, gamma;
+		// The indicator compares gamma bits of masks, which take indicatorLanes results of indicatorLaneBits bits (the field size)
+		static const int indicatorLaneBits = 61;
+		int AliceSetSize, BobSetSize, gamma, indicatorLanes, numOutputs;
+		static const uint32_t hashSeed = 14131; // the seed of the hash functions, public
 		Role role;
+		std::unique_ptr<PSIBackend> backend;
+		// The OPRF output t of the element in bin j is encCuckooTable[j * numOutputs + t] (encSimpleTable likewise)
 		std::vector<uint64_t> cuckooTable, encCuckooTable;
-		std::vector<std::vector<uint64_t>> simpleTable, encSimpleTable;
-		std::vector<int> AliceIndicesHashed;
-		std::vector<std::vector<int>> BobIndexVectorsHashed;
-		void AliceCuckooHash(uint32_t **AliceHashArrs, int threshold = 3);
-		void BobSimpleHash(uint32_t **BobHashArrs);
+		// Simple hashing tables in CSR layout: bin j holds the entries [simpleOffsets[j], simpleOffsets[j + 1])
+		std::vector<uint32_t> simpleOffsets;
+		std::vector<uint64_t> simpleTable, encSimpleTable;
+		std::vector<int> AliceIndicesHashed, BobIndicesHashed;
+		// The hash arrays of element i are hashArrs[4 * i, 4 * i + 4), false if cuckoo hashing fails (then the elements
+		// unplacedElements are in no bin)
+		bool AliceCuckooHash(const uint32_t *AliceHashArrs);
+		std::vector<uint32_t> unplacedElements;
+		void BobSimpleHash(const uint32_t *BobHashArrs);
 		void AlicePrepare(const std::vector<uint64_t> &AliceSet);
 		void BobPrepare(const std::vector<uint64_t> &BobSet);
+		// One encoding of numResults values per key, result t masks payloads[t] (all zero if null) by subtraction if arith[t], otherwise by xor
+		std::vector<std::vector<uint64_t>> AliceIntersect(int numResults);
+		std::vector<std::vector<uint64_t>> BobIntersect(const std::vector<const std::vector<uint32_t> *> &payloads, const std::vector<bool> &arith);
 		std::vector<uint64_t> AliceIntersect();
 		std::vector<uint64_t> BobIntersect(std::vector<uint32_t> &payload, bool arith);
+		// The indicator compares the gamma bits of the first indicatorLanes masks, in its own execution or queued to tester
+		std::vector<uint32_t> EqualityIndicator(std::vector<std::vector<uint64_t>> &masks);
+		int QueueEqualityTest(EqualityTester &tester, std::vector<std::vector<uint64_t>> &masks);
+		int eqHandle = -1; // the test of QueueIntersect
+		void BobRandomPermutation(std::vector<uint32_t> &rp1, std::vector<uint32_t> &invrp1);
+		void BobRevealIndices(std::vector<uint32_t> &invrp1, std::vector<uint64_t> &BobRev, std::vector<uint32_t> &indicator);
+		std::vector<uint32_t> AliceRevealIndices(std::vector<uint64_t> &AliceRev, std::vector<uint32_t> &indicator);
 		std::vector<uint32_t> BobPermutePayloadAlicePart(std::vector<uint32_t> &indicator);
 		std::vector<uint32_t> AlicePermutePayloadAlicePart(std::vector<uint32_t> &payload, std::vector<uint32_t> &indicator);
 	};
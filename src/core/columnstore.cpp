@@ -0,0 +1,540 @@
+#include "columnstore.h"
+#include "spill.h"
+#include "threadpool.h"
+#include <array>
+#include <algorithm>
+#include <numeric>
+
+namespace SECYAN
+{
+
+	Column::Column(size_t size, uint64_t value) : length(size), owned(true)
+	{
+		auto buffer = std::make_shared<std::vector<uint64_t>>(size, value);
+		ptr = buffer->data();
+		holder = std::move(buffer);
+	}
+
+	Column Column::Constant(size_t size, uint64_t value)
+	{
+		SECYAN::Column column(1, value);
+		column.length = size;
+		column.mask = 0;
+		return column;
+	}
+
+	uint64_t *Column::MutableData()
+	{
+		if (IsConstant())
+		{
+			auto buffer = std::make_shared<std::vector<uint64_t>>(length, *ptr);
+			ptr = buffer->data();
+			holder = std::move(buffer);
+			mask = ~(size_t)0;
+		}
+		else if (!owned || holder.use_count() > 1)
+		{
+			auto buffer = std::make_shared<std::vector<uint64_t>>(ptr, ptr + length);
+			ptr = buffer->data();
+			holder = std::move(buffer);
+			owned = true;
+		}
+		return const_cast<uint64_t *>(ptr);
+	}
+
+	void Column::CopyTo(uint64_t *dst) const
+	{
+		if (IsConstant())
+			std::fill(dst, dst + length, *ptr);
+		else
+			std::copy(ptr, ptr + length, dst);
+	}
+
+	// Rows below this are sorted by comparison instead of radix sort
+	const size_t minRadixSortRows = 1 << 10;
+	const size_t minRowsPerThread = 1 << 14;
+
+	const int radixBits = 11;
+	const size_t numBuckets = 1 << radixBits;
+
+	// A stable counting sort pass of positions [0, n) over numBuckets buckets, digit(i) is the bucket of position i
+	// The positions are split into numBlocks blocks, each block is counted and scattered by one task
+	template <typename Digit>
+	void RadixPass(size_t n, size_t numBlocks, const Digit &digit, std::vector<uint32_t> &perm, std::vector<uint32_t> &tmpPerm,
+				   std::vector<uint64_t> *keys, std::vector<uint64_t> *tmpKeys)
+	{
+		auto blockBegin = [&](size_t t) { return n * t / numBlocks; };
+		std::vector<std::array<size_t, numBuckets>> offsets(numBlocks);
+		gThreadPool.ParallelFor(numBlocks, [&](size_t t) {
+			auto &count = offsets[t];
+			count.fill(0);
+			for (size_t i = blockBegin(t); i < blockBegin(t + 1); i++)
+				count[digit(i)]++;
+		});
+		size_t offset = 0;
+		for (size_t b = 0; b < numBuckets; b++)
+			for (size_t t = 0; t < numBlocks; t++)
+			{
+				auto count = offsets[t][b];
+				offsets[t][b] = offset;
+				offset += count;
+			}
+		gThreadPool.ParallelFor(numBlocks, [&](size_t t) {
+			auto &offset = offsets[t];
+			for (size_t i = blockBegin(t); i < blockBegin(t + 1); i++)
+			{
+				auto pos = offset[digit(i)]++;
+				tmpPerm[pos] = perm[i];
+				if (keys)
+					(*tmpKeys)[pos] = (*keys)[i];
+			}
+		});
+		perm.swap(tmpPerm);
+		if (keys)
+			keys->swap(*tmpKeys);
+	}
+
+	ColumnStore::ColumnStore(size_t numColumns, size_t numRows)
+		: numRows(numRows), dummy(std::make_shared<std::vector<bool>>(numRows, false))
+	{
+		for (size_t j = 0; j < numColumns; j++)
+			columns.emplace_back(numRows);
+		dictionaries.resize(numColumns);
+	}
+
+	ColumnStore::ColumnStore(std::vector<SECYAN::Column> columns, size_t numRows)
+		: numRows(numRows), columns(std::move(columns)), dummy(std::make_shared<std::vector<bool>>(numRows, false))
+	{
+		dictionaries.resize(this->columns.size());
+		for (auto &column : this->columns)
+			assert(column.size() == numRows);
+	}
+
+	bool ColumnStore::Less(size_t i, size_t j) const
+	{
+		if ((*dummy)[i]) // ensure that a<b and b<a cannot be both true
+			return false;
+		if ((*dummy)[j])
+			return true;
+		assert(columns.size() > 0 && "Tuples not comparable!");
+		for (auto &column : columns)
+			if (column[i] != column[j])
+				return column[i] < column[j];
+		return false;
+	}
+
+	bool ColumnStore::Equal(size_t i, size_t j) const
+	{
+		if ((*dummy)[i] || (*dummy)[j])
+			return (*dummy)[i] && (*dummy)[j];
+		for (auto &column : columns)
+			if (column[i] != column[j])
+				return false;
+		return true;
+	}
+
+	void ColumnStore::GetRow(size_t i, uint64_t *out) const
+	{
+		for (size_t j = 0; j < columns.size(); j++)
+			out[j] = columns[j][i];
+	}
+
+	void ColumnStore::GetKeyRow(size_t i, uint64_t *out) const
+	{
+		for (size_t j = 0; j < columns.size(); j++)
+			out[j] = GetKey(i, j);
+	}
+
+	std::vector<uint32_t> ColumnStore::SortIndices(size_t begin, size_t end, bool dummiesLast) const
+	{
+		assert(tail.empty() && begin <= end && end <= numRows);
+		size_t n = end - begin;
+		std::vector<uint32_t> perm(n);
+		std::iota(perm.begin(), perm.end(), begin);
+		if (n < minRadixSortRows)
+		{
+			std::stable_sort(perm.begin(), perm.end(), [&](uint32_t i, uint32_t j) {
+				if (dummiesLast)
+					return Less(i, j);
+				for (auto &column : columns)
+					if (column[i] != column[j])
+						return column[i] < column[j];
+				return false;
+			});
+			return perm;
+		}
+
+		// LSD radix sort: digits from the least significant one, columns from the last one, and finally the dummy flags
+		size_t numBlocks = std::max<size_t>(1, std::min<size_t>(gThreadPool.GetNumThreads(), n / minRowsPerThread));
+		auto blockBegin = [&](size_t t) { return n * t / numBlocks; };
+		std::vector<uint32_t> tmpPerm(n);
+		std::vector<uint64_t> keys(n), tmpKeys(n);
+		std::vector<uint64_t> blockDiffs(numBlocks);
+		for (size_t j = columns.size(); j-- > 0;)
+		{
+			if (columns[j].IsConstant())
+				continue;
+			// The keys in the current order, and the bits that are not the same in all keys
+			auto column = columns[j].data();
+			auto first = column[perm[0]];
+			gThreadPool.ParallelFor(numBlocks, [&](size_t t) {
+				uint64_t diff = 0;
+				for (size_t i = blockBegin(t); i < blockBegin(t + 1); i++)
+				{
+					keys[i] = column[perm[i]];
+					diff |= keys[i] ^ first;
+				}
+				blockDiffs[t] = diff;
+			});
+			uint64_t diff = 0;
+			for (auto blockDiff : blockDiffs)
+				diff |= blockDiff;
+			for (int shift = 0; shift < 64; shift += radixBits)
+			{
+				if ((diff >> shift & (numBuckets - 1)) == 0) // a constant digit
+					continue;
+				RadixPass(n, numBlocks, [&](size_t i) { return keys[i] >> shift & (numBuckets - 1); }, perm, tmpPerm, &keys, &tmpKeys);
+			}
+		}
+		bool hasDummy = false;
+		for (size_t i = begin; i < end && dummiesLast && !hasDummy; i++)
+			hasDummy = (*dummy)[i];
+		if (hasDummy)
+			RadixPass(n, numBlocks, [&](size_t i) { return (size_t)(*dummy)[perm[i]]; }, perm, tmpPerm, nullptr, nullptr);
+		return perm;
+	}
+
+	void ColumnStore::Gather(const std::vector<uint32_t> &indices)
+	{
+		Compact();
+		auto size = indices.size();
+		for (auto &column : columns)
+		{
+			if (column.IsConstant())
+			{
+				column = SECYAN::Column::Constant(size, column[0]);
+				continue;
+			}
+			SECYAN::Column gathered(size);
+			auto dst = gathered.MutableData();
+			auto src = column.data();
+			gThreadPool.ParallelRange(size, [&](size_t begin, size_t end) {
+				for (size_t i = begin; i < end; i++)
+					dst[i] = src[indices[i]];
+			}, minRowsPerThread);
+			column = std::move(gathered);
+		}
+		std::vector<bool> gatheredDummy(size);
+		for (size_t i = 0; i < size; i++)
+			gatheredDummy[i] = (*dummy)[indices[i]];
+		dummy = std::make_shared<std::vector<bool>>(std::move(gatheredDummy));
+		numRows = size;
+	}
+
+	void ColumnStore::Project(const std::vector<uint32_t> &indexMap)
+	{
+		std::vector<SECYAN::Column> projected(indexMap.size());
+		std::vector<std::shared_ptr<const Dictionary>> projectedDictionaries(indexMap.size());
+		for (size_t j = 0; j < indexMap.size(); j++)
+		{
+			assert(indexMap[j] < columns.size());
+			projected[j] = columns[indexMap[j]]; // the buffer is shared, the same column may be projected twice
+			projectedDictionaries[j] = dictionaries[indexMap[j]];
+		}
+		columns.swap(projected);
+		dictionaries.swap(projectedDictionaries);
+		for (auto &segment : tail)
+		{
+			auto projectedSegment = std::make_shared<ColumnStore>(*segment);
+			projectedSegment->Project(indexMap);
+			segment = std::move(projectedSegment);
+		}
+	}
+
+	void ColumnStore::Append(const ColumnStore &other)
+	{
+		if (other.NumRows() == 0)
+			return;
+		if (NumRows() == 0) // an empty store (e.g. never loaded) takes the layout of the other
+		{
+			*this = other;
+			return;
+		}
+		assert(columns.size() == other.columns.size());
+		if (dictionaries == other.dictionaries)
+		{
+			// Link the segments of the other store, they are shared until compacted
+			auto head = std::make_shared<ColumnStore>(other);
+			head->tail.clear();
+			head->tailRows = 0;
+			tail.push_back(std::move(head));
+			tail.insert(tail.end(), other.tail.begin(), other.tail.end());
+			tailRows += other.NumRows();
+			return;
+		}
+
+		// Both parts are recoded into the merged dictionaries
+		Compact();
+		ColumnStore compacted = other;
+		compacted.Compact();
+		for (size_t j = 0; j < columns.size(); j++)
+		{
+			SECYAN::Column appended(numRows + compacted.numRows);
+			auto dst = appended.MutableData();
+			auto &src = columns[j], &otherSrc = compacted.columns[j];
+			assert(!dictionaries[j] == !compacted.dictionaries[j]);
+			if (dictionaries[j] && dictionaries[j] != compacted.dictionaries[j])
+			{
+				std::vector<uint64_t> remap, otherRemap;
+				dictionaries[j] = Dictionary::Merge(*dictionaries[j], *compacted.dictionaries[j], remap, otherRemap);
+				for (size_t i = 0; i < numRows; i++)
+					dst[i] = remap[src[i]];
+				for (size_t i = 0; i < compacted.numRows; i++)
+					dst[numRows + i] = otherRemap[otherSrc[i]];
+			}
+			else
+			{
+				src.CopyTo(dst);
+				otherSrc.CopyTo(dst + numRows);
+			}
+			columns[j] = std::move(appended);
+		}
+		auto appendedDummy = std::make_shared<std::vector<bool>>(*dummy);
+		appendedDummy->insert(appendedDummy->end(), compacted.dummy->begin(), compacted.dummy->end());
+		dummy = std::move(appendedDummy);
+		numRows += compacted.numRows;
+	}
+
+	void ColumnStore::Compact()
+	{
+		if (tail.empty())
+			return;
+		auto total = NumRows();
+		for (size_t j = 0; j < columns.size(); j++)
+		{
+			bool constant = columns[j].IsConstant();
+			for (auto &segment : tail)
+				constant = constant && segment->columns[j].IsConstant() && segment->columns[j][0] == columns[j][0];
+			if (constant)
+			{
+				columns[j] = SECYAN::Column::Constant(total, columns[j][0]);
+				continue;
+			}
+			SECYAN::Column compacted(total);
+			auto dst = compacted.MutableData();
+			columns[j].CopyTo(dst);
+			dst += numRows;
+			for (auto &segment : tail)
+			{
+				segment->columns[j].CopyTo(dst);
+				dst += segment->numRows;
+			}
+			columns[j] = std::move(compacted);
+		}
+		auto compactedDummy = std::make_shared<std::vector<bool>>(*dummy);
+		for (auto &segment : tail)
+			compactedDummy->insert(compactedDummy->end(), segment->dummy->begin(), segment->dummy->end());
+		dummy = std::move(compactedDummy);
+		numRows = total;
+		tail.clear();
+		tailRows = 0;
+	}
+
+	void ColumnStore::AddColumn(uint64_t value, std::shared_ptr<const Dictionary> dictionary)
+	{
+		assert(!dictionary || value < dictionary->Size());
+		columns.push_back(SECYAN::Column::Constant(numRows, value));
+		dictionaries.push_back(dictionary);
+		for (auto &segment : tail)
+		{
+			auto extended = std::make_shared<ColumnStore>(*segment);
+			extended->AddColumn(value, dictionary);
+			segment = std::move(extended);
+		}
+	}
+
+	void ColumnStore::ShrinkDictionaries()
+	{
+		Compact();
+		for (size_t j = 0; j < columns.size(); j++)
+		{
+			if (!dictionaries[j])
+				continue;
+			std::vector<bool> used(dictionaries[j]->Size(), false);
+			for (size_t i = 0; i < numRows; i++)
+				if (!(*dummy)[i])
+					used[columns[j][i]] = true;
+			std::vector<uint64_t> remap;
+			dictionaries[j] = dictionaries[j]->Subset(used, remap);
+			if (columns[j].IsConstant())
+			{
+				columns[j] = SECYAN::Column::Constant(numRows, remap[columns[j][0]] == Dictionary::npos ? 0 : remap[columns[j][0]]);
+				continue;
+			}
+			auto column = columns[j].MutableData();
+			for (size_t i = 0; i < numRows; i++)
+				column[i] = (*dummy)[i] ? 0 : remap[column[i]];
+		}
+	}
+
+	ColumnStore ColumnStore::Concat(const ColumnStore &left, const std::vector<uint32_t> &leftIndices,
+									const ColumnStore &right, const std::vector<uint32_t> &rightIndices)
+	{
+		assert(leftIndices.size() == rightIndices.size() && left.tail.empty() && right.tail.empty());
+		auto size = leftIndices.size();
+		ColumnStore ret(0, size);
+		ret.dictionaries = left.dictionaries;
+		ret.dictionaries.insert(ret.dictionaries.end(), right.dictionaries.begin(), right.dictionaries.end());
+		auto concat = [&](const ColumnStore &side, const std::vector<uint32_t> &indices) {
+			for (auto &src : side.columns)
+			{
+				if (src.IsConstant())
+				{
+					ret.columns.push_back(SECYAN::Column::Constant(size, src[0]));
+					continue;
+				}
+				SECYAN::Column column(size);
+				auto dst = column.MutableData();
+				for (size_t i = 0; i < size; i++)
+				{
+					assert(!(*side.dummy)[indices[i]] && "Trying to concatenate dummy tuples!");
+					dst[i] = src[indices[i]];
+				}
+				ret.columns.push_back(std::move(column));
+			}
+		};
+		concat(left, leftIndices);
+		concat(right, rightIndices);
+		return ret;
+	}
+
+	size_t ColumnStore::MemoryBytes() const
+	{
+		size_t bytes = numRows / 8;
+		for (auto &column : columns)
+			if (column.Owned() && !column.IsConstant())
+				bytes += column.size() * sizeof(uint64_t);
+		for (auto &dictionary : dictionaries)
+			if (dictionary)
+				bytes += dictionary->MemoryBytes();
+		// The segments share their columns (and the dictionaries) with the stores they were appended from, which count them,
+		// so only the columns left to the segments are counted
+		for (auto &segment : tail)
+			for (auto &column : segment->columns)
+				if (column.Owned() && !column.IsConstant() && column.Unique())
+					bytes += column.size() * sizeof(uint64_t);
+		return bytes;
+	}
+
+	void ColumnStore::Spill()
+	{
+		for (auto &column : columns)
+			if (column.Owned() && !column.IsConstant())
+				column = SpillColumn(column);
+		for (auto &segment : tail)
+		{
+			auto spilled = std::make_shared<ColumnStore>(*segment);
+			spilled->Spill();
+			segment = std::move(spilled);
+		}
+	}
+
+	std::vector<uint32_t> ColumnStore::ExternalSort(size_t runRows)
+	{
+		assert(runRows > 0);
+		Compact();
+		auto numColumns = columns.size();
+		// A record is a row followed by (dummy flag << 32 | row index), the sorted runs are written one after another
+		auto width = numColumns + 1;
+		std::vector<size_t> cursors, runEnds; // in records
+		std::vector<uint32_t> indices;
+		ColumnWriter runWriter;
+		for (size_t begin = 0; begin < numRows; begin += runRows)
+		{
+			auto end = std::min(numRows, begin + runRows);
+			indices = SortIndices(begin, end);
+			for (auto i : indices)
+			{
+				for (auto &column : columns)
+					runWriter.Append(column[i]);
+				runWriter.Append((uint64_t)(*dummy)[i] << 32 | i);
+			}
+			cursors.push_back(begin);
+			runEnds.push_back(end);
+		}
+		indices = std::vector<uint32_t>();
+		auto runs = runWriter.Finish();
+
+		// Merge the runs through a heap of their first records, in the same order as Less
+		auto record = [&](size_t r) { return runs.data() + cursors[r] * width; };
+		auto greater = [&](size_t r, size_t s) {
+			auto a = record(r), b = record(s);
+			if (a[numColumns] >> 32)
+				return !(b[numColumns] >> 32);
+			if (b[numColumns] >> 32)
+				return false;
+			for (size_t j = 0; j < numColumns; j++)
+				if (a[j] != b[j])
+					return a[j] > b[j];
+			return false;
+		};
+		std::vector<size_t> heap(cursors.size());
+		std::iota(heap.begin(), heap.end(), 0);
+		std::make_heap(heap.begin(), heap.end(), greater);
+		std::vector<std::unique_ptr<ColumnWriter>> writers(numColumns);
+		for (auto &writer : writers)
+			writer.reset(new ColumnWriter);
+		std::vector<uint32_t> permutation(numRows);
+		std::vector<bool> sortedDummy(numRows);
+		for (size_t k = 0; k < numRows; k++)
+		{
+			std::pop_heap(heap.begin(), heap.end(), greater);
+			auto r = heap.back();
+			auto rec = record(r);
+			for (size_t j = 0; j < numColumns; j++)
+				writers[j]->Append(rec[j]);
+			permutation[k] = (uint32_t)rec[numColumns];
+			sortedDummy[k] = rec[numColumns] >> 32;
+			if (++cursors[r] < runEnds[r])
+				std::push_heap(heap.begin(), heap.end(), greater);
+			else
+				heap.pop_back();
+		}
+		for (size_t j = 0; j < numColumns; j++)
+			if (!columns[j].IsConstant())
+				columns[j] = writers[j]->Finish();
+		dummy = std::make_shared<std::vector<bool>>(std::move(sortedDummy));
+		return permutation;
+	}
+
+	std::vector<uint64_t> ColumnStore::Pack() const
+	{
+		assert(tail.empty());
+		auto numColumns = columns.size();
+		std::vector<uint64_t> packed(numColumns * numRows);
+		for (size_t j = 0; j < numColumns; j++)
+		{
+			auto &column = columns[j];
+			for (size_t i = 0; i < numRows; i++)
+			{
+				assert(!(*dummy)[i] && "Trying to pack dummy tuples!");
+				packed[i * numColumns + j] = column[i];
+			}
+		}
+		return packed;
+	}
+
+	ColumnStore ColumnStore::Unpack(const std::vector<uint64_t> &packed, size_t numRows)
+	{
+		auto numColumns = numRows == 0 ? 0 : packed.size() / numRows;
+		ColumnStore ret(numColumns, numRows);
+		for (size_t j = 0; j < numColumns; j++)
+		{
+			auto column = ret.MutableColumn(j);
+			for (size_t i = 0; i < numRows; i++)
+				column[i] = packed[i * numColumns + j];
+		}
+		return ret;
+	}
+
+} // namespace SECYAN
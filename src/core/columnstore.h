@@ -0,0 +1,148 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+#include <cassert>
+#include "dictionary.h"
+
+namespace SECYAN
+{
+
+	// An immutable array of uint64_t values, copies share the same buffer.
+	// The buffer is either owned by the column or borrowed from a holder (e.g. a mapped snapshot file),
+	// MutableData() makes a private copy first if the buffer is borrowed or shared.
+	// A constant column stores its value once (data() has a single element), operator[] works for all rows.
+	class Column
+	{
+	public:
+		Column() {}
+		explicit Column(size_t size, uint64_t value = 0);
+		Column(std::shared_ptr<const void> holder, const uint64_t *data, size_t size)
+			: holder(std::move(holder)), ptr(data), length(size) {}
+		static Column Constant(size_t size, uint64_t value);
+
+		size_t size() const { return length; }
+		const uint64_t *data() const { return ptr; }
+		const uint64_t &operator[](size_t i) const { return ptr[i & mask]; }
+		uint64_t *MutableData();
+		// Whether the buffer is owned (in memory) rather than borrowed (e.g. from a mapped file)
+		bool Owned() const { return owned; }
+		// Whether no other column shares the buffer
+		bool Unique() const { return holder.use_count() == 1; }
+		bool IsConstant() const { return mask == 0; }
+		// Copy the values to dst (size() elements)
+		void CopyTo(uint64_t *dst) const;
+
+	private:
+		std::shared_ptr<const void> holder;
+		const uint64_t *ptr = nullptr;
+		size_t length = 0;
+		size_t mask = ~(size_t)0; // 0 for a constant column
+		bool owned = false;
+	};
+
+	// Columnar (struct-of-arrays) storage of the tuples of a relation:
+	// one contiguous uint64_t array per attribute plus a dummy bitmap.
+	// Append only links the rows of the other store as a segment, the segments are copied into contiguous columns
+	// by Compact, which must be called before the rows are visited (operations that modify the rows call it themselves).
+	// Dummy tuples are ordered after all non-dummy tuples and only equal to each other.
+	// Copies and projections share the columns and the bitmap (copy on write), so they cost O(#columns).
+	// A STRING column holds dictionary codes and has a dictionary (see dictionary.h), other columns have none.
+	class ColumnStore
+	{
+	public:
+		ColumnStore() {}
+		ColumnStore(size_t numColumns, size_t numRows);
+		ColumnStore(std::vector<SECYAN::Column> columns, size_t numRows);
+
+		size_t NumRows() const { return numRows + tailRows; }
+		size_t NumColumns() const { return columns.size(); }
+		// Not for constant columns
+		const uint64_t *Column(size_t j) const
+		{
+			assert(tail.empty() && !columns[j].IsConstant());
+			return columns[j].data();
+		}
+		uint64_t *MutableColumn(size_t j)
+		{
+			Compact();
+			return columns[j].MutableData();
+		}
+		const Dictionary *GetDictionary(size_t j) const { return dictionaries[j].get(); }
+		void SetDictionary(size_t j, std::shared_ptr<const Dictionary> dictionary) { dictionaries[j] = std::move(dictionary); }
+
+		uint64_t Get(size_t i, size_t j) const
+		{
+			assert(tail.empty() && "Error: Segments not compacted!");
+			assert(!(*dummy)[i] && "Error: Visiting dummy tuple!");
+			return columns[j][i];
+		}
+		bool IsDummy(size_t i) const
+		{
+			assert(tail.empty() && "Error: Segments not compacted!");
+			return (*dummy)[i];
+		}
+		void ToDummy(size_t i)
+		{
+			Compact();
+			if (dummy.use_count() > 1) // copy on write
+				dummy = std::make_shared<std::vector<bool>>(*dummy);
+			(*dummy)[i] = true;
+		}
+
+		bool Less(size_t i, size_t j) const;  // dictionary comparison of row i and row j
+		bool Equal(size_t i, size_t j) const; // dictionary comparison of row i and row j
+		// Copy the attributes of row i to out (out must have NumColumns() elements)
+		void GetRow(size_t i, uint64_t *out) const;
+		// Like GetRow, but the codes of STRING columns are replaced by the hashes of the strings,
+		// so that the keys of different relations (with different dictionaries) can be compared
+		void GetKeyRow(size_t i, uint64_t *out) const;
+		uint64_t GetKey(size_t i, size_t j) const
+		{
+			return dictionaries[j] ? dictionaries[j]->Hash(columns[j][i]) : columns[j][i];
+		}
+
+		// The rows in [begin, end) in sorted order (by Less), computed by a parallel radix sort
+		// If dummiesLast is false, the dummy flags are ignored and only the values are compared
+		std::vector<uint32_t> SortIndices(size_t begin, size_t end, bool dummiesLast = true) const;
+		// Take a subsequence of the rows, row i of the result is row indices[i]
+		void Gather(const std::vector<uint32_t> &indices);
+		// Keep the columns in indexMap (in that order), column j of the result is column indexMap[j]
+		void Project(const std::vector<uint32_t> &indexMap);
+		// O(#columns) unless the dictionaries of STRING columns differ, in which case they are merged
+		void Append(const ColumnStore &other);
+		// Copy the segments into contiguous columns (constant columns stay constant if all segments agree)
+		void Compact();
+		// Add a constant column, which is not materialized
+		void AddColumn(uint64_t value, std::shared_ptr<const Dictionary> dictionary = nullptr);
+		// Drop the strings that no (non-dummy) row uses from the dictionaries, e.g. before revealing them
+		void ShrinkDictionaries();
+		// Row k of the result is the concatenation of row leftIndices[k] of left and row rightIndices[k] of right
+		static ColumnStore Concat(const ColumnStore &left, const std::vector<uint32_t> &leftIndices,
+								  const ColumnStore &right, const std::vector<uint32_t> &rightIndices);
+
+		// Bytes of the columns and dictionaries held in memory (mapped columns are not counted)
+		size_t MemoryBytes() const;
+		// Move the in-memory columns to temporary files (see spill.h)
+		void Spill();
+		// External merge sort: sort runs of runRows rows in memory and merge them into spilled columns
+		// Return the permutation, i.e. row i of the result was row ret[i]
+		std::vector<uint32_t> ExternalSort(size_t runRows);
+
+		// Row-major packing (for sending tuples), every tuple must not be dummy
+		// Dictionaries are not packed, they are sent separately and set by SetDictionary
+		std::vector<uint64_t> Pack() const;
+		static ColumnStore Unpack(const std::vector<uint64_t> &packed, size_t numRows);
+
+	private:
+		size_t numRows = 0;
+		std::vector<SECYAN::Column> columns;
+		std::vector<std::shared_ptr<const Dictionary>> dictionaries; // one per column, nullptr if not a STRING column
+		std::shared_ptr<std::vector<bool>> dummy = std::make_shared<std::vector<bool>>(); // shared by copies until modified
+		// Rows appended after the first numRows rows, each segment is contiguous with the same dictionaries
+		std::vector<std::shared_ptr<const ColumnStore>> tail;
+		size_t tailRows = 0;
+	};
+
+} // namespace SECYAN
@@ -0,0 +1,115 @@
+#include "cuckoo.h"
+#include <algorithm>
+#include <cassert>
+
+namespace SECYAN
+{
+	const int32_t CuckooTable::EMPTY;
+	const int CuckooTable::numHashes;
+	const int CuckooTable::hashWords;
+
+	// A walk gives up on a key after this many evictions and searches for an augmenting path instead
+	const uint32_t maxEvictions = 500;
+	// The candidate bins of the key this many keys ahead are prefetched
+	const uint32_t prefetchDistance = 8;
+
+	CuckooTable::CuckooTable(uint32_t numBins)
+		: numBins(numBins), partBins(numBins / numHashes)
+	{
+		assert(numBins > 0 && numBins % numHashes == 0);
+	}
+
+	bool CuckooTable::Build(const uint32_t *hashes, uint32_t n, uint64_t walkSeed)
+	{
+		bins.assign(numBins, EMPTY);
+		unplaced.clear();
+		// xorshift64*, a walk only needs cheap unpredictable-enough choices
+		uint64_t state = walkSeed | 1;
+		auto nextRandom = [&]() {
+			state ^= state >> 12;
+			state ^= state << 25;
+			state ^= state >> 27;
+			return (uint32_t)((state * 0x2545F4914F6CDD1Dull) >> 32);
+		};
+		for (uint32_t i = 0; i < n; i++)
+		{
+			if (i + prefetchDistance < n)
+				for (int h = 0; h < numHashes; h++)
+					__builtin_prefetch(&bins[CandidateBin(hashes[hashWords * (i + prefetchDistance) + h], h, partBins)], 1);
+			int32_t key = i;
+			uint32_t from = numBins; // the bin the key in hand was evicted from
+			for (uint32_t evictions = 0;; evictions++)
+			{
+				auto keyHashes = hashes + hashWords * key;
+				bool placed = false;
+				for (int h = 0; h < numHashes && !placed; h++)
+				{
+					auto bin = CandidateBin(keyHashes[h], h, partBins);
+					if (bins[bin] == EMPTY)
+					{
+						bins[bin] = key;
+						placed = true;
+					}
+				}
+				if (placed)
+					break;
+				if (evictions == maxEvictions)
+				{
+					// Without an augmenting path for the key in hand, no placement of the keys so far has room for it
+					if (!Augment(key, hashes))
+						unplaced.push_back(key);
+					break;
+				}
+				// Evict the key of a random candidate bin other than the one the key in hand came from (the candidates are distinct)
+				int h = nextRandom() % numHashes;
+				auto bin = CandidateBin(keyHashes[h], h, partBins);
+				if (bin == from)
+				{
+					h = (h + 1) % numHashes;
+					bin = CandidateBin(keyHashes[h], h, partBins);
+				}
+				std::swap(key, bins[bin]);
+				from = bin;
+			}
+		}
+		return unplaced.empty();
+	}
+
+	bool CuckooTable::Augment(int32_t key, const uint32_t *hashes)
+	{
+		// The bins in the order they are reached, each from the bin (its index in queue) of a key that can move into it,
+		// or from root for the key in hand
+		const uint32_t root = numBins;
+		std::vector<uint32_t> queue, cameFrom;
+		std::vector<bool> reached(numBins, false);
+		uint32_t emptyBin = root;
+		auto explore = [&](int32_t k, uint32_t fromBin) {
+			for (int h = 0; h < numHashes; h++)
+			{
+				auto bin = CandidateBin(hashes[hashWords * k + h], h, partBins);
+				if (reached[bin])
+					continue;
+				reached[bin] = true;
+				queue.push_back(bin);
+				cameFrom.push_back(fromBin);
+				if (bins[bin] == EMPTY)
+				{
+					emptyBin = queue.size() - 1;
+					return true;
+				}
+			}
+			return false;
+		};
+		bool found = explore(key, root);
+		for (size_t q = 0; !found && q < queue.size(); q++)
+			found = explore(bins[queue[q]], q);
+		if (!found)
+			return false;
+		// Every key on the path moves to the bin reached from its own, the key in hand to the first bin of the path
+		uint32_t q = emptyBin;
+		for (; cameFrom[q] != root; q = cameFrom[q])
+			bins[queue[q]] = bins[queue[cameFrom[q]]];
+		bins[queue[q]] = key;
+		return true;
+	}
+} // namespace SECYAN
@@ -0,0 +1,41 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+
+namespace SECYAN
+{
+	// Cuckoo hashing of keys 0..n-1 into numBins bins, each key goes to one of its numHashes candidate bins
+	// The table is split into numHashes parts and hash h of a key selects its candidate in part h (see CandidateBin), so the
+	// candidates of a key are distinct. They are computed from 32-bit hash values by multiply-shift range reduction (see Bin),
+	// so that the simple hashing on the other side (see PSI::BobSimpleHash) puts every key into the same candidates.
+	class CuckooTable
+	{
+	public:
+		static const int32_t EMPTY = -1;
+		static const int numHashes = 3;
+		// The hash array of a key has 4 words (a 128-bit hash), of which the first numHashes are used
+		static const int hashWords = 4;
+
+		// numBins: a multiple of numHashes
+		explicit CuckooTable(uint32_t numBins);
+		// Insert the keys by random walks (the walk is determined by walkSeed), hashes[hashWords * i + h] is hash h of key i
+		// A walk that gives up is finished by a search for an augmenting path, so all keys are placed unless they do not fit
+		// Return false if they do not fit, then the keys Unplaced() are not in the table
+		bool Build(const uint32_t *hashes, uint32_t n, uint64_t walkSeed);
+		// The key in each bin, or EMPTY
+		const std::vector<int32_t> &Bins() const { return bins; }
+		const std::vector<uint32_t> &Unplaced() const { return unplaced; }
+
+		// floor(hash * numBins / 2^32), which maps uniform hash values to uniform bins without a division
+		static uint32_t Bin(uint32_t hash, uint32_t numBins) { return ((uint64_t)hash * numBins) >> 32; }
+		// The candidate bin of hash h in a table with numHashes parts of partBins bins
+		static uint32_t CandidateBin(uint32_t hash, int h, uint32_t partBins) { return h * partBins + Bin(hash, partBins); }
+
+	private:
+		uint32_t numBins, partBins;
+		std::vector<int32_t> bins;
+		std::vector<uint32_t> unplaced;
+		// Place key by moving the keys along a shortest path to an empty bin (breadth-first search), false if there is none
+		bool Augment(int32_t key, const uint32_t *hashes);
+	};
+} // namespace SECYAN
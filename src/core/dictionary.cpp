@@ -0,0 +1,167 @@
+#include "dictionary.h"
+#include "MurmurHash3.h"
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cassert>
+
+namespace SECYAN
+{
+	const uint64_t Dictionary::npos;
+	const uint32_t emptySlot = ~(uint32_t)0;
+
+	uint64_t Dictionary::HashString(const char *data, size_t length)
+	{
+		uint64_t out[2];
+		MurmurHash3_x64_128(data, length, 0, out);
+		return out[0];
+	}
+
+	Dictionary::Dictionary(std::vector<std::string> values)
+	{
+		std::sort(values.begin(), values.end());
+		values.erase(std::unique(values.begin(), values.end()), values.end());
+		size_t numChars = 0;
+		for (auto &value : values)
+			numChars += value.size();
+		chars.reserve(numChars);
+		offsets.reserve(values.size() + 1);
+		hashes.reserve(values.size());
+		for (auto &value : values)
+			Add(value.data(), value.size());
+		BuildIndex();
+	}
+
+	Dictionary::Dictionary(const char *data, size_t size)
+	{
+		uint64_t numValues = 0;
+		if (size >= sizeof(numValues))
+			std::memcpy(&numValues, data, sizeof(numValues));
+		size_t headerSize = sizeof(numValues) + (numValues + 1) * sizeof(uint64_t);
+		bool valid = size >= sizeof(numValues) && numValues < size / sizeof(uint64_t) && size >= headerSize;
+		if (valid)
+		{
+			offsets.resize(numValues + 1);
+			std::memcpy(offsets.data(), data + sizeof(numValues), offsets.size() * sizeof(uint64_t));
+			valid = offsets[0] == 0 && offsets.back() <= size - headerSize;
+			for (uint64_t k = 0; k < numValues && valid; k++)
+				valid = offsets[k] <= offsets[k + 1];
+		}
+		if (!valid)
+		{
+			std::cerr << "Read dictionary error!" << std::endl;
+			std::exit(1);
+		}
+		chars.assign(data + headerSize, data + headerSize + offsets.back());
+		hashes.resize(numValues);
+		for (uint64_t k = 0; k < numValues; k++)
+			hashes[k] = HashString(Data(k), Length(k));
+		BuildIndex();
+	}
+
+	void Dictionary::Add(const char *data, size_t length)
+	{
+		chars.insert(chars.end(), data, data + length);
+		offsets.push_back(chars.size());
+		hashes.push_back(HashString(data, length));
+	}
+
+	void Dictionary::BuildIndex()
+	{
+		assert(hashes.size() < emptySlot);
+		size_t numSlots = 16;
+		while (numSlots < 2 * hashes.size())
+			numSlots *= 2;
+		index.assign(numSlots, emptySlot);
+		for (uint32_t k = 0; k < hashes.size(); k++)
+		{
+			size_t slot = hashes[k] & (numSlots - 1);
+			while (index[slot] != emptySlot)
+				slot = (slot + 1) & (numSlots - 1);
+			index[slot] = k;
+		}
+	}
+
+	uint64_t Dictionary::Find(const char *data, size_t length) const
+	{
+		auto hash = HashString(data, length);
+		size_t mask = index.size() - 1;
+		for (size_t slot = hash & mask; index[slot] != emptySlot; slot = (slot + 1) & mask)
+		{
+			auto k = index[slot];
+			if (hashes[k] == hash && Length(k) == length && std::memcmp(Data(k), data, length) == 0)
+				return k;
+		}
+		return npos;
+	}
+
+	size_t Dictionary::MemoryBytes() const
+	{
+		return chars.size() + offsets.size() * sizeof(uint64_t) + hashes.size() * sizeof(uint64_t) + index.size() * sizeof(uint32_t);
+	}
+
+	std::vector<char> Dictionary::Serialize() const
+	{
+		uint64_t numValues = Size();
+		std::vector<char> out(sizeof(numValues) + offsets.size() * sizeof(uint64_t) + chars.size());
+		std::memcpy(out.data(), &numValues, sizeof(numValues));
+		std::memcpy(out.data() + sizeof(numValues), offsets.data(), offsets.size() * sizeof(uint64_t));
+		std::copy(chars.begin(), chars.end(), out.begin() + sizeof(numValues) + offsets.size() * sizeof(uint64_t));
+		return out;
+	}
+
+	bool Dictionary::Less(uint64_t code, const Dictionary &other, uint64_t otherCode) const
+	{
+		// the same order as std::string
+		auto length = Length(code), otherLength = other.Length(otherCode);
+		int cmp = std::memcmp(Data(code), other.Data(otherCode), std::min(length, otherLength));
+		return cmp < 0 || (cmp == 0 && length < otherLength);
+	}
+
+	std::shared_ptr<const Dictionary> Dictionary::Merge(const Dictionary &a, const Dictionary &b,
+														std::vector<uint64_t> &remapA, std::vector<uint64_t> &remapB)
+	{
+		auto merged = std::make_shared<Dictionary>();
+		remapA.resize(a.Size());
+		remapB.resize(b.Size());
+		uint64_t i = 0, j = 0;
+		while (i < a.Size() || j < b.Size())
+		{
+			uint64_t code = merged->Size();
+			if (j == b.Size() || (i < a.Size() && a.Less(i, b, j)))
+			{
+				merged->Add(a.Data(i), a.Length(i));
+				remapA[i++] = code;
+			}
+			else if (i == a.Size() || b.Less(j, a, i))
+			{
+				merged->Add(b.Data(j), b.Length(j));
+				remapB[j++] = code;
+			}
+			else // the same string
+			{
+				merged->Add(a.Data(i), a.Length(i));
+				remapA[i++] = code;
+				remapB[j++] = code;
+			}
+		}
+		merged->BuildIndex();
+		return merged;
+	}
+
+	std::shared_ptr<const Dictionary> Dictionary::Subset(const std::vector<bool> &used, std::vector<uint64_t> &remap) const
+	{
+		assert(used.size() == Size());
+		auto subset = std::make_shared<Dictionary>();
+		remap.assign(Size(), npos);
+		for (uint64_t k = 0; k < Size(); k++)
+			if (used[k])
+			{
+				remap[k] = subset->Size();
+				subset->Add(Data(k), Length(k));
+			}
+		subset->BuildIndex();
+		return subset;
+	}
+
+} // namespace SECYAN
@@ -0,0 +1,55 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+namespace SECYAN
+{
+	// The distinct values of a STRING column, the tuples store dense codes instead of the strings
+	// Code k is the k-th smallest string, so codes compare (and sort) like the strings themselves.
+	// Codes are local to a dictionary: use Hash(code) to compare strings of different dictionaries.
+	class Dictionary
+	{
+	public:
+		static const uint64_t npos = ~(uint64_t)0;
+
+		Dictionary() { BuildIndex(); }
+		// The values are sorted and deduplicated
+		explicit Dictionary(std::vector<std::string> values);
+		// Restore a dictionary from the output of Serialize
+		Dictionary(const char *data, size_t size);
+		Dictionary(const Dictionary &) = delete;
+		Dictionary &operator=(const Dictionary &) = delete;
+
+		size_t Size() const { return hashes.size(); }
+		std::string Get(uint64_t code) const { return std::string(Data(code), Length(code)); }
+		const char *Data(uint64_t code) const { return chars.data() + offsets[code]; }
+		size_t Length(uint64_t code) const { return offsets[code + 1] - offsets[code]; }
+		// A 64-bit hash of the string, equal strings have the same hash in every dictionary
+		uint64_t Hash(uint64_t code) const { return hashes[code]; }
+		// The code of a string, or npos if it is not in the dictionary
+		uint64_t Find(const char *data, size_t length) const;
+		size_t MemoryBytes() const;
+
+		// {uint64 size, uint64 offsets[size + 1], chars}
+		std::vector<char> Serialize() const;
+		// The union of two dictionaries, remapA[code] (remapB[code]) is the new code of a code of a (b)
+		static std::shared_ptr<const Dictionary> Merge(const Dictionary &a, const Dictionary &b,
+													   std::vector<uint64_t> &remapA, std::vector<uint64_t> &remapB);
+		// The sub-dictionary of the codes with used[code] set, remap[code] is the new code of a used code
+		std::shared_ptr<const Dictionary> Subset(const std::vector<bool> &used, std::vector<uint64_t> &remap) const;
+
+		static uint64_t HashString(const char *data, size_t length);
+
+	private:
+		std::vector<char> chars;
+		std::vector<uint64_t> offsets = std::vector<uint64_t>(1, 0); // string k is chars[offsets[k], offsets[k + 1])
+		std::vector<uint64_t> hashes;
+		std::vector<uint32_t> index; // open addressing table of codes (by hash) for Find
+		void Add(const char *data, size_t length);
+		void BuildIndex();
+		bool Less(uint64_t code, const Dictionary &other, uint64_t otherCode) const;
+	};
+} // namespace SECYAN
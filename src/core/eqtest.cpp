@@ -0,0 +1,148 @@
+#include "eqtest.h"
+#include "party.h"
+#include "threadpool.h"
+#include <algorithm>
+#include <iostream>
+
+namespace SECYAN
+{
+	using namespace std;
+
+	// Transpose a 64 x 64 bit matrix in place: bit j of m[i] becomes bit i of m[j]
+	static void Transpose64(uint64_t *m)
+	{
+		uint64_t mask = 0x00000000FFFFFFFFull;
+		for (int j = 32; j != 0; j >>= 1, mask ^= mask << j)
+			for (int k = 0; k < 64; k = (k + j + 1) & ~j)
+			{
+				uint64_t t = ((m[k] >> j) ^ m[k + j]) & mask;
+				m[k] ^= t << j;
+				m[k + j] ^= t;
+			}
+	}
+
+	int EqualityTester::Add(const vector<vector<uint64_t>> &lanes, const vector<int> &laneBits)
+	{
+		Test test;
+		test.numValues = lanes.empty() ? 0 : lanes[0].size();
+		test.numWords = (test.numValues + 63) / 64;
+		test.numPlanes = 0;
+		for (auto bits : laneBits)
+		{
+			if (bits < 0 || bits > 64)
+			{
+				cerr << "Error: a lane of an equality test has at most 64 bits!" << endl;
+				exit(1);
+			}
+			test.numPlanes += bits;
+		}
+		if (test.numPlanes == 0 || lanes.size() < laneBits.size())
+		{
+			cerr << "Error: invalid lanes of an equality test!" << endl;
+			exit(1);
+		}
+		test.planes.resize(test.numPlanes * test.numWords);
+		// The bits are equal iff the shares a ^ b of their xor are 0, the server flips its bits so that the planes share equality
+		uint64_t flip = gParty.GetRole() == SERVER ? ~0ull : 0;
+		gThreadPool.ParallelRange(test.numWords, [&](size_t begin, size_t end) {
+			uint64_t block[64];
+			for (size_t w = begin; w < end; w++)
+			{
+				size_t first = w * 64, count = min<size_t>(64, test.numValues - first);
+				int plane = 0;
+				for (size_t l = 0; l < laneBits.size(); l++)
+				{
+					copy(lanes[l].begin() + first, lanes[l].begin() + first + count, block);
+					fill(block + count, block + 64, 0);
+					Transpose64(block);
+					for (int b = 0; b < laneBits[l]; b++, plane++)
+						test.planes[plane * test.numWords + w] = block[b] ^ flip;
+				}
+			}
+		});
+		tests.push_back(move(test));
+		return (int)tests.size() - 1;
+	}
+
+	void EqualityTester::Execute()
+	{
+		// Every AND halves a pair of planes, so a test needs numPlanes - 1 ANDs of numWords words
+		size_t numTriples = 0;
+		for (auto &test : tests)
+			numTriples += (test.numPlanes - 1) * test.numWords;
+		vector<uint64_t> a, b, c;
+		gParty.ANDTriples(numTriples, a, b, c);
+
+		bool isServer = gParty.GetRole() == SERVER;
+		size_t roundStart = 0;
+		vector<uint64_t> msg, otherMsg;
+		while (true)
+		{
+			// The ANDs of this round: planes 2i and 2i + 1 of every test, triple t = roundStart + (index of the word in the round)
+			size_t roundSize = 0;
+			for (auto &test : tests)
+				roundSize += test.numPlanes / 2 * test.numWords;
+			if (roundSize == 0)
+				break;
+			// Open d = x ^ a and e = y ^ b
+			msg.resize(2 * roundSize);
+			size_t t = 0;
+			for (auto &test : tests)
+			{
+				size_t pairWords = test.numPlanes / 2 * test.numWords;
+				auto x = test.planes.data();
+				gThreadPool.ParallelRange(pairWords, [&, x, t](size_t begin, size_t end) {
+					for (size_t k = begin; k < end; k++)
+					{
+						size_t i = k / test.numWords, w = k % test.numWords;
+						msg[2 * (t + k)] = x[2 * i * test.numWords + w] ^ a[roundStart + t + k];
+						msg[2 * (t + k) + 1] = x[(2 * i + 1) * test.numWords + w] ^ b[roundStart + t + k];
+					}
+				});
+				t += pairWords;
+			}
+			otherMsg.resize(msg.size());
+			if (isServer)
+			{
+				gParty.Send(msg);
+				gParty.Recv(otherMsg.data(), otherMsg.size());
+			}
+			else
+			{
+				gParty.Recv(otherMsg.data(), otherMsg.size());
+				gParty.Send(msg);
+			}
+			// z = c ^ (d & b) ^ (e & a) (^ d & e for the server), written to plane i, and an odd last plane moves to the end
+			t = 0;
+			for (auto &test : tests)
+			{
+				size_t pairs = test.numPlanes / 2, pairWords = pairs * test.numWords;
+				auto x = test.planes.data();
+				// Word w of plane i is word k = i * numWords + w of the round, which only depends on the messages
+				gThreadPool.ParallelRange(pairWords, [&, x, t](size_t begin, size_t end) {
+					for (size_t k = begin; k < end; k++)
+					{
+						size_t r = roundStart + t + k;
+						uint64_t d = msg[2 * (t + k)] ^ otherMsg[2 * (t + k)], e = msg[2 * (t + k) + 1] ^ otherMsg[2 * (t + k) + 1];
+						uint64_t z = c[r] ^ (d & b[r]) ^ (e & a[r]);
+						x[k] = isServer ? z ^ (d & e) : z;
+					}
+				});
+				if (test.numPlanes % 2)
+					copy(x + (test.numPlanes - 1) * test.numWords, x + test.numPlanes * test.numWords, x + pairs * test.numWords);
+				test.numPlanes -= pairs;
+				t += pairWords;
+			}
+			roundStart += roundSize;
+		}
+	}
+
+	vector<uint32_t> EqualityTester::Result(int handle) const
+	{
+		auto &test = tests[handle];
+		vector<uint32_t> indicator(test.numValues);
+		for (size_t k = 0; k < test.numValues; k++)
+			indicator[k] = (test.planes[k / 64] >> (k % 64)) & 1;
+		return indicator;
+	}
+} // namespace SECYAN
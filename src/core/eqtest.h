@@ -0,0 +1,33 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace SECYAN
+{
+	// Equality tests of the private values of the two parties, with XOR shared results (as a PutEQGate with a PutSharedOUTGate).
+	// The bits of the values are sliced into planes of 64 values per word, and a test of n values with `bits` bits
+	// ANDs the planes of the equal bits pairwise in ceil(log2(bits)) rounds. The AND triples of all queued tests
+	// are generated together, and each round of all tests is one message exchange, so several tests share one execution.
+	class EqualityTester
+	{
+	public:
+		// Queue a test of n values, value k is the concatenation of the low laneBits[l] bits of lanes[l][k] over the first
+		// laneBits.size() lanes, both parties use the same n and laneBits. Return the handle of the test
+		int Add(const std::vector<std::vector<uint64_t>> &lanes, const std::vector<int> &laneBits);
+		// Run all queued tests, both parties queue the same tests in the same order
+		void Execute();
+		// After Execute, the share of the indicator of test handle: indicator[k](Alice) ^ indicator[k](Bob) = 1 iff the values k are equal
+		std::vector<uint32_t> Result(int handle) const;
+
+	private:
+		struct Test
+		{
+			size_t numValues, numWords; // numWords = ceil(numValues / 64) words per plane
+			int numPlanes;
+			// Plane p is planes[p * numWords, (p + 1) * numWords), bit k of a plane is the share of an equal bit of values k
+			std::vector<uint64_t> planes;
+		};
+		std::vector<Test> tests;
+	};
+} // namespace SECYAN
@@ -0,0 +1,73 @@
+#include "field.h"
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+namespace SECYAN
+{
+	// Horner's rule on 4 points, the independent chains hide the latency of the multiplications
+	void EvalScalar4(const uint64_t *coeff, int size, const uint64_t *xs, size_t n, uint64_t *out)
+	{
+		uint64_t acc[4] = {0, 0, 0, 0}, x[4] = {0, 0, 0, 0};
+		for (size_t k = 0; k < n; k++)
+			x[k] = xs[k];
+		for (int i = size - 1; i >= 0; i--)
+			for (int k = 0; k < 4; k++)
+				acc[k] = field_add(field_mul(acc[k], x[k]), coeff[i]);
+		for (size_t k = 0; k < n; k++)
+			out[k] = acc[k];
+	}
+
+#ifdef __AVX2__
+	// a * b (mod p) in 4 lanes, a, b < 2^62, the result is < 2^61 + 8 (not fully reduced)
+	// AVX2 only multiplies 32-bit halves: a * b = hh * 2^64 + mid * 2^32 + ll, with 2^64 = 8 and 2^61 = 1 (mod p)
+	inline __m256i MulLazy(__m256i a, __m256i b)
+	{
+		const __m256i p = _mm256_set1_epi64x(field_modulus);
+		const __m256i low29 = _mm256_set1_epi64x((1ll << 29) - 1);
+		__m256i aHi = _mm256_srli_epi64(a, 32), bHi = _mm256_srli_epi64(b, 32);
+		__m256i ll = _mm256_mul_epu32(a, b);
+		__m256i hh = _mm256_mul_epu32(aHi, bHi);
+		__m256i mid = _mm256_add_epi64(_mm256_mul_epu32(aHi, b), _mm256_mul_epu32(a, bHi));
+		// mid * 2^32 = (mid >> 29) * 2^61 + (mid mod 2^29) * 2^32
+		__m256i s = _mm256_add_epi64(_mm256_slli_epi64(hh, 3), _mm256_srli_epi64(mid, 29));
+		s = _mm256_add_epi64(s, _mm256_slli_epi64(_mm256_and_si256(mid, low29), 32));
+		s = _mm256_add_epi64(s, _mm256_and_si256(ll, p));
+		s = _mm256_add_epi64(s, _mm256_srli_epi64(ll, 61));
+		return _mm256_add_epi64(_mm256_and_si256(s, p), _mm256_srli_epi64(s, 61));
+	}
+
+	// Fully reduce a < 2^62
+	inline __m256i Reduce(__m256i a)
+	{
+		const __m256i p = _mm256_set1_epi64x(field_modulus);
+		a = _mm256_add_epi64(_mm256_and_si256(a, p), _mm256_srli_epi64(a, 61));
+		a = _mm256_add_epi64(_mm256_and_si256(a, p), _mm256_srli_epi64(a, 61));
+		// a <= p: 0 if a == p
+		return _mm256_andnot_si256(_mm256_cmpeq_epi64(a, p), a);
+	}
+#endif
+
+	void field_eval_batch(const uint64_t *coeff, int size, const uint64_t *xs, size_t n, uint64_t *out)
+	{
+		size_t k = 0;
+#ifdef __AVX2__
+		for (; k + 8 <= n; k += 8)
+		{
+			__m256i x0 = _mm256_loadu_si256((const __m256i *)(xs + k));
+			__m256i x1 = _mm256_loadu_si256((const __m256i *)(xs + k + 4));
+			__m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256();
+			for (int i = size - 1; i >= 0; i--)
+			{
+				__m256i c = _mm256_set1_epi64x(coeff[i]);
+				acc0 = _mm256_add_epi64(MulLazy(acc0, x0), c);
+				acc1 = _mm256_add_epi64(MulLazy(acc1, x1), c);
+			}
+			_mm256_storeu_si256((__m256i *)(out + k), Reduce(acc0));
+			_mm256_storeu_si256((__m256i *)(out + k + 4), Reduce(acc1));
+		}
+#endif
+		for (; k < n; k += 4)
+			EvalScalar4(coeff, size, xs + k, n - k < 4 ? n - k : 4, out + k);
+	}
+} // namespace SECYAN
@@ -0,0 +1,41 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+namespace SECYAN
+{
+	// Arithmetic modulo the Mersenne prime p = 2^61 - 1 (the modulus of the PSI polynomials, see poly.h)
+	// Unless noted otherwise, the inputs and results are in [0, p)
+	static const uint64_t field_modulus = 0x1fffffffffffffffull;
+	typedef unsigned __int128 uint128_t;
+
+	// Any 128-bit value, using 2^61 = 1 (mod p)
+	inline uint64_t field_reduce128(uint128_t x)
+	{
+		uint128_t y = (x & field_modulus) + (x >> 61);
+		uint64_t z = (uint64_t)(y & field_modulus) + (uint64_t)(y >> 61);
+		z = (z & field_modulus) + (z >> 61);
+		return z >= field_modulus ? z - field_modulus : z;
+	}
+
+	inline uint64_t field_add(uint64_t x, uint64_t y)
+	{
+		x += y;
+		return x >= field_modulus ? x - field_modulus : x;
+	}
+
+	inline uint64_t field_sub(uint64_t x, uint64_t y)
+	{
+		return x >= y ? x - y : x + field_modulus - y;
+	}
+
+	// Any 64-bit x and y, compiled to a single 64x64->128 multiplication (MULX with -mbmi2)
+	inline uint64_t field_mul(uint64_t x, uint64_t y)
+	{
+		return field_reduce128((uint128_t)x * y);
+	}
+
+	// out[k] = coeff[0] + coeff[1] * xs[k] + ... + coeff[size - 1] * xs[k]^(size - 1) for k in [0, n)
+	// Horner's rule on several points at once: 8 points per iteration with AVX2, 4 otherwise
+	void field_eval_batch(const uint64_t *coeff, int size, const uint64_t *xs, size_t n, uint64_t *out);
+} // namespace SECYAN
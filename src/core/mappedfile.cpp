@@ -0,0 +1,51 @@
+#include "mappedfile.h"
+#include <iostream>
+#include <cstdlib>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace SECYAN
+{
+	MappedFile::MappedFile(const char *filePath) : filePath(filePath)
+	{
+		int fd = open(filePath, O_RDONLY);
+		struct stat st;
+		if (fd < 0 || fstat(fd, &st) != 0)
+		{
+			std::cerr << "Open file error: " << filePath << "!" << std::endl;
+			std::exit(1);
+		}
+		length = st.st_size;
+		if (length > 0)
+		{
+			void *ret = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (ret == MAP_FAILED)
+			{
+				std::cerr << "Map file error: " << filePath << "!" << std::endl;
+				std::exit(1);
+			}
+			addr = (const char *)ret;
+		}
+		close(fd);
+	}
+
+	MappedFile::~MappedFile()
+	{
+		if (addr)
+			munmap((void *)addr, length);
+	}
+
+	void MappedFile::AdviseSequential()
+	{
+		if (addr)
+			madvise((void *)addr, length, MADV_SEQUENTIAL);
+	}
+
+	void MappedFile::AdviseWillNeed()
+	{
+		if (addr)
+			madvise((void *)addr, length, MADV_WILLNEED);
+	}
+} // namespace SECYAN
@@ -0,0 +1,28 @@
+#pragma once
+#include <string>
+#include <cstddef>
+
+namespace SECYAN
+{
+	// A read-only memory mapping of a whole file
+	class MappedFile
+	{
+	public:
+		MappedFile(const char *filePath);
+		~MappedFile();
+		MappedFile(const MappedFile &) = delete;
+		MappedFile &operator=(const MappedFile &) = delete;
+
+		const char *data() const { return addr; }
+		size_t size() const { return length; }
+		const std::string &path() const { return filePath; }
+		// Hint the kernel about the access pattern of the whole file
+		void AdviseSequential();
+		void AdviseWillNeed();
+
+	private:
+		std::string filePath;
+		const char *addr = nullptr;
+		size_t length = 0;
+	};
+} // namespace SECYAN
@@ -0,0 +1,196 @@
+#include "okvs.h"
+#include "cuckoo.h"
+#include "MurmurHash3.h"
+#include <cmath>
+#include <cassert>
+
+namespace SECYAN
+{
+	const int GarbledCuckooTable::numHashes;
+	const uint32_t GarbledCuckooTable::extraSlots;
+	const int GarbledCuckooTable::denseSlots;
+	const int GarbledCuckooTable::denseSumsSize;
+
+	GarbledCuckooTable::GarbledCuckooTable(uint32_t maxKeys)
+	{
+		segmentSize = (uint32_t)std::ceil((expansion * maxKeys + extraSlots) / numHashes);
+	}
+
+	void GarbledCuckooTable::KeyOf(uint64_t element, uint32_t bin, uint32_t seed, Key &key) const
+	{
+		uint64_t in[2] = {element, bin}, out[2];
+		MurmurHash3_x64_128(in, sizeof(in), seed, out);
+		uint32_t hashes[4] = {(uint32_t)out[0], (uint32_t)(out[0] >> 32), (uint32_t)out[1], (uint32_t)(out[1] >> 32)};
+		for (int h = 0; h < numHashes; h++)
+			key.slots[h] = h * segmentSize + CuckooTable::Bin(hashes[h], segmentSize);
+		// The dense mask depends on all 128 bits of the hash (fmix64 of MurmurHash3)
+		auto mix = [](uint64_t x) {
+			x ^= x >> 33;
+			x *= 0xff51afd7ed558ccdull;
+			x ^= x >> 33;
+			x *= 0xc4ceb9fe1a85ec53ull;
+			return x ^ (x >> 33);
+		};
+		key.dense = mix(out[0] ^ mix(out[1]));
+	}
+
+	void GarbledCuckooTable::DenseSums(const uint64_t *table, uint64_t *denseSums) const
+	{
+		auto dense = table + numHashes * segmentSize;
+		for (int b = 0; b < denseSlots / 8; b++)
+		{
+			auto sums = denseSums + b * 256;
+			sums[0] = 0;
+			for (uint32_t v = 1; v < 256; v++)
+				sums[v] = sums[v & (v - 1)] ^ dense[8 * b + __builtin_ctz(v)];
+		}
+	}
+
+	bool GarbledCuckooTable::Encode(const uint32_t *offsets, uint32_t numBins, const uint64_t *elements, const uint64_t *values, int numValues,
+									uint32_t seed, osuCrypto::PRNG &prng, std::vector<uint64_t> &slots) const
+	{
+		auto numSlots = NumSlots();
+		uint32_t n = offsets[numBins];
+		assert(n <= numSlots);
+		// The number of keys in a slot and the xor of these keys, which is the key itself when the degree is 1
+		// (side by side, so that peeling touches one cache line per slot)
+		struct SlotKeys
+		{
+			uint32_t degree, xorKeys;
+		};
+		// The sparse slots and the dense masks of the keys in separate arrays, peeling only reads the former
+		std::vector<uint32_t> keySlots((size_t)numHashes * n);
+		std::vector<uint64_t> denseMasks(n);
+		std::vector<SlotKeys> slotKeys(numHashes * segmentSize, {0, 0});
+		for (uint32_t j = 0; j < numBins; j++)
+			for (uint32_t k = offsets[j]; k < offsets[j + 1]; k++)
+			{
+				Key key;
+				KeyOf(elements[k], j, seed, key);
+				denseMasks[k] = key.dense;
+				for (int h = 0; h < numHashes; h++)
+				{
+					keySlots[(size_t)numHashes * k + h] = key.slots[h];
+					auto &slot = slotKeys[key.slots[h]];
+					slot.degree++;
+					slot.xorKeys ^= k;
+				}
+			}
+
+		// Peel: remove a key which is alone in one of its slots, that slot is the key's
+		std::vector<uint32_t> pending, peeledKeys, peeledSlots;
+		peeledKeys.reserve(n);
+		peeledSlots.reserve(n);
+		for (uint32_t s = 0; s < slotKeys.size(); s++)
+			if (slotKeys[s].degree == 1)
+				pending.push_back(s);
+		while (!pending.empty())
+		{
+			auto s = pending.back();
+			pending.pop_back();
+			if (slotKeys[s].degree != 1)
+				continue;
+			auto k = slotKeys[s].xorKeys;
+			peeledKeys.push_back(k);
+			peeledSlots.push_back(s);
+			for (int h = 0; h < numHashes; h++)
+			{
+				auto other = keySlots[(size_t)numHashes * k + h];
+				slotKeys[other].degree--;
+				slotKeys[other].xorKeys ^= k;
+				if (slotKeys[other].degree == 1)
+					pending.push_back(other);
+			}
+		}
+
+		slots.resize((size_t)numValues * numSlots);
+		prng.get(slots.data(), slots.size());
+		if (peeledKeys.size() < n && !SolveCore(keySlots, denseMasks, peeledKeys, values, numValues, slots))
+			return false;
+		// The slots of the keys peeled later are fixed first
+		std::vector<uint64_t> denseSums((size_t)numValues * denseSumsSize);
+		for (int t = 0; t < numValues; t++)
+			DenseSums(slots.data() + (size_t)t * numSlots, denseSums.data() + (size_t)t * denseSumsSize);
+		for (auto i = peeledKeys.size(); i-- > 0;)
+		{
+			auto k = peeledKeys[i], s = peeledSlots[i];
+			auto ks = &keySlots[(size_t)numHashes * k];
+			for (int t = 0; t < numValues; t++)
+			{
+				auto table = slots.data() + (size_t)t * numSlots;
+				table[s] = 0;
+				table[s] = values[(size_t)t * n + k] ^ table[ks[0]] ^ table[ks[1]] ^ table[ks[2]] ^
+						   DenseDecode(denseSums.data() + (size_t)t * denseSumsSize, denseMasks[k]);
+			}
+		}
+		return true;
+	}
+
+	bool GarbledCuckooTable::SolveCore(const std::vector<uint32_t> &keySlots, const std::vector<uint64_t> &denseMasks, const std::vector<uint32_t> &peeledKeys,
+									   const uint64_t *values, int numValues, std::vector<uint64_t> &slots) const
+	{
+		// The sparse slots of the core are never the slot of a peeled key, so they keep their random values, and the dense slots
+		// solve dense * x = values ^ (the sparse slots) for every core key. Rows are reduced to one row per pivot (gauss-jordan),
+		// the dense slots that are not pivots keep their random values
+		uint32_t n = denseMasks.size(), numSlots = NumSlots();
+		std::vector<bool> peeled(n, false);
+		for (auto k : peeledKeys)
+			peeled[k] = true;
+		struct Row
+		{
+			uint64_t dense;
+			std::vector<uint64_t> rhs; // one word per table
+		};
+		std::vector<Row> rows;
+		for (uint32_t k = 0; k < n; k++)
+		{
+			if (peeled[k])
+				continue;
+			Row row{denseMasks[k], std::vector<uint64_t>(numValues)};
+			auto ks = &keySlots[(size_t)numHashes * k];
+			for (int t = 0; t < numValues; t++)
+			{
+				auto table = slots.data() + (size_t)t * numSlots;
+				row.rhs[t] = values[(size_t)t * n + k] ^ table[ks[0]] ^ table[ks[1]] ^ table[ks[2]];
+			}
+			// Reduce by the pivot rows, then make the new pivot the only one of its column
+			for (auto &pivotRow : rows)
+				if (row.dense & (pivotRow.dense & -pivotRow.dense))
+				{
+					row.dense ^= pivotRow.dense;
+					for (int t = 0; t < numValues; t++)
+						row.rhs[t] ^= pivotRow.rhs[t];
+				}
+			if (row.dense == 0)
+			{
+				for (int t = 0; t < numValues; t++)
+					if (row.rhs[t] != 0)
+						return false;
+				continue;
+			}
+			auto pivot = row.dense & -row.dense;
+			for (auto &pivotRow : rows)
+				if (pivotRow.dense & pivot)
+				{
+					pivotRow.dense ^= row.dense;
+					for (int t = 0; t < numValues; t++)
+						pivotRow.rhs[t] ^= row.rhs[t];
+				}
+			rows.push_back(std::move(row));
+		}
+		// A pivot row has one pivot and free columns
+		for (int t = 0; t < numValues; t++)
+		{
+			auto dense = slots.data() + (size_t)t * numSlots + numHashes * segmentSize;
+			for (auto &row : rows)
+			{
+				auto pivot = __builtin_ctzll(row.dense);
+				auto value = row.rhs[t];
+				for (auto bits = row.dense & (row.dense - 1); bits; bits &= bits - 1)
+					value ^= dense[__builtin_ctzll(bits)];
+				dense[pivot] = value;
+			}
+		}
+		return true;
+	}
+} // namespace SECYAN
@@ -0,0 +1,62 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include "cryptoTools/Crypto/PRNG.h"
+
+namespace SECYAN
+{
+	// An oblivious key-value store: a garbled cuckoo table with 3 hash functions (in the layout of xor filters) and a dense part.
+	// A key is a pair (element, bin) of the PSI, it has one slot in each third of the sparse table and a random subset of the
+	// denseSlots dense slots, and decodes to the xor of these slots.
+	// Encode peels the hypergraph of the keys in linear time, solves the keys left (the 2-core) on the dense slots by gaussian
+	// elimination and fixes the slots in reverse peeling order, the other slots are random, so a key that was not encoded
+	// decodes to a random value.
+	class GarbledCuckooTable
+	{
+	public:
+		static const int numHashes = 3;
+		// The 2-core is empty or a few keys at this expansion, so the dense slots solve it except with negligible probability
+		static constexpr double expansion = 1.3;
+		static const uint32_t extraSlots = 256;
+		static const int denseSlots = 64;
+
+		struct Key
+		{
+			uint32_t slots[numHashes];
+			uint64_t dense; // bit i selects dense slot i
+		};
+
+		// maxKeys: a public upper bound of the number of keys, which determines the size of the table
+		explicit GarbledCuckooTable(uint32_t maxKeys);
+		uint32_t NumSlots() const { return numHashes * segmentSize + denseSlots; }
+		// The keys of bin j are (elements[k], j) for k in [offsets[j], offsets[j + 1]), n = offsets[numBins]
+		// numValues tables share the hash functions: key k decodes to values[t * n + k] in table t, which is
+		// slots[t * NumSlots(), (t + 1) * NumSlots()). The free slots are drawn from prng, a cryptographic PRNG, so that
+		// they look like the fixed ones
+		// Return false if the keys left by peeling cannot be solved (with negligible probability, or if two keys are equal)
+		bool Encode(const uint32_t *offsets, uint32_t numBins, const uint64_t *elements, const uint64_t *values, int numValues, uint32_t seed,
+					osuCrypto::PRNG &prng, std::vector<uint64_t> &slots) const;
+		void KeyOf(uint64_t element, uint32_t bin, uint32_t seed, Key &key) const;
+		// The xors of the dense slots of a table selected by each byte value of each byte of a dense mask, so that a key
+		// decodes with 8 lookups instead of one per bit
+		static const int denseSumsSize = denseSlots / 8 * 256;
+		void DenseSums(const uint64_t *table, uint64_t *denseSums) const;
+		static uint64_t DenseDecode(const uint64_t *denseSums, uint64_t dense)
+		{
+			uint64_t value = 0;
+			for (int b = 0; b < denseSlots / 8; b++)
+				value ^= denseSums[b * 256 + ((dense >> (8 * b)) & 255)];
+			return value;
+		}
+		static uint64_t Decode(const uint64_t *table, const uint64_t *denseSums, const Key &key)
+		{
+			return table[key.slots[0]] ^ table[key.slots[1]] ^ table[key.slots[2]] ^ DenseDecode(denseSums, key.dense);
+		}
+
+	private:
+		uint32_t segmentSize;
+		// Fix the dense slots of all tables for the keys that were not peeled, false if they have no solution
+		bool SolveCore(const std::vector<uint32_t> &keySlots, const std::vector<uint64_t> &denseMasks, const std::vector<uint32_t> &peeledKeys,
+					   const uint64_t *values, int numValues, std::vector<uint64_t> &slots) const;
+	};
+} // namespace SECYAN
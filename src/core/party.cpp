@@ -2,6 +2,8 @@
 #include <iostream>
 #include "party.h"
 #include "RNG.h"
+#include "threadpool.h"
+#include <algorithm>
 
 using namespace osuCrypto;
 
@@ -25,7 +27,14 @@ namespace SECYAN
 		gPRNG.SetSeed(osuCrypto::sysRandomSeed());
 		sess.start(ios, address, port + 1, role == SERVER ? SessionMode::Server : SessionMode::Client);
 		chl = sess.addChannel();
-		ot.Init(chl, role == SERVER);
+		// The OPRF uses one channel per thread, as many as both parties have threads
+		uint32_t numLanes = gThreadPool.GetNumThreads(), otherLanes = 0;
+		chl.send(&numLanes, 1);
+		chl.recv(&otherLanes, 1);
+		chls = {chl};
+		for (uint32_t t = 1; t < std::min(numLanes, otherLanes); t++)
+			chls.push_back(sess.addChannel());
+		ot.Init(chls, role == SERVER);
 		this->initialized = true;
 	}
 
@@ -102,16 +111,76 @@ namespace SECYAN
 		return ot.Recv(selectBits);
 	}
 
-	std::vector<std::vector<uint64_t>> Party::OPRFSend(std::vector<std::vector<uint64_t>> &inputs)
+	void Party::ANDTriples(size_t numWords, std::vector<uint64_t> &a, std::vector<uint64_t> &b, std::vector<uint64_t> &c)
 	{
 		CheckInit();
-		return ot.OPRFSend(inputs);
+		ot.ANDTriples(numWords, a, b, c);
 	}
 
-	std::vector<uint64_t> Party::OPRFRecv(std::vector<uint64_t> &inputs)
+	void Party::Preprocess(size_t numOTs)
 	{
 		CheckInit();
-		return ot.OPRFRecv(inputs);
+		ot.Preprocess(numOTs);
+		labelPool.erase(labelPool.begin(), labelPool.begin() + 2 * labelsUsed);
+		labelsUsed = 0;
+		while (labelPool.size() < 2 * numOTs)
+			labelPool.push_back(gRNG.NextUInt32());
+	}
+
+	size_t Party::PooledSendOTs()
+	{
+		CheckInit();
+		return ot.PooledSendOTs();
+	}
+
+	size_t Party::PooledRecvOTs()
+	{
+		CheckInit();
+		return ot.PooledRecvOTs();
+	}
+
+	void Party::RandomLabels(uint32_t *first, uint32_t *second, size_t n)
+	{
+		if (2 * n <= labelPool.size() - 2 * labelsUsed)
+		{
+			auto labels = &labelPool[2 * labelsUsed];
+			for (size_t i = 0; i < n; i++)
+			{
+				first[i] = labels[2 * i];
+				second[i] = labels[2 * i + 1];
+			}
+			labelsUsed += n;
+			return;
+		}
+		for (size_t i = 0; i < n; i++)
+		{
+			first[i] = gRNG.NextUInt32();
+			second[i] = gRNG.NextUInt32();
+		}
+	}
+
+	std::vector<uint64_t> Party::OPRFSend(const std::vector<uint64_t> &inputs, const std::vector<uint32_t> &offsets, uint32_t outputWords)
+	{
+		CheckInit();
+		return ot.OPRFSend(inputs, offsets, outputWords);
+	}
+
+	std::vector<uint64_t> Party::OPRFRecv(std::vector<uint64_t> &inputs, uint32_t outputWords)
+	{
+		CheckInit();
+		return ot.OPRFRecv(inputs, outputWords);
+	}
+
+	void Party::SetOPRFThreads(uint32_t numThreads)
+	{
+		CheckInit();
+		ot.SetNumThreads(numThreads);
+	}
+
+	uint32_t Party::GetOPRFThreads()
+	{
+		CheckInit();
+		return ot.GetNumThreads();
 	}
 
 	int64_t Party::Tick(std::string name)
@@ -133,8 +202,12 @@ namespace SECYAN
 	uint64_t Party::GetCommCostAndResetStats()
 	{
 		// In terms of bytes
-		auto total_cost = chl.getTotalDataSent() + chl.getTotalDataRecv() + this->comm_cost;
-		chl.resetStats();
+		auto total_cost = this->comm_cost;
+		for (auto &c : chls)
+		{
+			total_cost += c.getTotalDataSent() + c.getTotalDataRecv();
+			c.resetStats();
+		}
 		this->comm_cost = 0;
 		return total_cost;
 	}
@@ -54,8 +54,23 @@ namespace SECYAN
 
 		void OTSend(std::vector<uint64_t> &msg0, std::vector<uint64_t> &msg1);
 		std::vector<uint64_t> OTRecv(std::vector<uint32_t> &selectBits);
-		std::vector<std::vector<uint64_t>> OPRFSend(std::vector<std::vector<uint64_t>> &inputs);
-		std::vector<uint64_t> OPRFRecv(std::vector<uint64_t> &inputs);
+		// Random AND triples for bit-sliced boolean circuits (see OT::ANDTriples)
+		void ANDTriples(size_t numWords, std::vector<uint64_t> &a, std::vector<uint64_t> &b, std::vector<uint64_t> &c);
+		// Offline phase, before the data arrives: fill the pools up to numOTs random OTs in each direction (see OT::Preprocess)
+		// and the labels of numOTs gates, so that the OTs of the OEP (one per gate) are a short message exchange.
+		// Both parties call it with the same numOTs
+		void Preprocess(size_t numOTs);
+		size_t PooledSendOTs();
+		size_t PooledRecvOTs();
+		// Random labels first[i], second[i] for i < n (drawn in this order), from the preprocessed labels while they last
+		void RandomLabels(uint32_t *first, uint32_t *second, size_t n);
+		// Bin i holds inputs[offsets[i], offsets[i + 1]), the outputs have the same layout, outputWords words per input
+		std::vector<uint64_t> OPRFSend(const std::vector<uint64_t> &inputs, const std::vector<uint32_t> &offsets, uint32_t outputWords = 1);
+		std::vector<uint64_t> OPRFRecv(std::vector<uint64_t> &inputs, uint32_t outputWords = 1);
+		// Threads used by the OPRF, by default (and at most) the smaller gThreadPool.GetNumThreads() of the two parties at Init
+		// Both parties must set the same number
+		void SetOPRFThreads(uint32_t numThreads);
+		uint32_t GetOPRFThreads();
 		bool printTickTime = true;
 		int64_t Tick(std::string name);
 		uint64_t GetCommCostAndResetStats(); // Get number of bytes in all communication
@@ -71,8 +86,11 @@ namespace SECYAN
 		osuCrypto::IOService ios;
 		osuCrypto::Session sess;
 		osuCrypto::Channel chl;
+		std::vector<osuCrypto::Channel> chls; // chl and the other OPRF channels
 		osuCrypto::PRNG prng;
 		OT ot;
+		std::vector<uint32_t> labelPool; // pairs of labels from index 2 * labelsUsed on
+		size_t labelsUsed = 0;
 		std::unordered_map<std::string, std::chrono::system_clock::time_point> tick_table;
 	};
 	// A global Party
@@ -1,4 +1,6 @@
 #include "poly.h"
+#include "field.h"
+#include <algorithm>
 
 namespace SECYAN
 {
@@ -9,19 +11,10 @@ namespace SECYAN
 		return (x >> 61) + (x & poly_modulus);
 	}
 
-	// x, y < 2^62
+	// Any x, y (see field.h), the result is in [0, p)
 	uint64_t mod_mul(uint64_t x, uint64_t y)
 	{
-		uint64_t x1, x2, y1, y2, z1, z2, ans;
-		x1 = x >> 31;
-		x2 = x & 0x7fffffff;
-		y1 = y >> 31;
-		y2 = y & 0x7fffffff;
-		ans = x1 * y2 + x2 * y1;
-		z1 = ans >> 30;
-		z2 = ans & 0x3fffffff;
-		ans = z1 + (z2 << 31) + x1 * (y1 << 1) + x2 * y2;
-		return fast_mod(ans);
+		return field_mul(x, y);
 	}
 
 	// find x such that x*v=1 (mod p). v>0.
@@ -52,12 +45,15 @@ namespace SECYAN
 	uint64_t poly_eval(uint64_t *coeff, uint64_t x, int size)
 	// does a Horner evaluation
 	{
+		// x < 2^62, acc stays below 2^61 + 8 and is fully reduced at the end
 		uint64_t acc = 0;
 		for (int i = size - 1; i >= 0; i--)
 		{
-			acc = mod_mul(acc, x) + coeff[i];
+			uint128_t t = (uint128_t)acc * x + coeff[i];
+			acc = (uint64_t)(t & poly_modulus) + (uint64_t)(t >> 61);
+			acc = (acc & poly_modulus) + (acc >> 61);
 		}
-		return acc >= poly_modulus ? acc - poly_modulus : acc;
+		return field_reduce128(acc);
 	}
 
 	void interpolate(uint64_t *X, uint64_t *Y, int size, uint64_t *coeff)
@@ -113,4 +109,297 @@ namespace SECYAN
 		delete[] prod;
 	}
 
+	// Sums of products are accumulated in 128 bits and reduced once, at most maxLazyTerms products (each < 2^122) at a time
+	const int maxLazyTerms = 64;
+
+	// sum of a[i] * b[-i] for i in [0, n), i.e. b is read backwards
+	inline uint64_t dot_reversed(const uint64_t *a, const uint64_t *b, int n)
+	{
+		uint64_t sum = 0;
+		for (int begin = 0; begin < n; begin += maxLazyTerms - 1)
+		{
+			uint128_t acc = sum;
+			int end = std::min(n, begin + maxLazyTerms - 1);
+			for (int i = begin; i < end; i++)
+				acc += (uint128_t)a[i] * b[-i];
+			sum = field_reduce128(acc);
+		}
+		return sum;
+	}
+
+	const int karatsubaThreshold = 64; // schoolbook multiplication up to this length
+	const int divisionThreshold = 2048; // schoolbook division below this divisor (or quotient) length, measured on mega-bin loads
+	const int leafSize = 8; // the nodes of at most leafSize points are leaves of the subproduct tree
+
+	// out[0, n + m - 1) = a[0, n) * b[0, m)
+	void poly_mul(const uint64_t *a, int n, const uint64_t *b, int m, uint64_t *out)
+	{
+		if (n < m)
+		{
+			std::swap(a, b);
+			std::swap(n, m);
+		}
+		if (m <= karatsubaThreshold)
+		{
+			// out[k] = sum of a[i] * b[k - i]
+			for (int k = 0; k < n + m - 1; k++)
+			{
+				int begin = std::max(0, k - m + 1), end = std::min(n, k + 1);
+				out[k] = dot_reversed(a + begin, b + k - begin, end - begin);
+			}
+			return;
+		}
+		std::fill(out, out + n + m - 1, 0);
+		if (n > m)
+		{
+			// Unbalanced: multiply b by the chunks of a of length m
+			std::vector<uint64_t> part(2 * m - 1);
+			for (int i = 0; i < n; i += m)
+			{
+				int len = std::min(m, n - i);
+				poly_mul(a + i, len, b, m, part.data());
+				for (int k = 0; k < len + m - 1; k++)
+					out[i + k] = field_add(out[i + k], part[k]);
+			}
+			return;
+		}
+		// Karatsuba: a = a0 + x^h a1, b = b0 + x^h b1
+		int h = n / 2, l = n - h;
+		std::vector<uint64_t> z0(2 * h - 1), z1(2 * l - 1), z2(2 * l - 1), sa(l), sb(l);
+		poly_mul(a, h, b, h, z0.data());
+		poly_mul(a + h, l, b + h, l, z2.data());
+		for (int i = 0; i < l; i++)
+		{
+			sa[i] = i < h ? field_add(a[i], a[h + i]) : a[h + i];
+			sb[i] = i < h ? field_add(b[i], b[h + i]) : b[h + i];
+		}
+		poly_mul(sa.data(), l, sb.data(), l, z1.data());
+		for (int i = 0; i < 2 * l - 1; i++)
+			z1[i] = field_sub(z1[i], z2[i]);
+		for (int i = 0; i < 2 * h - 1; i++)
+		{
+			z1[i] = field_sub(z1[i], z0[i]);
+			out[i] = z0[i];
+		}
+		for (int i = 0; i < 2 * l - 1; i++)
+		{
+			out[h + i] = field_add(out[h + i], z1[i]);
+			out[2 * h + i] = field_add(out[2 * h + i], z2[i]);
+		}
+	}
+
+	std::vector<uint64_t> poly_mul(const std::vector<uint64_t> &a, const std::vector<uint64_t> &b)
+	{
+		std::vector<uint64_t> out(a.size() + b.size() - 1);
+		poly_mul(a.data(), a.size(), b.data(), b.size(), out.data());
+		return out;
+	}
+
+	// f^-1 mod x^n by Newton iteration, f[0] = 1
+	std::vector<uint64_t> poly_inverse(const std::vector<uint64_t> &f, int n)
+	{
+		std::vector<uint64_t> g{1};
+		for (int t = 1; t < n;)
+		{
+			int t2 = std::min(2 * t, n);
+			// g = g * (2 - f * g) mod x^t2
+			std::vector<uint64_t> e(std::min<int>(f.size(), t2) + g.size() - 1);
+			poly_mul(f.data(), std::min<int>(f.size(), t2), g.data(), g.size(), e.data());
+			e.resize(t2, 0);
+			for (auto &v : e)
+				v = field_sub(0, v);
+			e[0] = field_add(e[0], 2);
+			g = poly_mul(g, e);
+			g.resize(t2);
+			t = t2;
+		}
+		return g;
+	}
+
+	// a mod b, b is monic
+	std::vector<uint64_t> poly_rem(std::vector<uint64_t> a, const std::vector<uint64_t> &b)
+	{
+		int m = b.size() - 1;
+		if ((int)a.size() <= m)
+			return a;
+		int k = a.size() - m; // the length of the quotient
+		if (m < divisionThreshold || k < divisionThreshold)
+		{
+			// q[t] = a[t + m] - sum of q[s] * b[t + m - s] for s in (t, t + m], and a - q * b below x^m
+			std::vector<uint64_t> q(k);
+			for (int t = k - 1; t >= 0; t--)
+			{
+				int end = std::min(k, t + m + 1);
+				q[t] = field_sub(a[t + m], dot_reversed(q.data() + t + 1, b.data() + m - 1, end - t - 1));
+			}
+			for (int i = 0; i < m; i++)
+			{
+				int end = std::min(k, i + 1);
+				a[i] = field_sub(a[i], dot_reversed(q.data(), b.data() + i, end));
+			}
+			a.resize(m);
+			return a;
+		}
+		// rev(q) = rev(a) * rev(b)^-1 mod x^k
+		std::vector<uint64_t> revA(a.rbegin(), a.rbegin() + k), revB(b.rbegin(), b.rend());
+		revB.resize(std::min(k, m + 1));
+		auto revQ = poly_mul(revA, poly_inverse(revB, k));
+		revQ.resize(k);
+		std::vector<uint64_t> q(revQ.rbegin(), revQ.rend());
+		// only the low m coefficients of q * b are needed
+		std::vector<uint64_t> qb(std::min(k, m) + m - 1 + 1);
+		poly_mul(q.data(), std::min(k, m), b.data(), m, qb.data());
+		for (int i = 0; i < m; i++)
+			a[i] = field_sub(a[i], qb[i]);
+		a.resize(m);
+		return a;
+	}
+
+	// The product of x - X[k] for k in [begin, end)
+	std::vector<uint64_t> LeafProduct(const uint64_t *X, int begin, int end)
+	{
+		std::vector<uint64_t> product{1};
+		for (int k = begin; k < end; k++)
+		{
+			// product *= x - X[k]
+			product.push_back(0);
+			for (int i = product.size() - 1; i >= 0; i--)
+				product[i] = field_sub(i > 0 ? product[i - 1] : 0, field_mul(product[i], X[k]));
+		}
+		return product;
+	}
+
+	Interpolator::Interpolator(int size) : size(size), dummyProducts(4 * size)
+	{
+		if (size > 0)
+			BuildDummy(1, 0, size);
+	}
+
+	void Interpolator::BuildDummy(int node, int begin, int end)
+	{
+		if (end - begin <= leafSize)
+		{
+			std::vector<uint64_t> X(end);
+			for (int k = begin; k < end; k++)
+				X[k] = poly_modulus - k;
+			dummyProducts[node] = LeafProduct(X.data(), begin, end);
+			return;
+		}
+		int mid = (begin + end) / 2;
+		BuildDummy(2 * node, begin, mid);
+		BuildDummy(2 * node + 1, mid, end);
+		dummyProducts[node] = poly_mul(dummyProducts[2 * node], dummyProducts[2 * node + 1]);
+	}
+
+	const std::vector<uint64_t> &Interpolator::Product(int node, int begin, int numReal, const std::vector<Poly> &products) const
+	{
+		return begin >= numReal ? dummyProducts[node] : products[node];
+	}
+
+	void Interpolator::Build(int node, int begin, int end, const uint64_t *X, int numReal, std::vector<Poly> &products) const
+	{
+		if (begin >= numReal)
+			return; // a dummy node
+		if (end - begin <= leafSize)
+		{
+			products[node] = LeafProduct(X, begin, end);
+			return;
+		}
+		int mid = (begin + end) / 2;
+		Build(2 * node, begin, mid, X, numReal, products);
+		Build(2 * node + 1, mid, end, X, numReal, products);
+		products[node] = poly_mul(Product(2 * node, begin, numReal, products), Product(2 * node + 1, mid, numReal, products));
+	}
+
+	void Interpolator::Evaluate(int node, int begin, int end, const Poly &r, const uint64_t *X, int numReal,
+								const std::vector<Poly> &products, uint64_t *values) const
+	{
+		if (end - begin <= leafSize)
+		{
+			for (int k = begin; k < end; k++)
+			{
+				uint64_t acc = 0;
+				for (int i = r.size() - 1; i >= 0; i--)
+					acc = field_add(field_mul(acc, X[k]), r[i]);
+				values[k] = acc;
+			}
+			return;
+		}
+		int mid = (begin + end) / 2;
+		Evaluate(2 * node, begin, mid, poly_rem(r, Product(2 * node, begin, numReal, products)), X, numReal, products, values);
+		Evaluate(2 * node + 1, mid, end, poly_rem(r, Product(2 * node + 1, mid, numReal, products)), X, numReal, products, values);
+	}
+
+	std::vector<uint64_t> Interpolator::Combine(int node, int begin, int end, const uint64_t *X, int numReal, const uint64_t *weights,
+												const std::vector<Poly> &products) const
+	{
+		auto &product = Product(node, begin, numReal, products);
+		if (end - begin <= leafSize)
+		{
+			// product / (x - X[k]) by synthetic division
+			Poly sum(end - begin, 0), quotient(end - begin);
+			for (int k = begin; k < end; k++)
+			{
+				uint64_t carry = 0;
+				for (int i = end - begin; i > 0; i--)
+				{
+					carry = field_add(product[i], field_mul(carry, X[k]));
+					quotient[i - 1] = carry;
+				}
+				for (int i = 0; i < end - begin; i++)
+					sum[i] = field_add(sum[i], field_mul(weights[k], quotient[i]));
+			}
+			return sum;
+		}
+		int mid = (begin + end) / 2;
+		auto left = Combine(2 * node, begin, mid, X, numReal, weights, products);
+		auto right = Combine(2 * node + 1, mid, end, X, numReal, weights, products);
+		// left * product(right) + right * product(left)
+		auto sum = poly_mul(left, Product(2 * node + 1, mid, numReal, products));
+		auto other = poly_mul(right, Product(2 * node, begin, numReal, products));
+		sum.resize(end - begin, 0);
+		for (size_t i = 0; i < other.size() && i < sum.size(); i++)
+			sum[i] = field_add(sum[i], other[i]);
+		return sum;
+	}
+
+	void Interpolator::Interpolate(const uint64_t *X, const uint64_t *Y, int numReal, uint64_t *coeff, int numY) const
+	{
+		if (size == 0)
+			return;
+		std::vector<uint64_t> points(X, X + size), values(size);
+		for (auto &x : points)
+			x %= poly_modulus;
+		std::vector<Poly> products(4 * size);
+		Build(1, 0, size, points.data(), numReal, products);
+
+		// The weight of point k is 1 / M'(X[k]), M is the product of all x - X[k]
+		auto &root = Product(1, 0, numReal, products);
+		Poly derivative(size);
+		for (int i = 1; i <= size; i++)
+			derivative[i - 1] = field_mul(root[i], i);
+		Evaluate(1, 0, size, derivative, points.data(), numReal, products, values.data());
+
+		// Batch inversion: one mod_inverse for all points
+		std::vector<uint64_t> prefix(size + 1);
+		prefix[0] = 1;
+		for (int k = 0; k < size; k++)
+			prefix[k + 1] = field_mul(prefix[k], values[k]);
+		uint64_t inverse = mod_inverse(prefix[size]);
+		std::vector<uint64_t> inverses(size), weights(size);
+		for (int k = size - 1; k >= 0; k--)
+		{
+			inverses[k] = field_mul(inverse, prefix[k]);
+			inverse = field_mul(inverse, values[k]);
+		}
+
+		for (int t = 0; t < numY; t++)
+		{
+			for (int k = 0; k < size; k++)
+				weights[k] = field_mul(inverses[k], Y[t * size + k] % poly_modulus);
+			auto sum = Combine(1, 0, size, points.data(), numReal, weights.data(), products);
+			std::copy(sum.begin(), sum.end(), coeff + t * size);
+		}
+	}
+
 } // namespace SECYAN
\ No newline at end of file
@@ -1,8 +1,37 @@
 #pragma once
 #include <cstdint>
+#include <vector>
+#include "field.h"
 
 namespace SECYAN{
-static const uint64_t poly_modulus = 0x1fffffffffffffffull;
+static const uint64_t poly_modulus = field_modulus;
+// One point, use field_eval_batch (see field.h) for many points
 uint64_t poly_eval(uint64_t* coeff, uint64_t x, int size);
+// The quadratic interpolation, kept as a reference for Interpolator
 void interpolate(uint64_t* X, uint64_t* Y, int size, uint64_t* coeff);
-}
\ No newline at end of file
+
+// Interpolation of size points by a subproduct tree, in O(M(size) log size) with Karatsuba multiplication M
+// The points X[k] for k >= numReal must be the dummy points poly_modulus - k (see PSI::BobIntersect),
+// the subproducts of these points are computed once by the constructor. Interpolate is thread safe.
+class Interpolator
+{
+public:
+	explicit Interpolator(int size);
+	// coeff[i] is multiplied by x^i, the X values must be distinct
+	// numY polynomials share the points X: polynomial t takes the values Y[t * size, (t + 1) * size) and
+	// has the coefficients coeff[t * size, (t + 1) * size), the tree and the weights are computed once
+	void Interpolate(const uint64_t* X, const uint64_t* Y, int numReal, uint64_t* coeff, int numY = 1) const;
+
+private:
+	typedef std::vector<uint64_t> Poly; // coefficients, lowest degree first
+	int size;
+	std::vector<Poly> dummyProducts; // dummyProducts[node]: the product of x - X[k] over the node, if all its points are dummy
+	void BuildDummy(int node, int begin, int end);
+	void Build(int node, int begin, int end, const uint64_t* X, int numReal, std::vector<Poly>& products) const;
+	// values[k] = r(X[k]) for the points of the node, r is reduced modulo the product of the node
+	void Evaluate(int node, int begin, int end, const Poly& r, const uint64_t* X, int numReal, const std::vector<Poly>& products, uint64_t* values) const;
+	// The sum of weights[k] * product / (x - X[k]) over the points of the node
+	Poly Combine(int node, int begin, int end, const uint64_t* X, int numReal, const uint64_t* weights, const std::vector<Poly>& products) const;
+	const Poly& Product(int node, int begin, int numReal, const std::vector<Poly>& products) const;
+};
+}
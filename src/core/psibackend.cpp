@@ -0,0 +1,141 @@
+#include "psibackend.h"
+#include "PSI.h"
+#include "poly.h"
+#include "party.h"
+#include "threadpool.h"
+#include "RNG.h"
+#include "MurmurHash3.h"
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <cmath>
+#include <iostream>
+
+namespace SECYAN
+{
+	using namespace std;
+
+	// The x coordinate of the key (element, bin), two keys of a mega-bin collide with probability about 2^-61
+	inline uint64_t FieldKey(uint64_t element, uint64_t bin)
+	{
+		uint64_t key[2] = {element, bin}, out[2];
+		MurmurHash3_x64_128(key, sizeof(key), 0, out);
+		return out[0] & poly_modulus;
+	}
+
+	PolynomialBackend::PolynomialBackend(int bucketSize, int maxKeys, int BobSetSize) : bucketSize(bucketSize)
+	{
+		int numBinsInMegabin = max((int)(bucketSize * log2(bucketSize) / BobSetSize), 1);
+		numMegabins = (bucketSize + numBinsInMegabin - 1) / numBinsInMegabin;
+		megaBinLoad = MaxBinLoad(maxKeys, numMegabins);
+		// In any case, the load is at most 3*256+20=778 (with 3 hash functions)
+	}
+
+	int PolynomialBackend::MegabinStart(int i) const
+	{
+		// The first bucketSize % numMegabins mega-bins have one more bin
+		return i * (bucketSize / numMegabins) + min(i, bucketSize % numMegabins);
+	}
+
+	void PolynomialBackend::Encode(const vector<uint32_t> &offsets, const vector<uint64_t> &elements, const vector<uint64_t> &values, int numValues)
+	{
+		size_t n = elements.size();
+		size_t numCoeffs = (size_t)numMegabins * numValues * megaBinLoad;
+		// The polynomials of mega-bin i start at coeff[i * numValues * megaBinLoad]
+		uint64_t *coeff = new uint64_t[numCoeffs];
+		// Each mega-bin draws its dummy points from its own stream (seeded by gRNG and the mega-bin id),
+		// so the result does not depend on the number of threads or the scheduling
+		uint32_t streamSeed[2] = {gRNG.NextUInt32(), gRNG.NextUInt32()};
+		std::atomic<bool> overloaded(false);
+		Interpolator interpolator(megaBinLoad);
+		gThreadPool.ParallelFor(numMegabins, [&](size_t i) {
+			std::seed_seq seq{streamSeed[0], streamSeed[1], (uint32_t)i};
+			RNG rng;
+			rng.SetSeed(seq);
+			// The polynomials of the mega-bin share the points pointX, polynomial t takes the values pointY[t * megaBinLoad, ...)
+			vector<uint64_t> pointX(megaBinLoad), pointY(numValues * megaBinLoad);
+			int startBinId = MegabinStart(i), endBinId = MegabinStart(i + 1);
+			uint32_t begin = offsets[startBinId], end = offsets[endBinId];
+			if (end - begin > (uint32_t)megaBinLoad)
+			{
+				overloaded = true;
+				return;
+			}
+			int numReal = end - begin;
+			for (int j = startBinId; j < endBinId; j++)
+				for (uint32_t k = offsets[j]; k < offsets[j + 1]; k++)
+					pointX[k - begin] = FieldKey(elements[k], j);
+			for (int pointId = 0; pointId < numReal; pointId++)
+				for (int t = 0; t < numValues; t++)
+					pointY[t * megaBinLoad + pointId] = values[t * n + begin + pointId] & poly_modulus;
+			for (int pointId = numReal; pointId < megaBinLoad; pointId++)
+			{
+				pointX[pointId] = poly_modulus - pointId;
+				for (int t = 0; t < numValues; t++)
+					pointY[t * megaBinLoad + pointId] = rng.NextUInt32();
+			}
+			interpolator.Interpolate(pointX.data(), pointY.data(), numReal, coeff + i * numValues * megaBinLoad, numValues);
+		});
+		if (overloaded)
+		{
+			std::cerr << "Error: Mega-bin load not enough!" << std::endl;
+			std::exit(1);
+		}
+		gParty.Send(coeff, numCoeffs);
+		delete[] coeff;
+	}
+
+	vector<uint64_t> PolynomialBackend::Decode(const vector<int> &bins, const vector<uint64_t> &elements, int numValues)
+	{
+		size_t n = elements.size();
+		vector<uint64_t> values(numValues * n);
+		size_t numCoeffs = (size_t)numMegabins * numValues * megaBinLoad;
+		uint64_t *coeff = new uint64_t[numCoeffs];
+		gParty.Recv(coeff, numCoeffs);
+		// The mega-bins are independent, the pool hands them out one at a time
+		gThreadPool.ParallelFor(numMegabins, [&](size_t i) {
+			// Evaluate the polynomials of the mega-bin at all its keys at once
+			size_t begin = lower_bound(bins.begin(), bins.end(), MegabinStart(i)) - bins.begin();
+			size_t end = lower_bound(bins.begin(), bins.end(), MegabinStart(i + 1)) - bins.begin();
+			vector<uint64_t> points(end - begin);
+			for (size_t k = begin; k < end; k++)
+				points[k - begin] = FieldKey(elements[k], bins[k]);
+			for (int t = 0; t < numValues; t++)
+				field_eval_batch(coeff + (i * numValues + t) * megaBinLoad, megaBinLoad, points.data(), points.size(), values.data() + t * n + begin);
+		});
+		delete[] coeff;
+		return values;
+	}
+
+	void OKVSBackend::Encode(const vector<uint32_t> &offsets, const vector<uint64_t> &elements, const vector<uint64_t> &values, int numValues)
+	{
+		// The hash functions are public, a seed chosen by retrying would leak Bob's set
+		vector<uint64_t> slots;
+		if (!table.Encode(offsets.data(), offsets.size() - 1, elements.data(), values.data(), numValues, seed, gPRNG, slots))
+		{
+			std::cerr << "Error: OKVS encoding failed!" << std::endl;
+			std::exit(1);
+		}
+		gParty.Send(slots.data(), slots.size());
+	}
+
+	vector<uint64_t> OKVSBackend::Decode(const vector<int> &bins, const vector<uint64_t> &elements, int numValues)
+	{
+		size_t n = elements.size();
+		vector<uint64_t> slots((size_t)numValues * table.NumSlots()), values(numValues * n);
+		gParty.Recv(slots.data(), slots.size());
+		vector<uint64_t> denseSums((size_t)numValues * GarbledCuckooTable::denseSumsSize);
+		for (int t = 0; t < numValues; t++)
+			table.DenseSums(slots.data() + (size_t)t * table.NumSlots(), denseSums.data() + (size_t)t * GarbledCuckooTable::denseSumsSize);
+		gThreadPool.ParallelRange(n, [&](size_t begin, size_t end) {
+			GarbledCuckooTable::Key key;
+			for (size_t k = begin; k < end; k++)
+			{
+				table.KeyOf(elements[k], bins[k], seed, key);
+				for (int t = 0; t < numValues; t++)
+					values[t * n + k] = GarbledCuckooTable::Decode(slots.data() + (size_t)t * table.NumSlots(), denseSums.data() + (size_t)t * GarbledCuckooTable::denseSumsSize, key);
+			}
+		});
+		return values;
+	}
+} // namespace SECYAN
@@ -0,0 +1,50 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include "okvs.h"
+
+namespace SECYAN
+{
+	// The step of the PSI after the OPRF: Bob encodes key-value pairs, so that Alice learns the value of each of her keys that Bob has,
+	// and a random value for her other keys. A key is a pair (element, bin) of the cuckoo table (see PSI.cpp), the backends hash
+	// all 64 bits of the element with the bin. Only the lowest 61 bits of the values are guaranteed to be transferred.
+	class PSIBackend
+	{
+	public:
+		virtual ~PSIBackend() {}
+		// Called by Bob: the keys of bin j are (elements[k], j) for k in [offsets[j], offsets[j + 1]),
+		// key k has the values values[t * n + k] for t < numValues
+		virtual void Encode(const std::vector<uint32_t> &offsets, const std::vector<uint64_t> &elements, const std::vector<uint64_t> &values, int numValues) = 0;
+		// Called by Alice: key k is (elements[k], bins[k]), the bins are increasing, return the values in the same layout as Encode
+		virtual std::vector<uint64_t> Decode(const std::vector<int> &bins, const std::vector<uint64_t> &elements, int numValues) = 0;
+	};
+
+	// One polynomial per mega-bin (a group of consecutive bins), interpolated through the points of Bob
+	// and padded with dummy points to a public load. The time is quadratic in the load (up to log factors)
+	class PolynomialBackend : public PSIBackend
+	{
+	public:
+		// maxKeys: an upper bound of the number of keys of Bob
+		PolynomialBackend(int bucketSize, int maxKeys, int BobSetSize);
+		void Encode(const std::vector<uint32_t> &offsets, const std::vector<uint64_t> &elements, const std::vector<uint64_t> &values, int numValues);
+		std::vector<uint64_t> Decode(const std::vector<int> &bins, const std::vector<uint64_t> &elements, int numValues);
+
+	private:
+		int bucketSize, numMegabins, megaBinLoad;
+		int MegabinStart(int i) const;
+	};
+
+	// One garbled cuckoo table over all keys (see okvs.h), linear in the number of keys
+	class OKVSBackend : public PSIBackend
+	{
+	public:
+		static const uint32_t seed = 0x6B5F; // the seed of the hash functions, public
+		// maxKeys: a public upper bound of the number of keys of Bob
+		explicit OKVSBackend(int maxKeys) : table(maxKeys) {}
+		void Encode(const std::vector<uint32_t> &offsets, const std::vector<uint64_t> &elements, const std::vector<uint64_t> &values, int numValues);
+		std::vector<uint64_t> Decode(const std::vector<int> &bins, const std::vector<uint64_t> &elements, int numValues);
+
+	private:
+		GarbledCuckooTable table;
+	};
+} // namespace SECYAN
@@ -1,6 +1,5 @@
 ﻿#include "relation.h"
 #include "OEP.h"
-#include <fstream>
 #include <iostream>
 #include <iomanip>
 #include <algorithm>
@@ -10,7 +9,13 @@
 #include "circuit/booleancircuits.h"
 #include <numeric>
 #include "RNG.h"
+#include "tblfile.h"
+#include "snapshot.h"
+#include "spill.h"
+#include "threadpool.h"
 #include <unordered_set>
+#include <cstring>
+#include <cmath>
 
 namespace SECYAN
 {
@@ -18,95 +23,232 @@ namespace SECYAN
 	template <typename T>
 	void SubSequence(std::vector<T> &a, std::vector<uint32_t> &indices)
 	{
-		std::vector<T> b = a;
-		a.resize(indices.size());
+		std::vector<T> b(indices.size());
 		for (size_t i = 0; i < indices.size(); i++)
-			a[i] = b[indices[i]];
+			b[i] = a[indices[i]];
+		a.swap(b);
+	}
+
+	// The longest prefix of sortedBy within attrNames (rows sorted by sortedBy are also sorted by its prefixes)
+	std::vector<std::string> SortedPrefix(const std::vector<std::string> &sortedBy, const std::vector<std::string> &attrNames)
+	{
+		size_t k = 0;
+		while (k < sortedBy.size() && std::find(attrNames.begin(), attrNames.end(), sortedBy[k]) != attrNames.end())
+			k++;
+		return std::vector<std::string>(sortedBy.begin(), sortedBy.begin() + k);
+	}
+
+	inline TblFile::FieldType ToFieldType(Relation::DataType type)
+	{
+		switch (type)
+		{
+		case Relation::INT:
+			return TblFile::INT;
+		case Relation::DECIMAL:
+			return TblFile::DECIMAL;
+		case Relation::DATE:
+			return TblFile::DATE;
+		default:
+			return TblFile::STRING;
+		}
 	}
 
 	void Relation::LoadData(const char *filePath, std::string annotAttrName)
+	{
+		std::vector<std::vector<uint32_t>> annots;
+		LoadTuples(filePath, {annotAttrName}, annots);
+		m_Annot.swap(annots[0]);
+	}
+
+	std::vector<Relation> Relation::LoadData(const char *filePath, const std::vector<std::string> &annotAttrNames)
+	{
+		Relation loaded = *this;
+		std::vector<std::vector<uint32_t>> annots;
+		loaded.LoadTuples(filePath, annotAttrNames, annots);
+		std::vector<Relation> copies(annotAttrNames.size(), loaded); // the copies share the tuple storage
+		for (size_t k = 0; k < copies.size(); k++)
+			copies[k].m_Annot.swap(annots[k]);
+		return copies;
+	}
+
+	void Relation::LoadTuples(const char *filePath, const std::vector<std::string> &annotAttrNames, std::vector<std::vector<uint32_t>> &annots)
 	{
 		if (IsDummy())
+		{
+			// The number of rows and the attributes that the rows are sorted by are told by the owner
+			std::vector<uint64_t> info;
+			gParty.Recv(info);
+			m_RI.numRows = info[0];
+			m_RI.sortedBy.clear();
+			for (size_t k = 1; k < info.size(); k++)
+				m_RI.sortedBy.push_back(m_RI.attrNames[info[k]]);
+			annots.assign(annotAttrNames.size(), std::vector<uint32_t>(m_RI.numRows, 0));
 			return;
-		m_Tuples.resize(m_RI.numRows);
-		std::unordered_map<std::string, int> inverseAttrMap;
-		for (uint32_t i = 0; i < m_RI.attrNames.size(); i++)
-			inverseAttrMap[m_RI.attrNames[i]] = i;
+		}
+		m_RI.sortedBy = SortedPrefix(m_RI.sortedBy, m_RI.attrNames);
+		if (Snapshot::IsSnapshot(filePath))
+			LoadSnapshot(filePath, annotAttrNames, annots);
+		else
+			LoadTbl(filePath, annotAttrNames, annots);
+		if (m_AI.isBoolean)
+			for (auto &annot : annots)
+				for (uint32_t i = 0; i < m_RI.numRows; i++)
+					assert(annot[i] <= 1);
 
-		// open file filePath
-		std::ifstream fin(filePath, std::ios::in);
-		if(!fin.is_open())
+		m_Index = std::make_shared<TupleIndex>();
+		m_Index->Bind(filePath, m_RI.numRows);
+
+		if (!m_RI.isPublic)
 		{
-			std::cerr << "Open file error!" << std::endl;
-			std::exit(1);
+			std::vector<uint64_t> info = {m_RI.numRows};
+			for (auto &attrName : m_RI.sortedBy)
+				info.push_back(std::find(m_RI.attrNames.begin(), m_RI.attrNames.end(), attrName) - m_RI.attrNames.begin());
+			gParty.Send(info);
 		}
-		std::string element;
-		int numColumns = -1;
-		fin >> numColumns;
-		fin >> std::ws; // remove the newline character
+	}
 
-		std::vector<int> indexMap(numColumns);
+	void Relation::LoadTbl(const char *filePath, const std::vector<std::string> &annotAttrNames, std::vector<std::vector<uint32_t>> &annots)
+	{
+		TblFile file(filePath);
+		if (m_RI.numRows == 0)
+			m_RI.numRows = file.NumRows();
+		auto numColumns = m_RI.attrNames.size();
+		annots.assign(annotAttrNames.size(), std::vector<uint32_t>(m_RI.numRows, 0));
+
+		// All columns are parsed in a single pass over the file
+		std::vector<TblFile::Field> fields;
 		for (uint32_t i = 0; i < numColumns; i++)
 		{
-			getline(fin, element, '|');
-			auto it = inverseAttrMap.find(element);
-			if (it != inverseAttrMap.end())
-				indexMap[i] = it->second;
-			else if (element == annotAttrName)
-				indexMap[i] = -2;
-			else
-				indexMap[i] = -1;
+			int fileColumn = file.FindColumn(m_RI.attrNames[i]);
+			if (fileColumn < 0)
+			{
+				std::cerr << "Load attribute error: " << m_RI.attrNames[i] << " not found!" << std::endl;
+				std::exit(1);
+			}
+			fields.push_back({fileColumn, ToFieldType(m_RI.attrTypes[i]), nullptr});
+		}
+		// The strings are collected in a first pass, then the STRING columns are parsed into dictionary codes
+		std::vector<std::shared_ptr<const Dictionary>> dictionaries(numColumns);
+		for (uint32_t i = 0; i < numColumns; i++)
+			if (m_RI.attrTypes[i] == STRING)
+			{
+				dictionaries[i] = file.BuildDictionary(fields[i].fileColumn, m_RI.numRows);
+				fields[i].dictionary = dictionaries[i].get();
+			}
+		for (size_t k = 0; k < annotAttrNames.size(); k++)
+		{
+			int annotColumn = file.FindColumn(annotAttrNames[k]);
+			if (annotColumn < 0)
+			{
+				std::cerr << "Load annotation error: " << annotAttrNames[k] << " not found!" << std::endl;
+				std::exit(1);
+			}
+			fields.push_back({annotColumn, TblFile::ANNOT, annots[k].data()});
 		}
-		fin >> std::ws;
 
-		for (uint32_t i = 0; i < m_RI.numRows; i++)
+		size_t rowBytes = numColumns * sizeof(uint64_t) + annotAttrNames.size() * sizeof(uint32_t);
+		if (gMemoryBudget.Fits(m_RI.numRows * rowBytes))
 		{
-			uint32_t year, month, day, pos;
-			float f_value;
-			const int arrlen = sizeof(uint64_t) / sizeof(char);
-			char padded_str[arrlen];
-			m_Tuples[i].resize(m_RI.attrNames.size());
-			for (uint32_t j = 0; j < numColumns; j++)
+			m_Tuples = ColumnStore(numColumns, m_RI.numRows);
+			for (uint32_t i = 0; i < numColumns; i++)
 			{
-				getline(fin, element, '|');
-				int index = indexMap[j];
-				if (index >= 0)
-				{
-					switch (m_RI.attrTypes[index])
-					{
-					case DataType::INT:
-						m_Tuples[i][index] = (uint64_t)stoi(element);
-						break;
-					case DataType::DECIMAL:
-						f_value = stof(element);
-						m_Tuples[i][index] = (uint64_t)(int)(100 * f_value);
-						break;
-					case DataType::DATE:
-						if(sscanf(element.c_str(), "%4d-%2d-%2d", &year, &month, &day) != 3)
-						{
-							std::cerr << "Read date error!" << std::endl;
-							std::exit(1);
-						}
-						m_Tuples[i][index] = year * 10000 + month * 100 + day;
-						break;
-					case DataType::STRING:
-						std::memset(padded_str, 0, arrlen);
-						pos = std::max(0, (int)element.length() - arrlen);
-						element.copy(padded_str, arrlen, pos);
-						m_Tuples[i][index] = *(uint64_t *)padded_str;
-						break;
-					}
-				}
-				else if (index == -2)
-				{
-					m_Annot[i] = stoul(element);
-					if (m_AI.isBoolean)
-						assert(m_Annot[i] <= 1);
-				}
+				fields[i].out = m_Tuples.MutableColumn(i);
+				m_Tuples.SetDictionary(i, dictionaries[i]);
+			}
+			file.Parse(fields, m_RI.numRows);
+			return;
+		}
+
+		// Parse a window of chunks at a time and append it to the spilled columns
+		size_t windowRows = gMemoryBudget.GetLimit() / 2 / std::max<size_t>(1, numColumns * sizeof(uint64_t));
+		std::vector<std::vector<uint64_t>> window(numColumns);
+		std::vector<std::unique_ptr<ColumnWriter>> writers(numColumns);
+		for (auto &writer : writers)
+			writer.reset(new ColumnWriter);
+		size_t chunkBegin = 0;
+		while (chunkBegin < file.NumChunks() && file.ChunkFirstRow(chunkBegin) < m_RI.numRows)
+		{
+			size_t firstRow = file.ChunkFirstRow(chunkBegin);
+			size_t chunkEnd = chunkBegin + 1; // at least one chunk
+			while (chunkEnd < file.NumChunks() && file.ChunkFirstRow(chunkEnd + 1) - firstRow <= windowRows)
+				chunkEnd++;
+			size_t numWindowRows = std::min(file.ChunkFirstRow(chunkEnd), m_RI.numRows) - firstRow;
+			for (uint32_t i = 0; i < numColumns; i++)
+			{
+				window[i].resize(numWindowRows);
+				fields[i].out = window[i].data();
+			}
+			for (size_t k = 0; k < annotAttrNames.size(); k++)
+				fields[numColumns + k].out = annots[k].data() + firstRow;
+			file.Parse(fields, m_RI.numRows, chunkBegin, chunkEnd);
+			for (uint32_t i = 0; i < numColumns; i++)
+				writers[i]->Append(window[i].data(), numWindowRows);
+			chunkBegin = chunkEnd;
+		}
+		std::vector<Column> columns;
+		for (auto &writer : writers)
+			columns.push_back(writer->Finish());
+		m_Tuples = ColumnStore(std::move(columns), m_RI.numRows);
+		for (uint32_t i = 0; i < numColumns; i++)
+			m_Tuples.SetDictionary(i, dictionaries[i]);
+	}
+
+	void Relation::LoadSnapshot(const char *filePath, const std::vector<std::string> &annotAttrNames, std::vector<std::vector<uint32_t>> &annots)
+	{
+		Snapshot file(filePath);
+		if (m_RI.numRows == 0)
+			m_RI.numRows = file.NumRows();
+		else if (m_RI.numRows > file.NumRows())
+		{
+			std::cerr << "Read data error: " << filePath << " has only " << file.NumRows() << " rows!" << std::endl;
+			std::exit(1);
+		}
+
+		// The attribute columns are used in place, only the (mutable) annotations are copied
+		std::vector<Column> columns;
+		for (uint32_t i = 0; i < m_RI.attrNames.size(); i++)
+		{
+			int fileColumn = file.FindColumn(m_RI.attrNames[i]);
+			if (fileColumn < 0)
+			{
+				std::cerr << "Load attribute error: " << m_RI.attrNames[i] << " not found!" << std::endl;
+				std::exit(1);
+			}
+			if (file.ColumnType(fileColumn) != ToFieldType(m_RI.attrTypes[i]))
+			{
+				std::cerr << "Load attribute error: " << m_RI.attrNames[i] << " has a different type in the snapshot (see tblconvert -t)!" << std::endl;
+				std::exit(1);
+			}
+			columns.push_back(file.GetColumn(fileColumn, m_RI.numRows));
+		}
+		m_Tuples = ColumnStore(std::move(columns), m_RI.numRows);
+		for (uint32_t i = 0; i < m_RI.attrNames.size(); i++)
+			if (m_RI.attrTypes[i] == STRING)
+				m_Tuples.SetDictionary(i, file.GetDictionary(file.FindColumn(m_RI.attrNames[i])));
+		annots.resize(annotAttrNames.size());
+		for (size_t k = 0; k < annotAttrNames.size(); k++)
+		{
+			int annotColumn = file.FindColumn(annotAttrNames[k]);
+			if (annotColumn < 0 || file.ColumnType(annotColumn) != TblFile::ANNOT)
+			{
+				std::cerr << "Load annotation error: " << annotAttrNames[k] << " not found!" << std::endl;
+				std::exit(1);
 			}
-			fin >> std::ws;
+			auto annot = file.GetAnnot(annotColumn);
+			annots[k].assign(annot, annot + m_RI.numRows);
 		}
-		fin.close();
+		std::vector<std::string> sortedBy;
+		for (auto col : file.SortColumns())
+			sortedBy.push_back(file.ColumnNames()[col]);
+		sortedBy = SortedPrefix(sortedBy, m_RI.attrNames);
+		if (sortedBy.size() > m_RI.sortedBy.size())
+			m_RI.sortedBy = sortedBy;
+	}
+
+	void Relation::EnforceMemoryBudget()
+	{
+		if (!gMemoryBudget.Fits(m_Tuples.MemoryBytes() + m_Annot.size() * sizeof(uint32_t)))
+			m_Tuples.Spill();
 	}
 
 	void Relation::RevealAnnotToOwner()
@@ -132,6 +274,7 @@ namespace SECYAN
 
 	void Relation::Print(size_t limit_size, bool showZeroAnnotedTuple)
 	{
+		m_Tuples.Compact();
 		bool dummy = IsDummy();
 		if (m_RI.owner != gParty.GetRole() && m_AI.knownByOwner)
 		{
@@ -148,11 +291,9 @@ namespace SECYAN
 		uint64_t i_value, year, month, day;
 		uint32_t out, printed = 0;
 		float f_value;
-		const int arrlen = sizeof(uint64_t) / sizeof(char);
-		char padded_str[arrlen + 1] = "";
 		for (uint32_t i = 0; i < m_RI.numRows && printed < limit_size; i++)
 		{
-			if (m_AI.knownByOwner && (m_Annot[i] == 0 && !showZeroAnnotedTuple || m_Tuples[i].IsDummy()))
+			if (m_AI.knownByOwner && (m_Annot[i] == 0 && !showZeroAnnotedTuple || m_Tuples.IsDummy(i)))
 				continue;
 			printed++;
 			std::cout << i + 1 << '\t';
@@ -163,14 +304,13 @@ namespace SECYAN
 					switch (m_RI.attrTypes[j])
 					{
 					case DataType::INT:
-						std::cout << (int)m_Tuples[i][j];
+						std::cout << (int)m_Tuples.Get(i, j);
 						break;
 					case DataType::STRING:
-						*(uint64_t *)padded_str = m_Tuples[i][j];
-						std::cout << padded_str; // for simplicity
+						std::cout << m_Tuples.GetDictionary(j)->Get(m_Tuples.Get(i, j));
 						break;
 					case DataType::DATE:
-						i_value = m_Tuples[i][j];
+						i_value = m_Tuples.Get(i, j);
 						day = i_value % 100;
 						i_value /= 100;
 						month = i_value % 100;
@@ -179,7 +319,7 @@ namespace SECYAN
 						std::cout << year << '-' << std::setfill('0') << std::setw(2) << month << '-' << std::setfill('0') << std::setw(2) << day;
 						break;
 					case DataType::DECIMAL:
-						f_value = (float)(int)m_Tuples[i][j] / 100;
+						f_value = (float)(int)m_Tuples.Get(i, j) / 100;
 						std::cout << std::setprecision(2) << std::fixed << f_value;
 						break;
 					}
@@ -221,17 +361,35 @@ namespace SECYAN
 
 	void Relation::Sort()
 	{
-		if (m_RI.sorted)
+		m_Tuples.Compact();
+		auto &attrNames = m_RI.attrNames;
+		if (attrNames.size() <= m_RI.sortedBy.size() && std::equal(attrNames.begin(), attrNames.end(), m_RI.sortedBy.begin()))
 			return;
-		m_RI.sorted = true;
+		m_RI.sortedBy = attrNames;
 		if (m_RI.numRows == 0)
 			return;
 		std::vector<uint32_t> indices(m_RI.numRows);
 		if (!IsDummy())
 		{
-			std::iota(indices.begin(), indices.end(), 0);
-			std::sort(indices.begin(), indices.end(), [&](uint32_t i, uint32_t j) { return m_Tuples[i] < m_Tuples[j]; });
-			SubSequence(m_Tuples, indices);
+			// the index array, the sorted columns and the original columns (if in memory)
+			size_t rowBytes = 2 * m_Tuples.NumColumns() * sizeof(uint64_t) + sizeof(uint32_t);
+			if (gMemoryBudget.Fits(m_RI.numRows * rowBytes))
+			{
+				// The order of the values is cached (or persisted), the dummy rows are moved last
+				auto permutation = m_Index->FindSortPermutation(attrNames);
+				if (!permutation)
+				{
+					m_Index->AddSortPermutation(attrNames, m_Tuples.SortIndices(0, m_RI.numRows, false));
+					permutation = m_Index->FindSortPermutation(attrNames);
+				}
+				indices = *permutation;
+				std::stable_partition(indices.begin(), indices.end(), [&](uint32_t i) { return !m_Tuples.IsDummy(i); });
+				m_Tuples.Gather(indices);
+				EnforceMemoryBudget();
+			}
+			else
+				indices = m_Tuples.ExternalSort(std::max<size_t>(1, gMemoryBudget.GetLimit() / rowBytes));
+			m_Index = std::make_shared<TupleIndex>();
 		}
 		if (m_RI.isPublic)
 			SubSequence(m_Annot, indices);
@@ -239,6 +397,47 @@ namespace SECYAN
 			PermuteAnnotByOwner(indices);
 	}
 
+	void Relation::Group()
+	{
+		m_Tuples.Compact();
+		auto numAttrs = m_RI.attrNames.size();
+		if (numAttrs <= m_RI.sortedBy.size())
+		{
+			std::vector<std::string> attrNames(m_RI.attrNames);
+			std::vector<std::string> prefix(m_RI.sortedBy.begin(), m_RI.sortedBy.begin() + numAttrs);
+			std::sort(attrNames.begin(), attrNames.end());
+			std::sort(prefix.begin(), prefix.end());
+			if (attrNames == prefix)
+				return;
+		}
+		Sort();
+	}
+
+	std::vector<uint32_t> Relation::GroupBits()
+	{
+		std::vector<uint32_t> bits(std::max<size_t>(m_RI.numRows, 1) - 1, 0);
+		int64_t last = -1; // the last non-dummy row
+		for (uint32_t i = 0; i < m_RI.numRows; i++)
+		{
+			if (m_Tuples.IsDummy(i))
+				continue;
+			if (last >= 0 && m_Tuples.Equal(last, i))
+				std::fill(bits.begin() + last, bits.begin() + i, 1);
+			last = i;
+		}
+		return bits;
+	}
+
+	Relation Relation::ProjectedTuples(std::vector<std::string> &attrNames)
+	{
+		std::vector<uint32_t> annot;
+		annot.swap(m_Annot);
+		Relation projected = *this;
+		m_Annot.swap(annot);
+		projected.Project(attrNames);
+		return projected;
+	}
+
 	void Relation::Project(const char *projectAttrName)
 	{
 		std::vector<std::string> projectAttrNames(1);
@@ -249,7 +448,7 @@ namespace SECYAN
 	void Relation::Project(std::vector<std::string> &projectAttrNames)
 	{
 		auto numProjectAttrs = projectAttrNames.size();
-		m_RI.sorted = false;
+		m_RI.sortedBy = SortedPrefix(m_RI.sortedBy, projectAttrNames);
 		std::unordered_map<std::string, int> invAttrMap;
 		std::vector<uint32_t> indexMap(numProjectAttrs);
 		for (uint32_t i = 0; i < m_RI.attrNames.size(); i++)
@@ -265,16 +464,7 @@ namespace SECYAN
 			indexMap[i] = it->second;
 		}
 		if (!IsDummy())
-		{
-			for (uint32_t i = 0; i < m_RI.numRows; i++)
-			{
-				Tuple tuple = m_Tuples[i];
-				m_Tuples[i].resize(numProjectAttrs);
-				if (!tuple.IsDummy())
-					for (uint32_t j = 0; j < numProjectAttrs; j++)
-						m_Tuples[i][j] = tuple[indexMap[j]];
-			}
-		}
+			m_Tuples.Project(indexMap);
 		SubSequence(m_RI.attrTypes, indexMap);
 		m_RI.attrNames = projectAttrNames;
 	}
@@ -282,7 +472,7 @@ namespace SECYAN
 	// The pi-1 projector (used after projection)
 	void Relation::AnnotOrAgg()
 	{
-		Sort();
+		Group();
 
 		if (!m_AI.knownByOwner)
 		{
@@ -290,20 +480,20 @@ namespace SECYAN
 			return;
 		}
 		m_AI.isBoolean = true;
-		m_RI.sorted = false;
 		if (IsDummy())
 			return;
 		int numRows = m_RI.numRows;
 		for (uint32_t i = 0; i < numRows; i++)
 			if (m_Annot[i] != 0)
 				m_Annot[i] = 1;
+		auto groupBits = GroupBits();
 		for (uint32_t i = 0; i < numRows - 1; i++)
 		{
-			if (m_Tuples[i] == m_Tuples[i + 1])
+			if (groupBits[i])
 			{
 				m_Annot[i + 1] |= m_Annot[i];
 				m_Annot[i] = 0;
-				m_Tuples[i].ToDummy();
+				m_Tuples.ToDummy(i);
 			}
 		}
 	}
@@ -326,9 +516,12 @@ namespace SECYAN
 			}
 		}
 		m_AI.isBoolean = true;
+		std::vector<uint32_t> groupBits;
+		if (m_RI.owner == gParty.GetRole())
+			groupBits = GroupBits();
 		for (uint32_t i = 0; i < numRows - 1; i++)
 		{
-			bool sameTuple = (m_RI.owner == gParty.GetRole()) && (m_Tuples[i] == m_Tuples[i + 1]);
+			bool sameTuple = (m_RI.owner == gParty.GetRole()) && groupBits[i];
 			auto s_rep = yc->PutINGate((uint8_t)sameTuple, 1, m_RI.owner);
 			auto s_or = yc->PutORGate(bAnnot[i], bAnnot[i + 1]);
 			bAnnot[i] = yc->PutANDGate(yc->PutINVGate(s_rep), bAnnot[i]);
@@ -344,24 +537,20 @@ namespace SECYAN
 			m_Annot[i] = bAnnot[i]->get_clear_value<uint8_t>();
 		gParty.Reset();
 		delete[] bAnnot;
-		m_RI.sorted = false;
 		if (IsDummy())
 			return;
 		for (uint32_t i = 0; i < numRows - 1; i++)
-			if (m_Tuples[i] == m_Tuples[i + 1])
-				m_Tuples[i].ToDummy();
+			if (groupBits[i])
+				m_Tuples.ToDummy(i);
 	}
 
 	void Relation::OwnerAnnotAddAgg()
 	{
 		auto size = m_RI.numRows;
-		std::vector<uint32_t> aggBits(size - 1);
+		auto aggBits = GroupBits();
 		for (uint32_t i = 0; i < size - 1; i++)
-		{
-			aggBits[i] = m_Tuples[i] == m_Tuples[i + 1];
 			if (aggBits[i])
-				m_Tuples[i].ToDummy();
-		}
+				m_Tuples.ToDummy(i);
 		if (m_RI.isPublic || m_AI.knownByOwner)
 		{
 			for (uint32_t i = 0; i < size - 1; i++)
@@ -381,9 +570,8 @@ namespace SECYAN
 	{
 		if (m_RI.numRows == 0)
 			return;
-		Sort();
+		Group();
 		assert(!m_AI.isBoolean);
-		m_RI.sorted = false;
 		if (IsDummy())
 		{
 			if (!m_AI.knownByOwner)
@@ -407,30 +595,72 @@ namespace SECYAN
 
 	uint64_t Relation::HashTuple(int i)
 	{
-		if (i >= m_RI.numRows || i < 0 || m_Tuples[i].IsDummy())
+		if (i >= m_RI.numRows || i < 0 || m_Tuples.IsDummy(i))
 			return (uint64_t)i << 32 | gRNG.NextUInt32();
+		return KeyHash(i);
+	}
+
+	uint64_t Relation::KeyHash(uint32_t i)
+	{
 		int numColumns = this->m_RI.attrNames.size();
 		if (numColumns == 1)
-			return m_Tuples[i][0];
+			return m_Tuples.GetKey(i, 0);
+		const int maxStackColumns = 16;
+		uint64_t stackRow[maxStackColumns];
+		std::vector<uint64_t> heapRow;
+		uint64_t *row = stackRow;
+		if (numColumns > maxStackColumns)
+		{
+			heapRow.resize(numColumns);
+			row = heapRow.data();
+		}
+		m_Tuples.GetKeyRow(i, row); // strings are hashed by their values, not their dictionary codes
 		uint64_t out[2];
-		MurmurHash3_x64_128(m_Tuples[i].data(), numColumns * 8, 0, out);
+		MurmurHash3_x64_128(row, numColumns * 8, 0, out);
 		return out[0];
 	}
 
-	void Relation::SemiJoin(Relation &child, const char *parentAttrName, const char *childAttrName)
+	std::shared_ptr<const HashIndex> Relation::GetHashIndex()
+	{
+		auto index = m_Index->FindHashIndex(m_RI.attrNames);
+		if (index)
+			return index;
+		auto numRows = m_RI.numRows;
+		std::vector<uint64_t> hashValues(numRows);
+		gThreadPool.ParallelRange(numRows, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++)
+				hashValues[i] = KeyHash(i);
+		}, 1 << 14);
+		HashIndex built;
+		built.groups.resize(numRows);
+		std::unordered_map<uint64_t, uint32_t> groupOfKey;
+		for (uint32_t i = 0; i < numRows; i++)
+		{
+			auto it = groupOfKey.emplace(hashValues[i], built.keys.size());
+			if (it.second)
+				built.keys.push_back(hashValues[i]);
+			built.groups[i] = it.first->second;
+		}
+		m_Index->AddHashIndex(m_RI.attrNames, std::move(built));
+		return m_Index->FindHashIndex(m_RI.attrNames);
+	}
+
+	void Relation::SemiJoin(Relation &child, const char *parentAttrName, const char *childAttrName, PSI::Backend psiBackend)
 	{
 		std::vector<std::string> parentAttrNames(1);
 		std::vector<std::string> childAttrNames(1);
 		parentAttrNames[0] = parentAttrName;
 		childAttrNames[0] = childAttrName;
-		SemiJoin(child, parentAttrNames, childAttrNames);
+		SemiJoin(child, parentAttrNames, childAttrNames, psiBackend);
 	}
 
-	void Relation::SemiJoin(Relation &child, std::vector<std::string> &parentAttrNames, std::vector<std::string> &childAttrNames)
+	void Relation::SemiJoin(Relation &child, std::vector<std::string> &parentAttrNames, std::vector<std::string> &childAttrNames, PSI::Backend psiBackend)
 	{
+		m_Tuples.Compact();
+		child.m_Tuples.Compact();
 		assert(parentAttrNames.size() == childAttrNames.size());
 		if (m_RI.owner != child.m_RI.owner)
-			OblivSemiJoin(child, parentAttrNames, childAttrNames);
+			OblivSemiJoin(child, parentAttrNames, childAttrNames, psiBackend);
 		else
 		{
 			std::cerr << "Semi join by the same owner not implemented yet!" << std::endl;
@@ -544,34 +774,58 @@ namespace SECYAN
 		delete[] newAnnot;
 	}
 
-	void Relation::AliceSemiJoin(Relation &BobRelation)
+	std::vector<uint64_t> Relation::AliceElements(std::vector<uint32_t> &elementOfRow)
+	{
+		auto numRows = m_RI.numRows;
+		auto index = GetHashIndex();
+		std::vector<uint64_t> elements;
+		elements.reserve(numRows);
+		elementOfRow.resize(numRows);
+		std::vector<uint32_t> elementOfGroup(index->keys.size(), numRows);
+		for (uint32_t j = 0; j < numRows; j++)
+		{
+			if (m_Tuples.IsDummy(j))
+			{
+				elementOfRow[j] = elements.size();
+				elements.push_back(HashTuple(j));
+				continue;
+			}
+			auto group = index->groups[j];
+			if (elementOfGroup[group] == numRows)
+			{
+				elementOfGroup[group] = elements.size();
+				elements.push_back(index->keys[group]);
+			}
+			elementOfRow[j] = elementOfGroup[group];
+		}
+		return elements;
+	}
+
+	std::vector<uint64_t> Relation::BobElements()
+	{
+		auto index = GetHashIndex();
+		std::vector<uint64_t> elements(m_RI.numRows);
+		for (uint32_t i = 0; i < m_RI.numRows; i++)
+			elements[i] = m_Tuples.IsDummy(i) ? HashTuple(i) : index->keys[index->groups[i]];
+		return elements;
+	}
+
+	void Relation::AliceSemiJoin(Relation &BobRelation, PSI::Backend psiBackend)
 	{
 		assert(m_RI.owner == gParty.GetRole());
 		auto aliceRowNum = m_RI.numRows;
 		auto bobRowNum = BobRelation.m_RI.numRows;
-		std::unordered_map<uint64_t, std::vector<uint32_t>> rowIndexMap;
-		for (uint32_t i = 0; i < aliceRowNum; i++)
-			rowIndexMap[HashTuple(i)].push_back(i);
-		std::vector<uint64_t> myHashValues(aliceRowNum);
-		std::vector<uint32_t> firstPermutedIndices(aliceRowNum);
-		uint32_t i = 0;
-		for (auto mapPair : rowIndexMap)
-		{
-			for (auto j : mapPair.second)
-				firstPermutedIndices[j] = i;
-			myHashValues[i++] = mapPair.first;
-		}
-		assert(i <= aliceRowNum);
-		for (; i < aliceRowNum; i++)
-			myHashValues[i] = HashTuple(-i);
-		PSI psi(myHashValues, aliceRowNum, bobRowNum, PSI::Alice);
-
-		auto indicator = psi.Intersect();
-		std::vector<uint32_t> bobpayload_mask;
-		if (BobRelation.m_AI.knownByOwner)
-			bobpayload_mask = psi.IntersectWithPayload();
-		else
-			bobpayload_mask = psi.CombineSharedPayload(BobRelation.m_Annot, indicator);
+		// Padded with random elements
+		std::vector<uint32_t> firstPermutedIndices;
+		auto myHashValues = AliceElements(firstPermutedIndices);
+		for (uint32_t i = myHashValues.size(); i < aliceRowNum; i++)
+			myHashValues.push_back(HashTuple(-i));
+		// The indicator and the annotation of Bob from one PSI
+		bool sharedAnnot = !BobRelation.m_AI.knownByOwner;
+		PSI psi(myHashValues, aliceRowNum, bobRowNum, PSI::Alice, PSI::NumPayloadOutputs(1, sharedAnnot), psiBackend);
+		std::vector<std::vector<uint32_t>> results;
+		auto indicator = psi.IntersectWithPayloads({sharedAnnot ? &BobRelation.m_Annot : nullptr}, sharedAnnot, results);
+		auto bobpayload_mask = std::move(results[0]);
 
 		auto secondPermutedIndices = psi.CuckooToAliceArray();
 		std::vector<uint32_t> indices(aliceRowNum);
@@ -593,22 +847,18 @@ namespace SECYAN
 		AnnotMul(indicator.data(), bobpayload_mask.data(), BobRelation.m_AI.isBoolean);
 	}
 
-	void Relation::BobSemiJoin(Relation &BobRelation)
+	void Relation::BobSemiJoin(Relation &BobRelation, PSI::Backend psiBackend)
 	{
 		assert(BobRelation.m_RI.owner == gParty.GetRole());
 		auto aliceRowNum = m_RI.numRows;
 		auto bobRowNum = BobRelation.m_RI.numRows;
-		std::vector<uint64_t> myHashValues(bobRowNum);
-		for (uint32_t i = 0; i < bobRowNum; i++)
-			myHashValues[i] = BobRelation.HashTuple(i);
-
-		PSI psi(myHashValues, aliceRowNum, bobRowNum, PSI::Bob);
-		auto indicator = psi.Intersect();
-		std::vector<uint32_t> bobpayload_mask;
-		if (BobRelation.m_AI.knownByOwner)
-			bobpayload_mask = psi.IntersectWithPayload(BobRelation.m_Annot);
-		else
-			bobpayload_mask = psi.CombineSharedPayload(BobRelation.m_Annot, indicator);
+		auto myHashValues = BobRelation.BobElements();
+
+		bool sharedAnnot = !BobRelation.m_AI.knownByOwner;
+		PSI psi(myHashValues, aliceRowNum, bobRowNum, PSI::Bob, PSI::NumPayloadOutputs(1, sharedAnnot), psiBackend);
+		std::vector<std::vector<uint32_t>> results;
+		auto indicator = psi.IntersectWithPayloads({&BobRelation.m_Annot}, sharedAnnot, results);
+		auto bobpayload_mask = std::move(results[0]);
 
 		//auto ac = gParty.GetCircuit(S_ARITH);
 		//auto in = ac->PutSharedSIMDINGate(bobpayload_mask.size(), bobpayload_mask.data(), 32);
@@ -624,22 +874,427 @@ namespace SECYAN
 		AnnotMul(indicator.data(), bobpayload_mask.data(), BobRelation.m_AI.isBoolean);
 	}
 
-	void Relation::OblivSemiJoin(Relation &child, std::vector<std::string> &parentAttrNames, std::vector<std::string> &childAttrNames)
+	// Up to this number of pairs of rows, comparing all pairs is cheaper than the PSI (see psibench -m 1)
+	uint64_t Relation::smallSemiJoinPairs = 1 << 12;
+
+	void Relation::SmallSemiJoin(Relation &child)
+	{
+		auto parentRows = m_RI.numRows, childRows = child.m_RI.numRows;
+		size_t numPairs = parentRows * childRows;
+		// 40 bits of statistical security for all pairs
+		uint32_t keyBits = std::min(64, 40 + (int)std::ceil(std::log2(std::max<size_t>(numPairs, 1))));
+		auto role = gParty.GetRole();
+		// Pair (i, j) of parent row i and child row j is at i * childRows + j, each party fills in the keys of its relation
+		// Keys are hashed, dummy rows have random keys
+		std::vector<uint64_t> keys(numPairs);
+		std::vector<uint32_t> childAnnot(numPairs);
+		auto &own = m_RI.owner == role ? *this : child;
+		std::vector<uint64_t> ownKeys(own.m_RI.numRows);
+		for (uint32_t i = 0; i < own.m_RI.numRows; i++)
+		{
+			uint64_t key = own.KeyHash(i), out[2];
+			MurmurHash3_x64_128(&key, 8, 0, out);
+			ownKeys[i] = own.m_Tuples.IsDummy(i) ? gRNG.NextUInt64() : out[0];
+		}
+		for (uint32_t i = 0; i < parentRows; i++)
+			for (uint32_t j = 0; j < childRows; j++)
+			{
+				keys[i * childRows + j] = m_RI.owner == role ? ownKeys[i] : ownKeys[j];
+				childAnnot[i * childRows + j] = child.m_Annot[j];
+			}
+
+		std::vector<uint32_t> indicator(parentRows, 0), payload(parentRows, 0);
+		if (numPairs == 0)
+		{
+			AnnotMul(indicator.data(), payload.data(), child.m_AI.isBoolean);
+			return;
+		}
+		// The child has distinct keys (as for the PSI), so at most one pair of every parent row matches:
+		// the indicator and the child annotation of row i are the sums of eq(i, j) and eq(i, j) * annot(j) over j
+		auto bc = gParty.GetCircuit(S_BOOL);
+		auto ac = gParty.GetCircuit(S_ARITH);
+		auto s_parent = bc->PutSIMDINGate(numPairs, keys.data(), keyBits, m_RI.owner);
+		auto s_child = bc->PutSIMDINGate(numPairs, keys.data(), keyBits, child.m_RI.owner);
+		auto s_eq = ac->PutB2AGate(bc->PutEQGate(s_parent, s_child));
+		// A boolean shared child annotation is xor-shared, it is converted to an arithmetic sharing for the multiplication
+		share *s_annot;
+		if (child.m_AI.knownByOwner)
+			s_annot = ac->PutSIMDINGate(numPairs, childAnnot.data(), 32, child.m_RI.owner);
+		else if (child.m_AI.isBoolean)
+			s_annot = ac->PutB2AGate(bc->PutSharedSIMDINGate(numPairs, childAnnot.data(), 1));
+		else
+			s_annot = ac->PutSharedSIMDINGate(numPairs, childAnnot.data(), 32);
+		auto s_indicator = ac->PutSharedOUTGate(s_eq);
+		auto s_payload = ac->PutSharedOUTGate(ac->PutMULGate(s_eq, s_annot));
+		gParty.ExecCircuit();
+		uint32_t *eqShares, *payloadShares, bitlen, nvals;
+		s_indicator->get_clear_value_vec(&eqShares, &bitlen, &nvals);
+		s_payload->get_clear_value_vec(&payloadShares, &bitlen, &nvals);
+		gParty.Reset();
+
+		// Sums of arithmetic shares: the lowest bits of the indicator shares are boolean shares of the indicator (and of the
+		// child annotation if it is boolean)
+		for (uint32_t i = 0; i < parentRows; i++)
+			for (uint32_t j = 0; j < childRows; j++)
+			{
+				indicator[i] += eqShares[i * childRows + j];
+				payload[i] += payloadShares[i * childRows + j];
+			}
+		delete[] eqShares;
+		delete[] payloadShares;
+		AnnotMul(indicator.data(), payload.data(), child.m_AI.isBoolean);
+	}
+
+	// Smaller partitions are not worth the padding
+	const size_t minPartitionRows = 1 << 12;
+	// The first seed of the partition hash, public (see PartitionedSemiJoin)
+	const uint32_t partitionSeed = 0x5EC7A2;
+
+	// An upper bound of the loads of numLoads bins, each of which gets each of m balls with probability 1 / n, except with
+	// probability 2^-40 for all of them: the Chernoff bound P[load >= k] <= e^-mu (e mu / k)^k for k > mu = m / n
+	uint32_t PartitionBound(size_t m, uint32_t n, double numLoads)
+	{
+		if (n <= 1 || m == 0)
+			return m;
+		double mu = (double)m / n, target = -40 * std::log(2.0) - std::log(numLoads);
+		size_t low = std::ceil(mu), high = m;
+		while (low < high)
+		{
+			size_t k = low + (high - low) / 2;
+			if (k > mu && -mu + k * (1 + std::log(mu / k)) <= target)
+				high = k;
+			else
+				low = k + 1;
+		}
+		return low;
+	}
+
+	// The public layout of a semi-join in numPartitions partitions (see PartitionedSemiJoin)
+	struct SemiJoinLayout
+	{
+		uint32_t numPartitions;
+		// The rows of each relation are split into numPartitions chunks of consecutive rows
+		uint32_t parentChunkRows, childChunkRows;
+		// The bounds of the elements of the parent in a partition, and of the elements of a chunk in a partition (a block)
+		uint32_t parentBound, parentBlockBound, childBlockBound;
+
+		SemiJoinLayout(uint32_t parentRows, uint32_t childRows, uint32_t numPartitions) : numPartitions(numPartitions)
+		{
+			parentChunkRows = ((size_t)parentRows + numPartitions - 1) / numPartitions;
+			childChunkRows = ((size_t)childRows + numPartitions - 1) / numPartitions;
+			// The partitions of the parent and the blocks of both relations
+			double numLoads = numPartitions + 2.0 * numPartitions * numPartitions;
+			parentBound = PartitionBound(parentRows, numPartitions, numLoads);
+			parentBlockBound = PartitionBound(parentChunkRows, numPartitions, numLoads);
+			childBlockBound = PartitionBound(childChunkRows, numPartitions, numLoads);
+		}
+		// The elements of the child in a partition: one block of each chunk
+		uint32_t ChildBound() const { return numPartitions * childBlockBound; }
+		// The results routed to a chunk of the parent: one block of each partition
+		uint32_t ParentSlots() const { return numPartitions * parentBlockBound; }
+	};
+
+	// The rows [begin, end) of chunk c of a relation
+	inline void ChunkRange(uint32_t numRows, uint32_t chunkRows, uint32_t c, uint32_t &begin, uint32_t &end)
+	{
+		begin = std::min<size_t>((size_t)c * chunkRows, numRows);
+		end = std::min<size_t>((size_t)begin + chunkRows, numRows);
+	}
+
+	// An estimate of the peak bytes of PartitionedSemiJoin (or of AliceSemiJoin and BobSemiJoin for one partition): the arrays
+	// kept across the steps (of either party) and the largest step, a PSI or an extended permutation
+	size_t SemiJoinBytes(const SemiJoinLayout &layout, size_t parentRows, size_t childRows, int numPayloadOutputs)
 	{
+		size_t p = layout.numPartitions;
+		// Alice: the elements with their partitions and slots, the results in blocks and in rows. Bob: the elements, the rows
+		// and the child annotations in blocks, the results in rows
+		size_t aliceBytes = parentRows * (sizeof(uint64_t) + 7 * sizeof(uint32_t)) + p * layout.ParentSlots() * 3 * sizeof(uint32_t);
+		size_t bobBytes = childRows * sizeof(uint64_t) + p * layout.ChildBound() * 2 * sizeof(uint32_t) + parentRows * 2 * sizeof(uint32_t);
+		size_t numBins = PSI::NumBins(layout.parentBound, layout.ChildBound());
+		size_t stepBytes = std::max({PSI::MemoryBytes(layout.parentBound, layout.ChildBound(), numPayloadOutputs),
+									 ExtendedPermuteBytes(layout.childChunkRows, p * layout.childBlockBound),
+									 ExtendedPermuteBytes(numBins, layout.ParentSlots()),
+									 ExtendedPermuteBytes(layout.ParentSlots(), layout.parentChunkRows)});
+		return std::max(aliceBytes, bobBytes) + stepBytes;
+	}
+
+	// Both parties get the larger of their values
+	uint32_t ExchangeMax(uint32_t value)
+	{
+		uint32_t otherValue;
+		if (gParty.GetRole() == SERVER)
+		{
+			gParty.Send(&value, 1);
+			gParty.Recv(&otherValue, 1);
+		}
+		else
+		{
+			gParty.Recv(&otherValue, 1);
+			gParty.Send(&value, 1);
+		}
+		return std::max(value, otherValue);
+	}
+
+	// The smallest power of 2 of partitions whose estimate fits in the memory budget. Both parties use the larger number of
+	// partitions required by their budgets, which they always exchange, since only one of them may have a budget
+	uint32_t NumSemiJoinPartitions(uint32_t parentRows, uint32_t childRows, int numPayloadOutputs)
+	{
+		size_t maxPartitions = std::max<size_t>(1, std::max(parentRows, childRows) / minPartitionRows);
+		uint32_t numPartitions = 1;
+		while (2 * numPartitions <= maxPartitions &&
+			   !gMemoryBudget.Fits(SemiJoinBytes(SemiJoinLayout(parentRows, childRows, numPartitions), parentRows, childRows, numPayloadOutputs)))
+			numPartitions *= 2;
+		return ExchangeMax(numPartitions);
+	}
+
+	inline uint32_t PartitionOf(uint64_t element, uint32_t seed, uint32_t numPartitions)
+	{
+		uint64_t out[2];
+		MurmurHash3_x64_128(&element, sizeof(uint64_t), seed, out);
+		return out[0] % numPartitions;
+	}
+
+	// Alice's side of the layout. Partition q has the elements partitionElements[q], element e is at positionInPartition[e] of its
+	// partition. The distinct elements of chunk c in partition q are blockElements[c * ParentSlots() + q * parentBlockBound + k]
+	// (elements.size() for padding), row i is at slotOfRow[i] of the ParentSlots() slots of its chunk
+	// The elements are distinct, so they fall into the partitions independently. Return false if a bound is exceeded
+	bool ArrangeParentElements(const SemiJoinLayout &layout, const std::vector<uint64_t> &elements, const std::vector<uint32_t> &elementOfRow, uint32_t seed,
+							   std::vector<std::vector<uint32_t>> &partitionElements, std::vector<uint32_t> &positionInPartition,
+							   std::vector<uint32_t> &blockElements, std::vector<uint32_t> &slotOfRow)
+	{
+		uint32_t p = layout.numPartitions, numElements = elements.size(), numRows = elementOfRow.size();
+		std::vector<uint32_t> partitionOf(numElements);
+		partitionElements.assign(p, {});
+		positionInPartition.resize(numElements);
+		for (uint32_t e = 0; e < numElements; e++)
+		{
+			auto q = partitionOf[e] = PartitionOf(elements[e], seed, p);
+			if (partitionElements[q].size() == layout.parentBound)
+				return false;
+			positionInPartition[e] = partitionElements[q].size();
+			partitionElements[q].push_back(e);
+		}
+		uint32_t blockBound = layout.parentBlockBound, numSlots = layout.ParentSlots();
+		blockElements.assign((size_t)p * numSlots, numElements);
+		slotOfRow.resize(numRows);
+		// The slot of element e in chunk chunkOf[e], the last chunk it appeared in
+		std::vector<uint32_t> chunkOf(numElements, p), slotOf(numElements);
+		for (uint32_t c = 0; c < p; c++)
+		{
+			uint32_t begin, end;
+			ChunkRange(numRows, layout.parentChunkRows, c, begin, end);
+			std::vector<uint32_t> blockSizes(p, 0);
+			for (uint32_t i = begin; i < end; i++)
+			{
+				auto e = elementOfRow[i];
+				if (chunkOf[e] != c)
+				{
+					auto q = partitionOf[e];
+					if (blockSizes[q] == blockBound)
+						return false;
+					chunkOf[e] = c;
+					slotOf[e] = q * blockBound + blockSizes[q]++;
+					blockElements[(size_t)c * numSlots + slotOf[e]] = e;
+				}
+				slotOfRow[i] = slotOf[e];
+			}
+		}
+		return true;
+	}
+
+	// Bob's side of the layout (one element per row): the rows of chunk c in partition q are
+	// blockRows[q * ChildBound() + c * childBlockBound + k] (elements.size() for padding). Return false if a bound is exceeded
+	bool ArrangeChildElements(const SemiJoinLayout &layout, const std::vector<uint64_t> &elements, uint32_t seed, std::vector<uint32_t> &blockRows)
+	{
+		uint32_t p = layout.numPartitions, numRows = elements.size(), blockBound = layout.childBlockBound, bound = layout.ChildBound();
+		blockRows.assign((size_t)p * bound, numRows);
+		for (uint32_t c = 0; c < p; c++)
+		{
+			uint32_t begin, end;
+			ChunkRange(numRows, layout.childChunkRows, c, begin, end);
+			std::vector<uint32_t> blockSizes(p, 0);
+			for (uint32_t i = begin; i < end; i++)
+			{
+				auto q = PartitionOf(elements[i], seed, p);
+				if (blockSizes[q] == blockBound)
+					return false;
+				blockRows[(size_t)q * bound + c * blockBound + blockSizes[q]++] = i;
+			}
+		}
+		return true;
+	}
+
+	std::vector<uint32_t> Relation::ArrangeAnnotByOwner(std::vector<uint32_t> &layout, uint32_t begin, uint32_t end)
+	{
+		bool isOwner = m_RI.owner == gParty.GetRole();
+		auto numSlots = layout.size();
+		if (m_AI.knownByOwner)
+		{
+			std::vector<uint32_t> arranged(numSlots, 0);
+			if (isOwner)
+				for (size_t s = 0; s < numSlots; s++)
+					if (layout[s] < end)
+						arranged[s] = m_Annot[layout[s]];
+			return arranged;
+		}
+		std::vector<uint32_t> annot(m_Annot.begin() + begin, m_Annot.begin() + end);
+		if (!isOwner)
+			return SenderExtendedPermute(annot, numSlots);
+		std::vector<uint32_t> indices(numSlots);
+		for (size_t s = 0; s < numSlots; s++)
+			indices[s] = layout[s] < end ? layout[s] - begin : 0; // padding
+		return PermutorExtendedPermute(indices, annot);
+	}
+
+	void Relation::PartitionedSemiJoin(Relation &child, uint32_t numPartitions, PSI::Backend psiBackend)
+	{
+		// The PSI elements are partitioned by a public hash rather than the rows: Alice has one element per distinct tuple, so the
+		// partitions are bounded whatever the multiplicities of the tuples. So that no OEP is larger than a partition, the rows
+		// of each relation are also split into chunks, and the elements of a chunk in a partition (a block) are bounded as well:
+		// the child annotations are routed chunk by chunk into the blocks of the partitions, the PSI results partition by
+		// partition into the blocks of the chunks of the parent, and these chunk by chunk to the rows. The bounds are public,
+		// so the sizes of the partitions and blocks leak nothing. If one is exceeded, which happens with probability 2^-40,
+		// both parties start over with a new seed
+		bool isAlice = m_RI.owner == gParty.GetRole();
+		uint32_t parentRows = m_RI.numRows, childRows = child.m_RI.numRows, p = numPartitions;
+		SemiJoinLayout layout(parentRows, childRows, p);
+		std::vector<uint32_t> elementOfRow;
+		auto elements = isAlice ? AliceElements(elementOfRow) : child.BobElements();
+		std::vector<std::vector<uint32_t>> partitionElements;
+		std::vector<uint32_t> positionInPartition, blockElements, slotOfRow, blockRows;
+		uint32_t seed = partitionSeed;
+		while (true)
+		{
+			bool fits = isAlice ? ArrangeParentElements(layout, elements, elementOfRow, seed, partitionElements, positionInPartition, blockElements, slotOfRow)
+								: ArrangeChildElements(layout, elements, seed, blockRows);
+			if (ExchangeMax(!fits) == 0)
+				break;
+			if (gParty.GetRole() == SERVER)
+			{
+				seed = gRNG.NextUInt32();
+				gParty.Send(&seed, 1);
+			}
+			else
+				gParty.Recv(&seed, 1);
+		}
+
+		// Only the owner of the child reads the layout
+		uint32_t childBound = layout.ChildBound(), childBlockBound = layout.childBlockBound;
+		std::vector<uint32_t> childAnnot((size_t)p * childBound, 0);
+		for (uint32_t c = 0; c < p; c++)
+		{
+			uint32_t begin, end;
+			ChunkRange(childRows, layout.childChunkRows, c, begin, end);
+			if (begin == end)
+				continue;
+			std::vector<uint32_t> chunkLayout((size_t)p * childBlockBound, childRows);
+			if (!isAlice)
+				for (uint32_t q = 0; q < p; q++)
+					std::copy_n(blockRows.begin() + (size_t)q * childBound + c * childBlockBound, childBlockBound, chunkLayout.begin() + (size_t)q * childBlockBound);
+			auto arranged = child.ArrangeAnnotByOwner(chunkLayout, begin, end);
+			for (uint32_t q = 0; q < p; q++)
+				std::copy_n(arranged.begin() + (size_t)q * childBlockBound, childBlockBound, childAnnot.begin() + (size_t)q * childBound + c * childBlockBound);
+		}
+
+		bool sharedAnnot = !child.m_AI.knownByOwner;
+		uint32_t blockBound = layout.parentBlockBound, numSlots = layout.ParentSlots();
+		std::vector<uint32_t> indicatorBlocks((size_t)p * numSlots), payloadBlocks((size_t)p * numSlots);
+		for (uint32_t q = 0; q < p; q++)
+		{
+			uint32_t bound = isAlice ? layout.parentBound : childBound;
+			std::vector<uint64_t> partElements(bound);
+			for (uint32_t k = 0; k < bound; k++)
+			{
+				uint32_t e = isAlice ? (k < partitionElements[q].size() ? partitionElements[q][k] : elements.size()) : blockRows[(size_t)q * childBound + k];
+				partElements[k] = e < elements.size() ? elements[e] : HashTuple(-1 - (int)((size_t)q * bound + k));
+			}
+			std::vector<uint32_t> partAnnot(childAnnot.begin() + (size_t)q * childBound, childAnnot.begin() + (size_t)(q + 1) * childBound);
+			PSI psi(partElements, layout.parentBound, childBound, isAlice ? PSI::Alice : PSI::Bob, PSI::NumPayloadOutputs(1, sharedAnnot), psiBackend);
+			std::vector<std::vector<uint32_t>> results;
+			auto indicator = psi.IntersectWithPayloads({isAlice && !sharedAnnot ? nullptr : &partAnnot}, sharedAnnot, results);
+			auto payload = std::move(results[0]);
+			// The results of the partition go to its block in every chunk of the parent
+			if (isAlice)
+			{
+				auto cuckooIndices = psi.CuckooToAliceArray();
+				std::vector<uint32_t> indices((size_t)p * blockBound);
+				for (uint32_t c = 0; c < p; c++)
+					for (uint32_t k = 0; k < blockBound; k++)
+					{
+						auto e = blockElements[(size_t)c * numSlots + q * blockBound + k];
+						indices[(size_t)c * blockBound + k] = e < elements.size() ? cuckooIndices[positionInPartition[e]] : 0;
+					}
+				payload = PermutorExtendedPermute(indices, payload);
+				indicator = PermutorExtendedPermute(indices, indicator);
+			}
+			else
+			{
+				payload = SenderExtendedPermute(payload, (size_t)p * blockBound);
+				indicator = SenderExtendedPermute(indicator, (size_t)p * blockBound);
+			}
+			for (uint32_t c = 0; c < p; c++)
+			{
+				std::copy_n(payload.begin() + (size_t)c * blockBound, blockBound, payloadBlocks.begin() + (size_t)c * numSlots + q * blockBound);
+				std::copy_n(indicator.begin() + (size_t)c * blockBound, blockBound, indicatorBlocks.begin() + (size_t)c * numSlots + q * blockBound);
+			}
+		}
+
+		std::vector<uint32_t> indicator(parentRows, 0), payload(parentRows, 0);
+		for (uint32_t c = 0; c < p; c++)
+		{
+			uint32_t begin, end;
+			ChunkRange(parentRows, layout.parentChunkRows, c, begin, end);
+			if (begin == end)
+				continue;
+			std::vector<uint32_t> chunkPayload(payloadBlocks.begin() + (size_t)c * numSlots, payloadBlocks.begin() + (size_t)(c + 1) * numSlots);
+			std::vector<uint32_t> chunkIndicator(indicatorBlocks.begin() + (size_t)c * numSlots, indicatorBlocks.begin() + (size_t)(c + 1) * numSlots);
+			if (isAlice)
+			{
+				std::vector<uint32_t> indices(slotOfRow.begin() + begin, slotOfRow.begin() + end);
+				chunkPayload = PermutorExtendedPermute(indices, chunkPayload);
+				chunkIndicator = PermutorExtendedPermute(indices, chunkIndicator);
+			}
+			else
+			{
+				chunkPayload = SenderExtendedPermute(chunkPayload, end - begin);
+				chunkIndicator = SenderExtendedPermute(chunkIndicator, end - begin);
+			}
+			std::copy(chunkPayload.begin(), chunkPayload.end(), payload.begin() + begin);
+			std::copy(chunkIndicator.begin(), chunkIndicator.end(), indicator.begin() + begin);
+		}
+		AnnotMul(indicator.data(), payload.data(), child.m_AI.isBoolean);
+	}
+
+	void Relation::OblivSemiJoin(Relation &child, std::vector<std::string> &parentAttrNames, std::vector<std::string> &childAttrNames, PSI::Backend psiBackend)
+	{
+		// The copies share the tuples with the inputs, and the annotations are moved into them instead of copied
+		std::vector<uint32_t> parentAnnot, childAnnot;
+		parentAnnot.swap(m_Annot);
+		childAnnot.swap(child.m_Annot);
 		Relation parentRelation = *this;
 		Relation childRelation = child;
+		parentRelation.m_Annot.swap(parentAnnot);
+		childRelation.m_Annot.swap(childAnnot);
 		parentRelation.Project(parentAttrNames);
 		childRelation.Project(childAttrNames);
-		if (gParty.GetRole() == m_RI.owner)
-			parentRelation.AliceSemiJoin(childRelation);
+		bool isSmall = (uint64_t)m_RI.numRows * child.m_RI.numRows <= smallSemiJoinPairs || std::max(m_RI.numRows, child.m_RI.numRows) < PSI::minSetSize;
+		auto numPartitions = isSmall ? 1 : NumSemiJoinPartitions(m_RI.numRows, child.m_RI.numRows, PSI::NumPayloadOutputs(1, !child.m_AI.knownByOwner));
+		if (isSmall)
+			parentRelation.SmallSemiJoin(childRelation);
+		else if (numPartitions > 1)
+			parentRelation.PartitionedSemiJoin(childRelation, numPartitions, psiBackend);
+		else if (gParty.GetRole() == m_RI.owner)
+			parentRelation.AliceSemiJoin(childRelation, psiBackend);
 		else
-			parentRelation.BobSemiJoin(childRelation);
+			parentRelation.BobSemiJoin(childRelation, psiBackend);
 		m_AI = parentRelation.m_AI;
-		m_Annot = parentRelation.m_Annot;
+		m_Annot.swap(parentRelation.m_Annot);
+		child.m_Annot.swap(childRelation.m_Annot);
 	}
 
 	void Relation::RemoveZeroAnnotatedTuples()
 	{
+		m_Tuples.Compact();
 		uint32_t *out, bitlen, nvals;
 		auto numRows = m_RI.numRows;
 		if (m_RI.isPublic)
@@ -685,54 +1340,47 @@ namespace SECYAN
 				nonZeroIndices.push_back(i);
 		SubSequence(m_Annot, nonZeroIndices);
 		if (!IsDummy())
-			SubSequence(m_Tuples, nonZeroIndices);
-		m_RI.numRows = nonZeroIndices.size();
-		delete[] out;
-	}
-
-	// Every tuple must not be dummy!!!
-	std::vector<uint64_t> Relation::PackTuples()
-	{
-		assert(!IsDummy() && "Trying to pack tuples in dummy relation!");
-		auto numColumns = m_RI.attrNames.size();
-		auto numRows = m_RI.numRows;
-		std::vector<uint64_t> packedTuples(numColumns * numRows);
-		for (uint32_t i = 0; i < numRows; i++)
-			for (uint32_t j = 0; j < numColumns; j++)
-				packedTuples[i * numColumns + j] = m_Tuples[i][j];
-		return packedTuples;
-	}
-
-	std::vector<Tuple> UnpackTuples(std::vector<uint64_t> &packedTuples, uint32_t numRows)
-	{
-		auto numColumns = packedTuples.size() / numRows;
-		std::vector<Tuple> tuples(numRows);
-		for (uint32_t i = 0; i < numRows; i++)
 		{
-			tuples[i].resize(numColumns);
-			for (uint32_t j = 0; j < numColumns; j++)
-				tuples[i][j] = packedTuples[i * numColumns + j];
+			m_Tuples.Gather(nonZeroIndices);
+			m_Index = std::make_shared<TupleIndex>();
 		}
-		return tuples;
+		m_RI.numRows = nonZeroIndices.size();
+		delete[] out;
 	}
 
 	void Relation::RevealTuples()
 	{
+		m_Tuples.Compact();
 		if (m_RI.isPublic || m_RI.numRows == 0)
 		{
 			m_RI.isPublic = true;
 			return;
 		}
+		// The codes of STRING attributes are followed by their dictionaries, which only keep the revealed strings
 		std::vector<uint64_t> packedTuples;
+		std::vector<char> dictionary;
 		if (IsDummy())
 		{
 			gParty.Recv(packedTuples);
-			m_Tuples = UnpackTuples(packedTuples, m_RI.numRows);
+			m_Tuples = ColumnStore::Unpack(packedTuples, m_RI.numRows);
+			for (uint32_t j = 0; j < m_RI.attrNames.size(); j++)
+				if (m_RI.attrTypes[j] == STRING)
+				{
+					gParty.Recv(dictionary);
+					m_Tuples.SetDictionary(j, std::make_shared<const Dictionary>(dictionary.data(), dictionary.size()));
+				}
 		}
 		else
 		{
-			packedTuples = PackTuples();
+			m_Tuples.ShrinkDictionaries();
+			packedTuples = m_Tuples.Pack(); // every tuple must not be dummy
 			gParty.Send(packedTuples);
+			for (uint32_t j = 0; j < m_RI.attrNames.size(); j++)
+				if (m_RI.attrTypes[j] == STRING)
+				{
+					dictionary = m_Tuples.GetDictionary(j)->Serialize();
+					gParty.Send(dictionary);
+				}
 		}
 		m_RI.isPublic = true;
 	}
@@ -749,45 +1397,53 @@ namespace SECYAN
 	// Every tuple must not be zero annotated in join !!!
 	void Relation::Join(Relation &child, std::vector<std::string> &parentAttrNames, std::vector<std::string> &childAttrNames)
 	{
+		m_Tuples.Compact();
+		child.m_Tuples.Compact();
 		assert(parentAttrNames.size() == childAttrNames.size());
 		assert(m_RI.isPublic && child.m_RI.isPublic); // Only support public join yet
-		auto parentCopy = *this;
-		parentCopy.Project(parentAttrNames);
-		auto childCopy = child;
-		childCopy.Project(childAttrNames);
+		auto parentCopy = ProjectedTuples(parentAttrNames);
+		auto childCopy = child.ProjectedTuples(childAttrNames);
 		//auto aliceRowNum = parentCopy.m_RI.numRows;
 		//auto bobRowNum = childCopy.m_RI.numRows;
-		std::unordered_map<uint64_t, std::pair<std::vector<int>, std::vector<int>>> rowIndexMap;
+		// The non-dummy tuples are matched through the hash indexes of the join attributes
+		auto parentIndex = parentCopy.GetHashIndex();
+		auto childIndex = childCopy.GetHashIndex();
+		std::unordered_map<uint64_t, uint32_t> parentGroupOfKey;
+		for (uint32_t g = 0; g < parentIndex->keys.size(); g++)
+			parentGroupOfKey[parentIndex->keys[g]] = g;
+		std::vector<std::vector<uint32_t>> parentRowsOfGroup(parentIndex->keys.size());
 		for (uint32_t i = 0; i < parentCopy.m_RI.numRows; i++)
-			rowIndexMap[parentCopy.HashTuple(i)].first.push_back(i);
-		for (uint32_t i = 0; i < childCopy.m_RI.numRows; i++)
-			rowIndexMap[childCopy.HashTuple(i)].second.push_back(i);
+			if (!parentCopy.m_Tuples.IsDummy(i))
+				parentRowsOfGroup[parentIndex->groups[i]].push_back(i);
 		std::unordered_set<std::string> childJoinAttrNames(childAttrNames.begin(), childAttrNames.end());
 		std::vector<std::string> newChildAttrNames;
 		for (auto attr : child.m_RI.attrNames)
 			if (childJoinAttrNames.find(attr) == childJoinAttrNames.end())
 				newChildAttrNames.push_back(attr);
-		childCopy = child;
-		childCopy.Project(newChildAttrNames);
-		std::vector<Tuple> newTableTuples;
+		childCopy = child.ProjectedTuples(newChildAttrNames);
+		std::vector<uint32_t> parentIndices, childIndices;
 		std::vector<uint32_t> newAnnot1, newAnnot2;
-		auto newTableNumColumns = m_RI.attrNames.size() + childCopy.m_RI.attrNames.size();
-		for (auto mapPair : rowIndexMap)
+		for (uint32_t j = 0; j < child.m_RI.numRows; j++)
 		{
-			for (auto i : mapPair.second.first)
+			if (child.m_Tuples.IsDummy(j))
+				continue;
+			auto it = parentGroupOfKey.find(childIndex->keys[childIndex->groups[j]]);
+			if (it == parentGroupOfKey.end())
+				continue;
+			for (auto i : parentRowsOfGroup[it->second])
 			{
-				for (auto j : mapPair.second.second)
-				{
-					newTableTuples.push_back(m_Tuples[i] + childCopy.m_Tuples[j]);
-					newAnnot1.push_back(m_Annot[i]);
-					newAnnot2.push_back(child.m_Annot[j]);
-				}
+				parentIndices.push_back(i);
+				childIndices.push_back(j);
+				newAnnot1.push_back(m_Annot[i]);
+				newAnnot2.push_back(child.m_Annot[j]);
 			}
 		}
-		m_Tuples = newTableTuples;
-		m_RI.numRows = m_Tuples.size();
+		m_Tuples = ColumnStore::Concat(m_Tuples, parentIndices, childCopy.m_Tuples, childIndices);
+		m_RI.numRows = m_Tuples.NumRows();
 		m_RI.attrNames.insert(m_RI.attrNames.end(), childCopy.m_RI.attrNames.begin(), childCopy.m_RI.attrNames.end());
 		m_RI.attrTypes.insert(m_RI.attrTypes.end(), childCopy.m_RI.attrTypes.begin(), childCopy.m_RI.attrTypes.end());
+		m_RI.sortedBy.clear();
+		m_Index = std::make_shared<TupleIndex>();
 		// Because tuples are not zero annotated, when an annotation is boolean, it must be 1.
 		if (m_AI.isBoolean)
 			m_Annot = newAnnot2;
@@ -808,38 +1464,62 @@ namespace SECYAN
 			m_Annot.assign(out, out + nvals);
 			delete[] out;
 		}
+		EnforceMemoryBudget();
 	}
 
 	void Relation::AnnotAdd(Relation &child)
 	{
+		m_Tuples.Compact();
+		child.m_Tuples.Compact();
 		assert(m_RI.numRows == child.m_RI.numRows && !m_AI.isBoolean && !child.m_AI.isBoolean);
 		for (uint32_t i = 0; i < m_RI.numRows; i++)
 		{
 			m_Annot[i] += child.m_Annot[i];
 			if (!IsDummy())
-				assert(m_Tuples[i].IsDummy() == child.m_Tuples[i].IsDummy());
+				assert(m_Tuples.IsDummy(i) == child.m_Tuples.IsDummy(i));
 		}
 	}
 
 	void Relation::AnnotSub(Relation &child)
 	{
+		m_Tuples.Compact();
+		child.m_Tuples.Compact();
 		assert(m_RI.numRows == child.m_RI.numRows && !m_AI.isBoolean && !child.m_AI.isBoolean);
 		for (uint32_t i = 0; i < m_RI.numRows; i++)
 		{
 			m_Annot[i] -= child.m_Annot[i];
 			if (!IsDummy())
-				assert(m_Tuples[i].IsDummy() == child.m_Tuples[i].IsDummy());
+				assert(m_Tuples.IsDummy(i) == child.m_Tuples.IsDummy(i));
 		}
 	}
 
 	void Relation::Union(Relation &child)
 	{
 		assert(m_RI.owner == child.m_RI.owner && m_RI.attrNames == child.m_RI.attrNames && m_RI.attrTypes == child.m_RI.attrTypes);
-		m_Tuples.insert(m_Tuples.end(), child.m_Tuples.begin(), child.m_Tuples.end());
+		m_Tuples.Append(child.m_Tuples); // O(#columns), the rows are copied by the next operation that visits them
 		m_Annot.insert(m_Annot.end(), child.m_Annot.begin(), child.m_Annot.end());
 		m_RI.numRows += child.m_RI.numRows;
+		m_RI.sortedBy.clear();
+		m_Index = std::make_shared<TupleIndex>();
 		m_AI.knownByOwner &= child.m_AI.knownByOwner;
 		m_AI.isBoolean &= child.m_AI.isBoolean;
+		EnforceMemoryBudget();
+	}
+
+	// The one-string dictionary of a STRING value added by AddAttr, shared by all columns with that value, so that their
+	// relations are unioned without merging dictionaries (see ColumnStore::Append)
+	std::shared_ptr<const Dictionary> ConstantDictionary(uint64_t value)
+	{
+		static std::unordered_map<uint64_t, std::shared_ptr<const Dictionary>> dictionaries;
+		auto &dictionary = dictionaries[value];
+		if (!dictionary)
+		{
+			// The value is a string of at most 8 characters packed into a little-endian uint64_t
+			char str[sizeof(uint64_t) + 1] = {};
+			std::memcpy(str, &value, sizeof(uint64_t));
+			dictionary = std::make_shared<const Dictionary>(std::vector<std::string>{str});
+		}
+		return dictionary;
 	}
 
 	void Relation::AddAttr(const char *attrName, DataType attrType, uint64_t value)
@@ -847,9 +1527,13 @@ namespace SECYAN
 		//std::string sattrName(attrName);
 		m_RI.attrNames.push_back(attrName);
 		m_RI.attrTypes.push_back(attrType);
-		if (!IsDummy())
-			for (uint32_t i = 0; i < m_RI.numRows; i++)
-				m_Tuples[i].push_back(value);
+		m_Index = std::make_shared<TupleIndex>(); // the name may have been projected out before
+		if (IsDummy())
+			return;
+		if (attrType == STRING)
+			m_Tuples.AddColumn(0, ConstantDictionary(value));
+		else
+			m_Tuples.AddColumn(value);
 	}
 
 } // namespace SECYAN
\ No newline at end of file
@@ -3,6 +3,9 @@
 #include <string>
 #include <unordered_map>
 #include "party.h"
+#include "columnstore.h"
+#include "tupleindex.h"
+#include "PSI.h"
 #include "aby/abyparty.h"
 #include "circuit/booleancircuits.h"
 #include <cassert>
@@ -10,67 +13,12 @@
 namespace SECYAN
 {
 
-	class Tuple
-	{
-	public:
-		bool IsDummy() { return isDummy; }
-		void ToDummy() { isDummy = true; }
-		const uint64_t *data() { return eles.data(); }
-		void resize(size_t size) { eles.resize(size); }
-		void push_back(uint64_t value) { eles.push_back(value); }
-
-		uint64_t &operator[](int i)
-		{
-			assert(!isDummy && "Error: Visiting dummy tuple!");
-			return eles[i];
-		}
-
-		bool operator<(const Tuple &t) const // dictionary comparison
-		{
-			if (isDummy) // ensure that a<b and b<a cannot be both true
-				return false;
-			if (t.isDummy)
-				return true;
-			auto size = eles.size();
-			assert(size == t.eles.size() && size > 0 && "Tuples not comparable!");
-			uint32_t i = 0;
-			while (i < size && eles[i] == t.eles[i])
-				i++;
-			return i < size && eles[i] < t.eles[i];
-		}
-
-		bool operator==(const Tuple &t) const // dictionary comparison
-		{
-			if (isDummy || t.isDummy)
-				return isDummy && t.isDummy;
-			auto size = eles.size();
-			assert(size == t.eles.size() && "Tuples not comparable!");
-			for (uint32_t i = 0; i < size; i++)
-				if (eles[i] != t.eles[i])
-					return false;
-			return true;
-		}
-
-		Tuple operator+(const Tuple &t) const // concatenate
-		{
-			assert(!isDummy && !t.isDummy && "Trying to concatenate dummy tuples!");
-			Tuple ret;
-			ret.eles = this->eles;
-			ret.eles.insert(ret.eles.end(), t.eles.begin(), t.eles.end());
-			return ret;
-		}
-
-	private:
-		bool isDummy = false;
-		std::vector<uint64_t> eles;
-	};
-
 	// Data File Structure:
 	// The first line: an integer indicating number of columns in the file
 	// The second line: attribute names (and annotation names, e.g. q3_annotation, q8_annotation1)
-	// The third line: attribute types (options: int, decimal, date, string, char)
-	// The attribute types for annotations can be arbitrary, which do not work
-	// Other lines: data
+	// Other lines: data, every value followed by '|'
+	// The attribute types are given by RelationInfo (options: int, decimal, date, string)
+	// A data file can be converted to a binary snapshot (see snapshot.h) by the tblconvert tool
 
 	class Relation
 	{
@@ -89,8 +37,10 @@ namespace SECYAN
 			bool isPublic; // Indicating whether the other role (not the owner) also knows the tuples of the relation
 			std::vector<std::string> attrNames;
 			std::vector<DataType> attrTypes;
-			size_t numRows;
-			bool sorted;
+			size_t numRows; // 0: the number of rows is counted from the data file by LoadData
+			// The non-dummy rows are in dictionary order of these attributes (dummy rows may be anywhere),
+			// maintained by LoadData (from snapshots), Sort, Project, Aggregate and AnnotOrAgg
+			std::vector<std::string> sortedBy;
 		};
 
 		struct AnnotInfo
@@ -100,16 +50,22 @@ namespace SECYAN
 		};
 
 		// Annotation name must NOT be included in attrNames
-		Relation(RelationInfo ri, AnnotInfo ai) : m_RI(ri), m_AI(ai)
+		Relation(RelationInfo ri, AnnotInfo ai) : m_RI(ri), m_AI(ai), m_Index(std::make_shared<TupleIndex>())
 		{
 			assert(ri.attrNames.size() == ri.attrTypes.size());
 			m_Annot.resize(ri.numRows, 0);
 		}
 		inline bool IsDummy() { return (!m_RI.isPublic) && (m_RI.owner != gParty.GetRole()); }
-		// Load data into the relation (for dummy relation, the first two parameters are NULL)
+		// Load data into the relation from a data file or its binary snapshot (see snapshot.h), the format is detected automatically
+		// (for dummy relation, the parameters are ignored and only the number of rows and sortedBy are received from the owner)
 		void LoadData(const char *filePath, std::string anntAttrName);
+		// Load the tuples once with several annotation columns, the k-th returned relation has annotations annotAttrNames[k]
+		// The returned relations share the tuple storage (this relation only provides RelationInfo and AnnotInfo)
+		std::vector<Relation> LoadData(const char *filePath, const std::vector<std::string> &annotAttrNames);
 		void RevealAnnotToOwner();												// reveal annotations to the owner
 		void Print(size_t limit_size = 100, bool showZeroAnnotedTuple = false); // only be called after revealed
+		// Sort the rows in dictionary order of attrNames (dummy rows last)
+		// Skipped if attrNames is a prefix of sortedBy, the sort permutation is cached (see tupleindex.h)
 		void Sort();
 		// Note: this project operation does not elimiate duplicate tuples!
 		void Project(std::vector<std::string> &projectAttrNames);
@@ -121,7 +77,9 @@ namespace SECYAN
 		void AnnotAdd(Relation &child);
 		void AnnotSub(Relation &child);
 		void AnnotDiv(Relation &child); // not implemented yet!
+		// The tuples of child are linked rather than copied (see ColumnStore::Append)
 		void Union(Relation &child);
+		// A STRING value is a string of at most 8 characters packed into a little-endian uint64_t
 		void AddAttr(const char *attrName, DataType attrType, uint64_t value);
 		void AnnotMul(uint32_t *indicator, uint32_t *childAnnotPermuted, bool isChildAnnotBool);
 
@@ -129,10 +87,14 @@ namespace SECYAN
 		// It sets annotation of a tuple as 1 if at least one of its duplicates has non-zero annotation
 		void AnnotOrAgg();
 
-		void SemiJoin(Relation &child, std::vector<std::string> &parentAttrNames, std::vector<std::string> &childAttrNames);
+		// psiBackend: how the PSI of the semi-join encodes the OPRF values of the child (see psibackend.h), both parties must choose the same
+		void SemiJoin(Relation &child, std::vector<std::string> &parentAttrNames, std::vector<std::string> &childAttrNames, PSI::Backend psiBackend = PSI::Polynomial);
 		// Note: the order of attrNames corresponds to join attributes of the two relations
 
-		void SemiJoin(Relation &child, const char *parentAttrName, const char *childAttrName);
+		void SemiJoin(Relation &child, const char *parentAttrName, const char *childAttrName, PSI::Backend psiBackend = PSI::Polynomial);
+		// Semi-joins of at most this many pairs of rows compare all pairs in one circuit instead of using the PSI (see SmallSemiJoin),
+		// 0: always use the PSI unless it cannot run. Both parties must set the same
+		static uint64_t smallSemiJoinPairs;
 
 		void RemoveZeroAnnotatedTuples();
 		void RevealTuples();
@@ -141,21 +103,49 @@ namespace SECYAN
 
 		// For debug test only
 		void PrintTableWithoutRevealing(const char *msg = NULL, int limit_size = 100);
+		// The annotations (shares unless revealed to the owner)
+		const std::vector<uint32_t> &GetAnnot() const { return m_Annot; }
 
 	private:
 		RelationInfo m_RI;
 		AnnotInfo m_AI;
-		std::vector<Tuple> m_Tuples;
+		ColumnStore m_Tuples;
 		std::vector<uint32_t> m_Annot; // the annotations of this relation
+		std::shared_ptr<TupleIndex> m_Index; // indexes of the tuples, shared by copies until the rows are changed
 
+		void LoadTuples(const char *filePath, const std::vector<std::string> &annotAttrNames, std::vector<std::vector<uint32_t>> &annots);
+		void LoadTbl(const char *filePath, const std::vector<std::string> &annotAttrNames, std::vector<std::vector<uint32_t>> &annots);
+		void LoadSnapshot(const char *filePath, const std::vector<std::string> &annotAttrNames, std::vector<std::vector<uint32_t>> &annots);
+		// A projection sharing the tuples of this relation, without annotations (only for HashTuple)
+		Relation ProjectedTuples(std::vector<std::string> &attrNames);
 		uint64_t HashTuple(int i);
+		// The hash of the attributes of row i, regardless of whether it is dummy
+		uint64_t KeyHash(uint32_t i);
+		std::shared_ptr<const HashIndex> GetHashIndex();
+		// Sort unless equal tuples are already adjacent (ignoring dummy tuples), i.e. attrNames is a permutation of a prefix of sortedBy
+		void Group();
+		// Called by the owner after Group: bits[i] = 1 iff row i is aggregated into row i + 1,
+		// dummy rows pass the aggregation on to the next non-dummy row
+		std::vector<uint32_t> GroupBits();
 		void PermuteAnnotByOwner(std::vector<uint32_t> &permutedIndices);
-		void AliceSemiJoin(Relation &BobRelation);
-		void BobSemiJoin(Relation &BobRelation);
-		void OblivSemiJoin(Relation &child, std::vector<std::string> &parentAttrNames, std::vector<std::string> &childAttrNames);
+		// The PSI elements of Alice: one per distinct tuple and per dummy tuple, row i has element elementOfRow[i]
+		std::vector<uint64_t> AliceElements(std::vector<uint32_t> &elementOfRow);
+		// The PSI elements of Bob: one per row (the child of a semi-join has distinct tuples)
+		std::vector<uint64_t> BobElements();
+		void AliceSemiJoin(Relation &BobRelation, PSI::Backend psiBackend);
+		void BobSemiJoin(Relation &BobRelation, PSI::Backend psiBackend);
+		// Semi-join of small relations (called by both parties): compare all pairs of rows in one circuit, without PSI and OEP
+		void SmallSemiJoin(Relation &child);
+		void OblivSemiJoin(Relation &child, std::vector<std::string> &parentAttrNames, std::vector<std::string> &childAttrNames, PSI::Backend psiBackend);
+		// Semi-join partition by partition (when a semi-join does not fit in the memory budget, see spill.h)
+		void PartitionedSemiJoin(Relation &child, uint32_t numPartitions, PSI::Backend psiBackend);
+		// The annotations of the rows [begin, end) in the order of layout (rows in [begin, end), or numRows for padding;
+		// only the owner reads it)
+		std::vector<uint32_t> ArrangeAnnotByOwner(std::vector<uint32_t> &layout, uint32_t begin, uint32_t end);
+		// Spill the tuples to disk if they do not fit in the memory budget
+		void EnforceMemoryBudget();
 		void OblivAnnotOrAgg();
 		void OwnerAnnotAddAgg();
-		std::vector<uint64_t> PackTuples();
 	};
 
 } // namespace SECYAN
\ No newline at end of file
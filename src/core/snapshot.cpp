@@ -0,0 +1,199 @@
+#include "snapshot.h"
+#include <iostream>
+#include <fstream>
+#include <cstring>
+
+namespace SECYAN
+{
+	const char snapshotMagic[8] = {'S', 'E', 'C', 'Y', 'A', 'N', 'S', 'N'};
+	const size_t columnAlignment = 64;
+
+	struct SnapshotHeader
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t numColumns;
+		uint64_t numRows;
+		uint32_t numSortColumns;
+		uint32_t reserved;
+	};
+
+	struct SnapshotColumnEntry
+	{
+		char name[Snapshot::maxNameLength + 1];
+		uint32_t type;
+		uint32_t reserved;
+		uint64_t offset;
+	};
+
+	static_assert(sizeof(SnapshotHeader) == 32 && sizeof(SnapshotColumnEntry) == 64, "Unexpected snapshot layout!");
+
+	inline size_t ValueSize(TblFile::FieldType type)
+	{
+		return type == TblFile::ANNOT ? sizeof(uint32_t) : sizeof(uint64_t);
+	}
+
+	inline uint64_t AlignUp(uint64_t pos)
+	{
+		return (pos + columnAlignment - 1) / columnAlignment * columnAlignment;
+	}
+
+	bool Snapshot::IsSnapshot(const char *filePath)
+	{
+		char magic[sizeof(snapshotMagic)];
+		std::ifstream in(filePath, std::ios::binary);
+		if (!in.read(magic, sizeof(magic)))
+			return false;
+		return std::memcmp(magic, snapshotMagic, sizeof(magic)) == 0;
+	}
+
+	void Snapshot::Write(const char *filePath, const std::vector<std::string> &names, const std::vector<TblFile::FieldType> &types,
+						 const std::vector<const void *> &data, const std::vector<const Dictionary *> &dictionaries,
+						 size_t numRows, const std::vector<uint32_t> &sortColumns)
+	{
+		auto numColumns = names.size();
+		assert(types.size() == numColumns && data.size() == numColumns && dictionaries.size() == numColumns);
+		SnapshotHeader header = {};
+		std::memcpy(header.magic, snapshotMagic, sizeof(snapshotMagic));
+		header.version = version;
+		header.numColumns = numColumns;
+		header.numRows = numRows;
+		header.numSortColumns = sortColumns.size();
+
+		std::vector<SnapshotColumnEntry> entries(numColumns);
+		std::vector<std::vector<char>> serialized(numColumns);
+		uint64_t pos = AlignUp(sizeof(header) + numColumns * sizeof(SnapshotColumnEntry) + sortColumns.size() * sizeof(uint32_t));
+		for (size_t j = 0; j < numColumns; j++)
+		{
+			if (names[j].size() > maxNameLength)
+			{
+				std::cerr << "Snapshot error: column name " << names[j] << " is too long!" << std::endl;
+				std::exit(1);
+			}
+			std::memset(&entries[j], 0, sizeof(SnapshotColumnEntry));
+			std::memcpy(entries[j].name, names[j].data(), names[j].size());
+			entries[j].type = types[j];
+			entries[j].offset = pos;
+			pos = AlignUp(pos + numRows * ValueSize(types[j]));
+			assert((types[j] == TblFile::STRING) == (dictionaries[j] != nullptr));
+			if (dictionaries[j])
+			{
+				serialized[j] = dictionaries[j]->Serialize();
+				pos = AlignUp(pos + serialized[j].size());
+			}
+		}
+		for (auto col : sortColumns)
+			assert(col < numColumns && types[col] != TblFile::ANNOT);
+
+		std::ofstream out(filePath, std::ios::binary | std::ios::trunc);
+		out.write((const char *)&header, sizeof(header));
+		out.write((const char *)entries.data(), entries.size() * sizeof(SnapshotColumnEntry));
+		out.write((const char *)sortColumns.data(), sortColumns.size() * sizeof(uint32_t));
+		const char padding[columnAlignment] = {};
+		for (size_t j = 0; j < numColumns; j++)
+		{
+			out.write(padding, entries[j].offset - out.tellp());
+			out.write((const char *)data[j], numRows * ValueSize(types[j]));
+			if (!serialized[j].empty())
+			{
+				uint64_t end = out.tellp();
+				out.write(padding, AlignUp(end) - end);
+				out.write(serialized[j].data(), serialized[j].size());
+			}
+		}
+		out.write(padding, pos - out.tellp());
+		if (!out)
+		{
+			std::cerr << "Snapshot error: cannot write " << filePath << "!" << std::endl;
+			std::exit(1);
+		}
+	}
+
+	Snapshot::Snapshot(const char *filePath) : file(std::make_shared<MappedFile>(filePath))
+	{
+		auto data = file->data();
+		auto fileSize = file->size();
+		SnapshotHeader header;
+		if (fileSize < sizeof(header))
+			Fail("truncated header");
+		std::memcpy(&header, data, sizeof(header));
+		if (std::memcmp(header.magic, snapshotMagic, sizeof(snapshotMagic)) != 0)
+			Fail("not a snapshot");
+		if (header.version != version)
+			Fail("unsupported version");
+		size_t tableEnd = sizeof(header) + (size_t)header.numColumns * sizeof(SnapshotColumnEntry) + header.numSortColumns * sizeof(uint32_t);
+		if (fileSize < tableEnd)
+			Fail("truncated column table");
+
+		numRows = header.numRows;
+		auto entries = (const SnapshotColumnEntry *)(data + sizeof(header));
+		for (uint32_t j = 0; j < header.numColumns; j++)
+		{
+			auto &entry = entries[j];
+			if (entry.type > TblFile::ANNOT)
+				Fail("unknown column type");
+			auto type = (TblFile::FieldType)entry.type;
+			if (entry.offset % columnAlignment != 0 || entry.offset > fileSize || (fileSize - entry.offset) / ValueSize(type) < numRows)
+				Fail("truncated column data");
+			columnNames.emplace_back(entry.name, strnlen(entry.name, sizeof(entry.name)));
+			columnTypes.push_back(type);
+			columnOffsets.push_back(entry.offset);
+		}
+		dictionaries.resize(header.numColumns);
+		auto sortData = (const uint32_t *)(entries + header.numColumns);
+		sortColumns.assign(sortData, sortData + header.numSortColumns);
+		for (auto col : sortColumns)
+			if (col >= header.numColumns)
+				Fail("invalid sort column");
+	}
+
+	void Snapshot::Fail(const char *msg)
+	{
+		std::cerr << "Read snapshot error (" << msg << ") in " << file->path() << "!" << std::endl;
+		std::exit(1);
+	}
+
+	int Snapshot::FindColumn(const std::string &name)
+	{
+		for (size_t i = 0; i < columnNames.size(); i++)
+			if (columnNames[i] == name)
+				return i;
+		return -1;
+	}
+
+	SECYAN::Column Snapshot::GetColumn(int col, size_t numRows)
+	{
+		assert(columnTypes[col] != TblFile::ANNOT && numRows <= this->numRows);
+		return SECYAN::Column(file, (const uint64_t *)(file->data() + columnOffsets[col]), numRows);
+	}
+
+	const uint32_t *Snapshot::GetAnnot(int col)
+	{
+		assert(columnTypes[col] == TblFile::ANNOT);
+		return (const uint32_t *)(file->data() + columnOffsets[col]);
+	}
+
+	std::shared_ptr<const Dictionary> Snapshot::GetDictionary(int col)
+	{
+		assert(columnTypes[col] == TblFile::STRING);
+		if (!dictionaries[col])
+		{
+			auto offset = AlignUp(columnOffsets[col] + numRows * sizeof(uint64_t));
+			if (offset > file->size())
+				Fail("truncated dictionary");
+			dictionaries[col] = std::make_shared<const Dictionary>(file->data() + offset, file->size() - offset);
+		}
+		return dictionaries[col];
+	}
+
+	bool Snapshot::IsSortedBy(const std::vector<std::string> &names)
+	{
+		if (names.size() > sortColumns.size())
+			return false;
+		for (size_t i = 0; i < names.size(); i++)
+			if (names[i] != columnNames[sortColumns[i]])
+				return false;
+		return true;
+	}
+
+} // namespace SECYAN
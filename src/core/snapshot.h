@@ -0,0 +1,60 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+#include "mappedfile.h"
+#include "columnstore.h"
+#include "tblfile.h"
+#include "dictionary.h"
+
+namespace SECYAN
+{
+	// Binary columnar snapshot of a data file (created by the tblconvert tool), all numbers are little-endian:
+	// Header: magic "SECYANSN", uint32 version, uint32 numColumns, uint64 numRows, uint32 numSortColumns, uint32 reserved
+	// Column table: numColumns entries of {char name[48], uint32 type (TblFile::FieldType), uint32 reserved, uint64 offset}
+	// Sort columns: numSortColumns uint32 column indices, the rows are in dictionary order of these columns
+	// Column data: at the offsets (64-byte aligned), numRows uint64_t values (uint32_t values for ANNOT columns)
+	// STRING columns hold dictionary codes, the dictionary (see Dictionary::Serialize) follows at the next aligned offset
+	// A snapshot is mapped into memory and its columns are used in place without copying.
+	class Snapshot
+	{
+	public:
+		static const uint32_t version = 2;
+		static const size_t maxNameLength = 47;
+
+		// Check the magic number of a file
+		static bool IsSnapshot(const char *filePath);
+		// data[j] points to numRows values of column j (uint32_t for ANNOT columns, uint64_t for others)
+		// dictionaries[j] is the dictionary of a STRING column (nullptr for others)
+		static void Write(const char *filePath, const std::vector<std::string> &names, const std::vector<TblFile::FieldType> &types,
+						  const std::vector<const void *> &data, const std::vector<const Dictionary *> &dictionaries,
+						  size_t numRows, const std::vector<uint32_t> &sortColumns);
+
+		Snapshot(const char *filePath);
+
+		size_t NumRows() { return numRows; }
+		const std::vector<std::string> &ColumnNames() { return columnNames; }
+		// Return the index of a column, or -1 if there is no such column
+		int FindColumn(const std::string &name);
+		TblFile::FieldType ColumnType(int col) { return columnTypes[col]; }
+		// The first numRows values of an attribute column, the column keeps the mapping alive
+		SECYAN::Column GetColumn(int col, size_t numRows);
+		const uint32_t *GetAnnot(int col);
+		std::shared_ptr<const Dictionary> GetDictionary(int col);
+		const std::vector<uint32_t> &SortColumns() { return sortColumns; }
+		// Whether the rows are in dictionary order of the given columns
+		bool IsSortedBy(const std::vector<std::string> &names);
+
+	private:
+		std::shared_ptr<MappedFile> file;
+		size_t numRows = 0;
+		std::vector<std::string> columnNames;
+		std::vector<TblFile::FieldType> columnTypes;
+		std::vector<uint64_t> columnOffsets;
+		std::vector<uint32_t> sortColumns;
+		std::vector<std::shared_ptr<const Dictionary>> dictionaries; // read on first use
+		[[noreturn]] void Fail(const char *msg);
+	};
+} // namespace SECYAN
@@ -0,0 +1,94 @@
+#include "spill.h"
+#include "mappedfile.h"
+#include <iostream>
+#include <cstdlib>
+#include <cerrno>
+#include <unistd.h>
+
+namespace SECYAN
+{
+	MemoryBudget gMemoryBudget;
+
+	std::string MemoryBudget::GetSpillDir()
+	{
+		if (!spillDir.empty())
+			return spillDir;
+		auto tmpDir = std::getenv("TMPDIR");
+		return tmpDir && *tmpDir ? tmpDir : "/tmp";
+	}
+
+	ColumnWriter::ColumnWriter()
+	{
+		path = gMemoryBudget.GetSpillDir() + "/secyan-spill-XXXXXX";
+		fd = mkstemp(&path[0]);
+		if (fd < 0)
+		{
+			std::cerr << "Spill error: cannot create a temporary file in " << gMemoryBudget.GetSpillDir() << "!" << std::endl;
+			std::exit(1);
+		}
+		buffer.reserve(bufferSize);
+	}
+
+	ColumnWriter::~ColumnWriter()
+	{
+		if (fd >= 0)
+		{
+			close(fd);
+			unlink(path.c_str());
+		}
+	}
+
+	void ColumnWriter::WriteAll(const uint64_t *values, size_t size)
+	{
+		auto p = (const char *)values;
+		size_t remaining = size * sizeof(uint64_t);
+		while (remaining > 0)
+		{
+			auto written = write(fd, p, remaining);
+			if (written < 0 && errno == EINTR)
+				continue;
+			if (written <= 0)
+			{
+				std::cerr << "Spill error: cannot write " << path << "!" << std::endl;
+				std::exit(1);
+			}
+			p += written;
+			remaining -= written;
+		}
+		this->size += size;
+	}
+
+	void ColumnWriter::Flush()
+	{
+		WriteAll(buffer.data(), buffer.size());
+		buffer.clear();
+	}
+
+	void ColumnWriter::Append(const uint64_t *values, size_t size)
+	{
+		if (buffer.size() + size <= bufferSize)
+		{
+			buffer.insert(buffer.end(), values, values + size);
+			return;
+		}
+		Flush();
+		WriteAll(values, size);
+	}
+
+	Column ColumnWriter::Finish()
+	{
+		Flush();
+		close(fd);
+		fd = -1;
+		auto file = std::make_shared<MappedFile>(path.c_str());
+		unlink(path.c_str());
+		return Column(file, (const uint64_t *)file->data(), size);
+	}
+
+	Column SpillColumn(const Column &column)
+	{
+		ColumnWriter writer;
+		writer.Append(column.data(), column.size());
+		return writer.Finish();
+	}
+} // namespace SECYAN
@@ -0,0 +1,63 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include "columnstore.h"
+
+namespace SECYAN
+{
+	// The memory budget of query processing (per party)
+	// Relations exceeding the budget are spilled: their columns are written to temporary files and mapped back,
+	// so that they are paged in on demand, sorted by external merge sort, and semi-joined partition by partition
+	class MemoryBudget
+	{
+	public:
+		// In bytes, 0: unlimited (default). The parties may set different limits (or only one of them)
+		void SetLimit(size_t bytes) { limit = bytes; }
+		size_t GetLimit() { return limit; }
+		bool Fits(size_t bytes) { return limit == 0 || bytes <= limit; }
+		// Directory of temporary files, default: $TMPDIR or /tmp
+		void SetSpillDir(const std::string &dir) { spillDir = dir; }
+		std::string GetSpillDir();
+
+	private:
+		size_t limit = 0;
+		std::string spillDir;
+	};
+
+	extern MemoryBudget gMemoryBudget;
+
+	// Write uint64_t values to a temporary file and map them back as a read-only column
+	// The file is removed as soon as it is mapped, the space is freed when the last copy of the column is destroyed
+	class ColumnWriter
+	{
+	public:
+		ColumnWriter();
+		~ColumnWriter();
+		ColumnWriter(const ColumnWriter &) = delete;
+		ColumnWriter &operator=(const ColumnWriter &) = delete;
+
+		void Append(const uint64_t *values, size_t size);
+		void Append(uint64_t value)
+		{
+			buffer.push_back(value);
+			if (buffer.size() == bufferSize)
+				Flush();
+		}
+		size_t Size() { return size + buffer.size(); }
+		Column Finish();
+
+	private:
+		static const size_t bufferSize = 1 << 16;
+		std::string path;
+		int fd = -1;
+		size_t size = 0;
+		std::vector<uint64_t> buffer;
+		void Flush();
+		void WriteAll(const uint64_t *values, size_t size);
+	};
+
+	// A file-backed copy of a column
+	Column SpillColumn(const Column &column);
+} // namespace SECYAN
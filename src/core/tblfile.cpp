@@ -0,0 +1,420 @@
+#include "tblfile.h"
+#include "threadpool.h"
+#include <iostream>
+#include <algorithm>
+#include <iterator>
+#include <cassert>
+
+namespace SECYAN
+{
+	// Each chunk should be large enough to amortize the scheduling cost
+	const size_t minChunkBytes = 1 << 18;
+
+	inline bool IsSpace(char c)
+	{
+		return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f';
+	}
+
+	inline const char *SkipSpaces(const char *p, const char *end)
+	{
+		while (p < end && IsSpace(*p))
+			p++;
+		return p;
+	}
+
+	// The parsers below follow stoi/stof/sscanf/stoul: leading spaces are skipped and trailing characters are ignored
+	inline bool ParseInt(const char *p, const char *end, int64_t &value)
+	{
+		p = SkipSpaces(p, end);
+		bool negative = false;
+		if (p < end && (*p == '-' || *p == '+'))
+			negative = *p++ == '-';
+		if (p == end || *p < '0' || *p > '9')
+			return false;
+		int64_t v = 0;
+		while (p < end && *p >= '0' && *p <= '9')
+			v = v * 10 + (*p++ - '0');
+		value = negative ? -v : v;
+		return true;
+	}
+
+	// Exact fixed-point parsing: digits after the second fraction digit are truncated
+	inline bool ParseDecimal(const char *p, const char *end, int64_t &value)
+	{
+		p = SkipSpaces(p, end);
+		bool negative = false;
+		if (p < end && (*p == '-' || *p == '+'))
+			negative = *p++ == '-';
+		bool hasDigit = false;
+		int64_t v = 0;
+		while (p < end && *p >= '0' && *p <= '9')
+		{
+			v = v * 10 + (*p++ - '0');
+			hasDigit = true;
+		}
+		int fraction = 0;
+		if (p < end && *p == '.')
+		{
+			p++;
+			for (int i = 0; i < 2; i++)
+			{
+				fraction *= 10;
+				if (p < end && *p >= '0' && *p <= '9')
+				{
+					fraction += *p++ - '0';
+					hasDigit = true;
+				}
+			}
+		}
+		v = v * 100 + fraction;
+		value = negative ? -v : v;
+		return hasDigit;
+	}
+
+	inline bool ParseDigits(const char *&p, const char *end, int maxDigits, uint32_t &value)
+	{
+		int numDigits = 0;
+		value = 0;
+		while (p < end && numDigits < maxDigits && *p >= '0' && *p <= '9')
+		{
+			value = value * 10 + (*p++ - '0');
+			numDigits++;
+		}
+		return numDigits > 0;
+	}
+
+	inline bool ParseDate(const char *p, const char *end, uint64_t &value)
+	{
+		uint32_t year, month, day;
+		p = SkipSpaces(p, end);
+		if (!ParseDigits(p, end, 4, year) || p == end || *p++ != '-')
+			return false;
+		if (!ParseDigits(p, end, 2, month) || p == end || *p++ != '-')
+			return false;
+		if (!ParseDigits(p, end, 2, day))
+			return false;
+		value = year * 10000 + month * 100 + day;
+		return true;
+	}
+
+	// Strict matching for type detection: the whole value (without surrounding spaces) must match
+	inline TblFile::FieldType MatchType(const char *p, const char *end)
+	{
+		p = SkipSpaces(p, end);
+		while (end > p && IsSpace(end[-1]))
+			end--;
+		const char *q = p;
+		if (q < end && (*q == '-' || *q == '+'))
+			q++;
+		const char *digits = q;
+		while (q < end && *q >= '0' && *q <= '9')
+			q++;
+		if (q == end && q > digits && q - digits <= 9)
+			return TblFile::INT;
+		if (q < end && *q == '.' && q > digits && end - q <= 3)
+		{
+			const char *r = q + 1;
+			while (r < end && *r >= '0' && *r <= '9')
+				r++;
+			if (r == end && r > q + 1 && q - digits <= 7)
+				return TblFile::DECIMAL;
+		}
+		if (end - p == 10 && p[4] == '-' && p[7] == '-')
+		{
+			bool isDate = true;
+			for (int i = 0; i < 10; i++)
+				if (i != 4 && i != 7 && (p[i] < '0' || p[i] > '9'))
+					isDate = false;
+			if (isDate)
+				return TblFile::DATE;
+		}
+		return TblFile::STRING;
+	}
+
+	// The most specific type that covers both types
+	inline TblFile::FieldType CommonType(TblFile::FieldType a, TblFile::FieldType b)
+	{
+		if (a == b)
+			return a;
+		if ((a == TblFile::INT && b == TblFile::DECIMAL) || (a == TblFile::DECIMAL && b == TblFile::INT))
+			return TblFile::DECIMAL;
+		return TblFile::STRING;
+	}
+
+	TblFile::TblFile(const char *filePath) : file(filePath)
+	{
+		data = file.data();
+		fileSize = file.size();
+		file.AdviseSequential();
+		size_t pos = 0;
+		ParseHeader(pos);
+		SplitChunks(pos);
+	}
+
+	void TblFile::Fail(const char *msg, size_t row)
+	{
+		std::cerr << "Read data error (" << msg << ") in " << file.path() << " at row " << row + 1 << "!" << std::endl;
+		std::exit(1);
+	}
+
+	void TblFile::ParseHeader(size_t &pos)
+	{
+		const char *end = data + fileSize;
+		const char *p = data;
+		int64_t numColumns;
+		if (!ParseInt(p, end, numColumns) || numColumns <= 0)
+		{
+			std::cerr << "Read header error in " << file.path() << "!" << std::endl;
+			std::exit(1);
+		}
+		while (p < end && *p != '\n')
+			p++;
+		p = SkipSpaces(p, end);
+		for (int64_t i = 0; i < numColumns; i++)
+		{
+			const char *q = p;
+			while (q < end && *q != '|' && *q != '\n')
+				q++;
+			if (q == end || *q != '|')
+			{
+				std::cerr << "Read header error in " << file.path() << "!" << std::endl;
+				std::exit(1);
+			}
+			columnNames.emplace_back(p, q);
+			p = q + 1;
+		}
+		while (p < end && *p != '\n')
+			p++;
+		pos = p - data;
+	}
+
+	void TblFile::SplitChunks(size_t dataBegin)
+	{
+		size_t dataSize = fileSize - dataBegin;
+		size_t numChunks = std::max<size_t>(1, std::min<size_t>(4 * gThreadPool.GetNumThreads(), dataSize / minChunkBytes));
+		chunkBegins.resize(numChunks);
+		chunkEnds.resize(numChunks);
+		for (size_t k = 0; k < numChunks; k++)
+		{
+			// every chunk (except the first one) begins right after a newline character
+			size_t begin = dataBegin + dataSize * k / numChunks;
+			if (k > 0)
+			{
+				while (begin < fileSize && data[begin - 1] != '\n')
+					begin++;
+				chunkEnds[k - 1] = begin;
+			}
+			chunkBegins[k] = begin;
+		}
+		chunkEnds[numChunks - 1] = fileSize;
+
+		// count non-empty rows in each chunk
+		std::vector<size_t> chunkRows(numChunks);
+		gThreadPool.ParallelFor(numChunks, [&](size_t k) {
+			size_t rows = 0;
+			bool empty = true;
+			for (size_t i = chunkBegins[k]; i < chunkEnds[k]; i++)
+			{
+				if (data[i] == '\n')
+				{
+					rows += !empty;
+					empty = true;
+				}
+				else if (empty && !IsSpace(data[i]))
+					empty = false;
+			}
+			chunkRows[k] = rows + !empty;
+		});
+		chunkFirstRows.resize(numChunks);
+		numRows = 0;
+		for (size_t k = 0; k < numChunks; k++)
+		{
+			chunkFirstRows[k] = numRows;
+			numRows += chunkRows[k];
+		}
+	}
+
+	int TblFile::FindColumn(const std::string &name)
+	{
+		for (size_t i = 0; i < columnNames.size(); i++)
+			if (columnNames[i] == name)
+				return i;
+		return -1;
+	}
+
+	TblFile::FieldType TblFile::GuessType(int fileColumn)
+	{
+		assert(fileColumn >= 0 && fileColumn < (int)columnNames.size());
+		size_t numChunks = chunkBegins.size();
+		std::vector<FieldType> chunkTypes(numChunks, INT);
+		std::vector<char> chunkEmpty(numChunks, true); // not vector<bool>, written concurrently
+		gThreadPool.ParallelFor(numChunks, [&](size_t k) {
+			const char *p = data + chunkBegins[k];
+			const char *end = data + chunkEnds[k];
+			size_t row = chunkFirstRows[k];
+			while (chunkTypes[k] != STRING)
+			{
+				p = SkipSpaces(p, end);
+				if (p == end)
+					break;
+				for (int j = 0; j <= fileColumn; j++)
+				{
+					const char *q = p;
+					while (q < end && *q != '|' && *q != '\n')
+						q++;
+					if (q == end || *q != '|')
+						Fail("missing columns", row);
+					if (j == fileColumn)
+					{
+						auto type = MatchType(p, q);
+						chunkTypes[k] = chunkEmpty[k] ? type : CommonType(chunkTypes[k], type);
+						chunkEmpty[k] = false;
+					}
+					p = q + 1;
+				}
+				while (p < end && *p != '\n')
+					p++;
+				row++;
+			}
+		});
+		bool empty = true;
+		FieldType type = INT;
+		for (size_t k = 0; k < numChunks; k++)
+			if (!chunkEmpty[k])
+			{
+				type = empty ? chunkTypes[k] : CommonType(type, chunkTypes[k]);
+				empty = false;
+			}
+		return type;
+	}
+
+	std::shared_ptr<const Dictionary> TblFile::BuildDictionary(int fileColumn, size_t numRows)
+	{
+		assert(fileColumn >= 0 && fileColumn < (int)columnNames.size());
+		size_t numChunks = chunkBegins.size();
+		std::vector<std::vector<std::string>> chunkValues(numChunks);
+		gThreadPool.ParallelFor(numChunks, [&](size_t k) {
+			const char *p = data + chunkBegins[k];
+			const char *end = data + chunkEnds[k];
+			auto &values = chunkValues[k];
+			for (size_t row = chunkFirstRows[k]; row < numRows; row++)
+			{
+				p = SkipSpaces(p, end);
+				if (p == end)
+					break;
+				for (int j = 0; j <= fileColumn; j++)
+				{
+					const char *q = p;
+					while (q < end && *q != '|' && *q != '\n')
+						q++;
+					if (q == end || *q != '|')
+						Fail("missing columns", row);
+					if (j == fileColumn)
+						values.emplace_back(p, q);
+					p = q + 1;
+				}
+				while (p < end && *p != '\n')
+					p++;
+			}
+			std::sort(values.begin(), values.end());
+			values.erase(std::unique(values.begin(), values.end()), values.end());
+		});
+		std::vector<std::string> values;
+		for (auto &chunk : chunkValues)
+		{
+			values.insert(values.end(), std::make_move_iterator(chunk.begin()), std::make_move_iterator(chunk.end()));
+			chunk = std::vector<std::string>();
+		}
+		return std::make_shared<const Dictionary>(std::move(values));
+	}
+
+	void TblFile::Parse(const std::vector<Field> &fields, size_t numRows)
+	{
+		Parse(fields, numRows, 0, chunkBegins.size());
+	}
+
+	void TblFile::Parse(const std::vector<Field> &fields, size_t numRows, size_t chunkBegin, size_t chunkEnd)
+	{
+		if (numRows > this->numRows)
+		{
+			std::cerr << "Read data error: " << file.path() << " has only " << this->numRows << " rows!" << std::endl;
+			std::exit(1);
+		}
+		assert(chunkBegin <= chunkEnd && chunkEnd <= chunkBegins.size());
+		std::vector<int> fieldOfColumn(columnNames.size(), -1);
+		for (size_t i = 0; i < fields.size(); i++)
+		{
+			auto col = fields[i].fileColumn;
+			assert(col >= 0 && col < (int)columnNames.size() && fieldOfColumn[col] == -1);
+			fieldOfColumn[col] = i;
+		}
+		auto rowOffset = ChunkFirstRow(chunkBegin);
+		gThreadPool.ParallelFor(chunkEnd - chunkBegin, [&](size_t k) {
+			ParseChunk(chunkBegin + k, fields, fieldOfColumn, numRows, rowOffset);
+		});
+	}
+
+	void TblFile::ParseChunk(size_t k, const std::vector<Field> &fields, const std::vector<int> &fieldOfColumn, size_t numRows, size_t rowOffset)
+	{
+		const char *p = data + chunkBegins[k];
+		const char *end = data + chunkEnds[k];
+		size_t row = chunkFirstRows[k];
+		int numColumns = columnNames.size();
+		while (row < numRows)
+		{
+			p = SkipSpaces(p, end);
+			if (p == end)
+				break;
+			for (int j = 0; j < numColumns; j++)
+			{
+				const char *q = p;
+				while (q < end && *q != '|' && *q != '\n')
+					q++;
+				if (q == end || *q != '|')
+					Fail("missing columns", row);
+				int f = fieldOfColumn[j];
+				if (f >= 0)
+				{
+					auto &field = fields[f];
+					int64_t i_value;
+					uint64_t u_value;
+					switch (field.type)
+					{
+					case INT:
+						if (!ParseInt(p, q, i_value))
+							Fail("int", row);
+						((uint64_t *)field.out)[row - rowOffset] = (uint64_t)(int)i_value;
+						break;
+					case DECIMAL:
+						if (!ParseDecimal(p, q, i_value))
+							Fail("decimal", row);
+						((uint64_t *)field.out)[row - rowOffset] = (uint64_t)(int)i_value;
+						break;
+					case DATE:
+						if (!ParseDate(p, q, u_value))
+							Fail("date", row);
+						((uint64_t *)field.out)[row - rowOffset] = u_value;
+						break;
+					case STRING:
+						u_value = field.dictionary->Find(p, q - p);
+						if (u_value == Dictionary::npos)
+							Fail("string not in dictionary", row);
+						((uint64_t *)field.out)[row - rowOffset] = u_value;
+						break;
+					case ANNOT:
+						if (!ParseInt(p, q, i_value))
+							Fail("annotation", row);
+						((uint32_t *)field.out)[row - rowOffset] = (uint32_t)i_value;
+						break;
+					}
+				}
+				p = q + 1;
+			}
+			// skip the rest of the row
+			while (p < end && *p != '\n')
+				p++;
+			row++;
+		}
+	}
+
+} // namespace SECYAN
@@ -0,0 +1,67 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include "mappedfile.h"
+#include "dictionary.h"
+
+namespace SECYAN
+{
+	// A memory-mapped data file in the pipe-delimited text format (see relation.h)
+	// The rows are located and parsed in parallel chunks by gThreadPool
+	class TblFile
+	{
+	public:
+		enum FieldType
+		{
+			INT,	 // signed integer, stored as (uint64_t)(int)
+			DECIMAL, // decimal with 2 fraction digits, stored as (uint64_t)(int)(100 * value)
+			DATE,	 // yyyy-mm-dd, stored as yyyymmdd
+			STRING,	 // stored as the code of the string in a dictionary (see dictionary.h)
+			ANNOT	 // unsigned 32-bit annotation
+		};
+
+		struct Field
+		{
+			int fileColumn; // index of the column in the file
+			FieldType type;
+			void *out; // uint64_t array (uint32_t array for ANNOT) with at least numRows elements
+			const Dictionary *dictionary = nullptr; // STRING only, must contain every value (see BuildDictionary)
+		};
+
+		TblFile(const char *filePath);
+		TblFile(const TblFile &) = delete;
+		TblFile &operator=(const TblFile &) = delete;
+
+		size_t NumRows() { return numRows; }
+		const std::vector<std::string> &ColumnNames() { return columnNames; }
+		// Return the index of a column in the file, or -1 if there is no such column
+		int FindColumn(const std::string &name);
+		// The most specific type (INT, DECIMAL, DATE or STRING) that every value of a column matches exactly
+		FieldType GuessType(int fileColumn);
+		// The distinct strings in the first numRows rows of a column
+		std::shared_ptr<const Dictionary> BuildDictionary(int fileColumn, size_t numRows);
+		// Parse the first numRows rows into the given fields
+		void Parse(const std::vector<Field> &fields, size_t numRows);
+		// The rows are split into chunks at line boundaries, chunk k begins at row ChunkFirstRow(k)
+		size_t NumChunks() { return chunkBegins.size(); }
+		size_t ChunkFirstRow(size_t k) { return k < chunkFirstRows.size() ? chunkFirstRows[k] : numRows; }
+		// Parse the rows (before row numRows) of chunks [chunkBegin, chunkEnd), row ChunkFirstRow(chunkBegin) goes to out[0]
+		void Parse(const std::vector<Field> &fields, size_t numRows, size_t chunkBegin, size_t chunkEnd);
+
+	private:
+		MappedFile file;
+		const char *data = nullptr;
+		size_t fileSize = 0;
+		std::vector<std::string> columnNames;
+		size_t numRows = 0;
+		// Rows in chunk k begin at chunkBegins[k] and have row ids from chunkFirstRows[k]
+		std::vector<size_t> chunkBegins, chunkEnds, chunkFirstRows;
+		void ParseHeader(size_t &pos);
+		void SplitChunks(size_t dataBegin);
+		void ParseChunk(size_t k, const std::vector<Field> &fields, const std::vector<int> &fieldOfColumn, size_t numRows, size_t rowOffset);
+		[[noreturn]] void Fail(const char *msg, size_t row);
+	};
+} // namespace SECYAN
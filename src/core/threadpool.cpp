@@ -0,0 +1,125 @@
+#include "threadpool.h"
+#include <algorithm>
+
+namespace SECYAN
+{
+	ThreadPool gThreadPool;
+
+	// Whether the current thread is running a task of the pool
+	thread_local bool tInPool = false;
+
+	ThreadPool::ThreadPool()
+	{
+		numThreads = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	ThreadPool::~ThreadPool()
+	{
+		StopWorkers();
+	}
+
+	void ThreadPool::SetNumThreads(uint32_t numThreads)
+	{
+		std::lock_guard<std::mutex> callLock(callMtx);
+		StopWorkers();
+		this->numThreads = std::max(1u, numThreads);
+	}
+
+	uint32_t ThreadPool::GetNumThreads()
+	{
+		return numThreads;
+	}
+
+	void ThreadPool::StartWorkers()
+	{
+		// Called under callMtx, so generation does not change until the workers wait for the next job
+		stopping = false;
+		for (uint32_t i = 1; i < numThreads; i++)
+			workers.emplace_back(&ThreadPool::WorkerLoop, this, generation);
+	}
+
+	void ThreadPool::StopWorkers()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			stopping = true;
+		}
+		taskCV.notify_all();
+		for (auto &worker : workers)
+			worker.join();
+		workers.clear();
+	}
+
+	void ThreadPool::RunTasks(const std::function<void(size_t)> &func, size_t size)
+	{
+		tInPool = true;
+		for (size_t i = nextTask++; i < size; i = nextTask++)
+			func(i);
+		tInPool = false;
+	}
+
+	void ThreadPool::WorkerLoop(uint64_t seenGeneration)
+	{
+		while (true)
+		{
+			const std::function<void(size_t)> *func;
+			size_t size;
+			{
+				std::unique_lock<std::mutex> lock(mtx);
+				taskCV.wait(lock, [&] { return stopping || generation != seenGeneration; });
+				if (stopping)
+					return;
+				seenGeneration = generation;
+				func = job;
+				size = jobSize;
+			}
+			RunTasks(*func, size);
+			{
+				std::lock_guard<std::mutex> lock(mtx);
+				if (--busyWorkers == 0)
+					doneCV.notify_one();
+			}
+		}
+	}
+
+	void ThreadPool::ParallelFor(size_t numTasks, const std::function<void(size_t)> &func)
+	{
+		if (numThreads <= 1 || numTasks <= 1 || tInPool)
+		{
+			for (size_t i = 0; i < numTasks; i++)
+				func(i);
+			return;
+		}
+		std::lock_guard<std::mutex> callLock(callMtx);
+		if (workers.empty())
+			StartWorkers();
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			job = &func;
+			jobSize = numTasks;
+			nextTask = 0;
+			busyWorkers = workers.size();
+			generation++;
+		}
+		taskCV.notify_all();
+		RunTasks(func, numTasks);
+		std::unique_lock<std::mutex> lock(mtx);
+		doneCV.wait(lock, [&] { return busyWorkers == 0; });
+		job = nullptr;
+	}
+
+	void ThreadPool::ParallelRange(size_t size, const std::function<void(size_t, size_t)> &func, size_t minChunkSize)
+	{
+		size_t numChunks = std::min<size_t>(numThreads, (size + minChunkSize - 1) / std::max<size_t>(minChunkSize, 1));
+		if (numChunks <= 1)
+		{
+			if (size > 0)
+				func(0, size);
+			return;
+		}
+		ParallelFor(numChunks, [&](size_t k) {
+			func(size * k / numChunks, size * (k + 1) / numChunks);
+		});
+	}
+
+} // namespace SECYAN
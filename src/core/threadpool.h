@@ -0,0 +1,48 @@
+#pragma once
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <cstdint>
+
+namespace SECYAN
+{
+	// A pool of worker threads for local computation (parsing, sorting, hashing, ...)
+	// Network communication is never done inside the pool
+	class ThreadPool
+	{
+	public:
+		ThreadPool();
+		~ThreadPool();
+		// Total number of threads used by ParallelFor, including the calling thread
+		void SetNumThreads(uint32_t numThreads);
+		uint32_t GetNumThreads();
+		// Run func(i) for every i in [0, numTasks), return after all tasks finish
+		// Nested calls (from inside a task) run sequentially on the current thread
+		void ParallelFor(size_t numTasks, const std::function<void(size_t)> &func);
+		// Split [0, size) into at most GetNumThreads() chunks, call func(begin, end) on each chunk
+		void ParallelRange(size_t size, const std::function<void(size_t, size_t)> &func, size_t minChunkSize = 1);
+
+	private:
+		uint32_t numThreads;
+		std::vector<std::thread> workers;
+		std::mutex mtx, callMtx; // callMtx serializes ParallelFor calls from different threads
+		std::condition_variable taskCV, doneCV;
+		const std::function<void(size_t)> *job = nullptr;
+		size_t jobSize = 0;
+		std::atomic<size_t> nextTask{0};
+		uint32_t busyWorkers = 0;
+		uint64_t generation = 0;
+		bool stopping = false;
+		void StartWorkers();
+		void StopWorkers();
+		// seenGeneration: the generation of the last job before the worker started
+		void WorkerLoop(uint64_t seenGeneration);
+		void RunTasks(const std::function<void(size_t)> &func, size_t size);
+	};
+
+	// A global thread pool
+	extern ThreadPool gThreadPool;
+} // namespace SECYAN
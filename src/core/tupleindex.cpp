@@ -0,0 +1,146 @@
+#include "tupleindex.h"
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <cstdio>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace SECYAN
+{
+	bool gPersistIndexes = false;
+
+	const char indexMagic[8] = {'S', 'E', 'C', 'Y', 'A', 'N', 'I', 'X'};
+	const uint32_t indexVersion = 1;
+	const uint32_t sortIndexKind = 0;
+	const uint32_t hashIndexKind = 1;
+
+	// Index file: header, numKeys uint64 key hashes (hash index only), numRows uint32 rows (permutation or groups)
+	// The size and modification time of the data file tell whether the index is up to date
+	struct IndexHeader
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t kind;
+		uint64_t numRows;
+		uint64_t numKeys;
+		uint64_t dataSize;
+		int64_t dataModified;
+	};
+
+	void TupleIndex::Bind(const std::string &dataPath, size_t numRows)
+	{
+		struct stat st;
+		if (stat(dataPath.c_str(), &st) != 0)
+			return;
+		this->dataPath = dataPath;
+		this->numRows = numRows;
+		dataSize = st.st_size;
+		dataModified = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+	}
+
+	std::string TupleIndex::IndexPath(const char *kind, const std::vector<std::string> &keys)
+	{
+		std::string path = dataPath + "." + kind + ".";
+		for (size_t k = 0; k < keys.size(); k++)
+			path += (k > 0 ? "," : "") + keys[k];
+		return path + ".idx";
+	}
+
+	bool TupleIndex::ReadIndex(const std::string &path, uint32_t kind, std::vector<uint64_t> &keys, std::vector<uint32_t> &rows)
+	{
+		std::ifstream in(path, std::ios::binary);
+		IndexHeader header;
+		if (!in.read((char *)&header, sizeof(header)))
+			return false;
+		if (std::memcmp(header.magic, indexMagic, sizeof(indexMagic)) != 0 || header.version != indexVersion || header.kind != kind ||
+			header.numRows != numRows || header.dataSize != dataSize || header.dataModified != dataModified ||
+			header.numKeys > numRows)
+			return false;
+		keys.resize(header.numKeys);
+		rows.resize(numRows);
+		in.read((char *)keys.data(), keys.size() * sizeof(uint64_t));
+		in.read((char *)rows.data(), rows.size() * sizeof(uint32_t));
+		return (bool)in;
+	}
+
+	void TupleIndex::WriteIndex(const std::string &path, uint32_t kind, const std::vector<uint64_t> &keys, const std::vector<uint32_t> &rows)
+	{
+		IndexHeader header = {};
+		std::memcpy(header.magic, indexMagic, sizeof(indexMagic));
+		header.version = indexVersion;
+		header.kind = kind;
+		header.numRows = numRows;
+		header.numKeys = keys.size();
+		header.dataSize = dataSize;
+		header.dataModified = dataModified;
+		// Written to a temporary file first, so that the other party (or query) never reads a partial index
+		auto tmpPath = path + "." + std::to_string(getpid()) + ".tmp";
+		std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+		out.write((const char *)&header, sizeof(header));
+		out.write((const char *)keys.data(), keys.size() * sizeof(uint64_t));
+		out.write((const char *)rows.data(), rows.size() * sizeof(uint32_t));
+		out.close();
+		if (!out || std::rename(tmpPath.c_str(), path.c_str()) != 0)
+		{
+			std::remove(tmpPath.c_str());
+			std::cerr << "Index warning: cannot write " << path << "!" << std::endl;
+		}
+	}
+
+	std::shared_ptr<const std::vector<uint32_t>> TupleIndex::FindSortPermutation(const std::vector<std::string> &keys)
+	{
+		auto it = sortPermutations.find(keys);
+		if (it != sortPermutations.end())
+			return it->second;
+		if (!gPersistIndexes || dataPath.empty())
+			return nullptr;
+		std::vector<uint64_t> noKeys;
+		std::vector<uint32_t> permutation;
+		if (!ReadIndex(IndexPath("sort", keys), sortIndexKind, noKeys, permutation) || !noKeys.empty())
+			return nullptr;
+		std::vector<bool> seen(numRows, false);
+		for (auto i : permutation)
+		{
+			if (i >= numRows || seen[i])
+				return nullptr;
+			seen[i] = true;
+		}
+		auto ret = std::make_shared<const std::vector<uint32_t>>(std::move(permutation));
+		sortPermutations[keys] = ret;
+		return ret;
+	}
+
+	void TupleIndex::AddSortPermutation(const std::vector<std::string> &keys, std::vector<uint32_t> permutation)
+	{
+		if (gPersistIndexes && !dataPath.empty() && permutation.size() == numRows)
+			WriteIndex(IndexPath("sort", keys), sortIndexKind, {}, permutation);
+		sortPermutations[keys] = std::make_shared<const std::vector<uint32_t>>(std::move(permutation));
+	}
+
+	std::shared_ptr<const HashIndex> TupleIndex::FindHashIndex(const std::vector<std::string> &keys)
+	{
+		auto it = hashIndexes.find(keys);
+		if (it != hashIndexes.end())
+			return it->second;
+		if (!gPersistIndexes || dataPath.empty())
+			return nullptr;
+		HashIndex index;
+		if (!ReadIndex(IndexPath("hash", keys), hashIndexKind, index.keys, index.groups))
+			return nullptr;
+		for (auto group : index.groups)
+			if (group >= index.keys.size())
+				return nullptr;
+		auto ret = std::make_shared<const HashIndex>(std::move(index));
+		hashIndexes[keys] = ret;
+		return ret;
+	}
+
+	void TupleIndex::AddHashIndex(const std::vector<std::string> &keys, HashIndex index)
+	{
+		if (gPersistIndexes && !dataPath.empty() && index.groups.size() == numRows)
+			WriteIndex(IndexPath("hash", keys), hashIndexKind, index.keys, index.groups);
+		hashIndexes[keys] = std::make_shared<const HashIndex>(std::move(index));
+	}
+
+} // namespace SECYAN
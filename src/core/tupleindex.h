@@ -0,0 +1,50 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <map>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+namespace SECYAN
+{
+	// Whether the indexes of relations loaded from data files are saved to (and reused from) files next to the data files,
+	// e.g. orders.tbl.sort.o_custkey.idx, default: false
+	extern bool gPersistIndexes;
+
+	// Rows grouped by the values of a key list
+	struct HashIndex
+	{
+		std::vector<uint64_t> keys;	  // the hash (see Relation::HashTuple) of every distinct key
+		std::vector<uint32_t> groups; // groups[i] is the index of the key of row i
+	};
+
+	// Cached sort permutations and hash indexes of the tuples of a relation, per key list (attribute names)
+	// The cache is shared by the copies and projections of a relation until its rows are reordered, filtered or appended.
+	// The indexes are computed from the values only (dummy flags are ignored), so turning rows into dummies keeps them valid.
+	class TupleIndex
+	{
+	public:
+		// Persist the indexes next to a data file, from which the first numRows rows are loaded (see gPersistIndexes)
+		void Bind(const std::string &dataPath, size_t numRows);
+
+		// Row permutation[i] is the i-th row in dictionary order of the keys, nullptr if not cached
+		std::shared_ptr<const std::vector<uint32_t>> FindSortPermutation(const std::vector<std::string> &keys);
+		void AddSortPermutation(const std::vector<std::string> &keys, std::vector<uint32_t> permutation);
+		// nullptr if not cached
+		std::shared_ptr<const HashIndex> FindHashIndex(const std::vector<std::string> &keys);
+		void AddHashIndex(const std::vector<std::string> &keys, HashIndex index);
+
+	private:
+		std::string dataPath; // empty: not bound
+		size_t numRows = 0;
+		uint64_t dataSize = 0;
+		int64_t dataModified = 0;
+		std::map<std::vector<std::string>, std::shared_ptr<const std::vector<uint32_t>>> sortPermutations;
+		std::map<std::vector<std::string>, std::shared_ptr<const HashIndex>> hashIndexes;
+		std::string IndexPath(const char *kind, const std::vector<std::string> &keys);
+		// The arrays of an index file, false if there is no up-to-date file
+		bool ReadIndex(const std::string &path, uint32_t kind, std::vector<uint64_t> &keys, std::vector<uint32_t> &rows);
+		void WriteIndex(const std::string &path, uint32_t kind, const std::vector<uint64_t> &keys, const std::vector<uint32_t> &rows);
+	};
+} // namespace SECYAN
@@ -0,0 +1,208 @@
+#include "waksman.h"
+#include <algorithm>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+namespace SECYAN
+{
+	static const uint8_t gateNumMap[] = {0, 0, 1, 3, 5, 8, 11, 14, 17, 21, 25, 29, 33, 37,
+										 41, 45, 49, 54, 59, 64, 69, 74, 79, 84, 89, 94, 99};
+
+	uint32_t ComputeGateNum(int N)
+	{
+		if (N < (int)sizeof(gateNumMap))
+			return gateNumMap[N];
+		int power = 32 - __builtin_clz(N); // floor(log2(N)) + 1
+		return power * N + 1 - (1 << power);
+	}
+
+	WaksmanNetwork::WaksmanNetwork(uint32_t size, int gateArrays)
+		: size(size), gateNum(ComputeGateNum(size)), gateArrays(gateArrays)
+	{
+		// The children of the subnetworks of a level form the next level, in the same order
+		layout.push_back({0, size, 0, 0});
+		levelStart.push_back(0);
+		while (levelStart.back() < layout.size())
+		{
+			uint32_t begin = levelStart.back(), end = layout.size();
+			levelStart.push_back(end);
+			for (auto k = begin; k < end; k++)
+			{
+				auto sub = layout[k];
+				if (sub.size <= 2)
+					continue;
+				uint32_t halfSize = sub.size / 2, lowerSize = sub.size - halfSize;
+				uint32_t upperGate = sub.leftGate + halfSize, lowerGate = upperGate + ComputeGateNum(halfSize);
+				layout[k].rightGate = lowerGate + ComputeGateNum(lowerSize);
+				layout.push_back({sub.offset, halfSize, upperGate, 0});
+				layout.push_back({sub.offset + halfSize, lowerSize, lowerGate, 0});
+			}
+		}
+		// The scratch memory: a value buffer for Run, or two index buffers, the inverse indices and two byte flag arrays for routing
+		arena.reset(new uint32_t[(size_t)gateArrays * gateNum + 3 * (size_t)size + (2 * (size_t)size + 3) / 4]);
+	}
+
+	void WaksmanNetwork::GenSelectionBits(const uint32_t *permuIndices, uint32_t *bits)
+	{
+		// The indices of a subnetwork are local to it, level d holds them in buffer d % 2.
+		// The subnetworks of a level are routed in parallel, each uses the scratch memory of its own wires
+		auto scratch = Scratch();
+		uint32_t *buffers[2] = {scratch, scratch + size};
+		std::copy(permuIndices, permuIndices + size, buffers[0]);
+		int numLevels = levelStart.size() - 1;
+		for (int d = 0; d < numLevels; d++)
+		{
+			auto cur = buffers[d % 2], next = buffers[(d + 1) % 2];
+			gThreadPool.ParallelRange(levelStart[d + 1] - levelStart[d], [&](size_t begin, size_t end) {
+				for (auto k = levelStart[d] + begin; k < levelStart[d] + end; k++)
+					RouteSubNetwork(layout[k], cur, next, bits);
+			});
+		}
+	}
+
+	void WaksmanNetwork::RouteSubNetwork(const SubNetwork &sub, const uint32_t *cur, uint32_t *next, uint32_t *bits)
+	{
+		int size = sub.size;
+		auto indices = cur + sub.offset;
+		if (size == 2)
+			bits[sub.leftGate] = indices[0];
+		if (size <= 2)
+			return;
+		// The scratch memory of the wires of the subnetwork
+		auto scratch = Scratch();
+		auto inv = scratch + 2 * this->size + sub.offset;
+		auto leftFlag = (uint8_t *)(scratch + 3 * this->size) + sub.offset, rightFlag = leftFlag + this->size;
+		for (int i = 0; i < size; i++)
+			inv[indices[i]] = i;
+
+		bool odd = size & 1;
+
+		// Solve the edge coloring problem
+
+		// flag=0: non-specified; flag=1: upperNetwork; flag=2: lowerNetwork
+		std::fill(leftFlag, leftFlag + size, 0);
+		std::fill(rightFlag, rightFlag + size, 0);
+		int rightPointer = size - 1;
+		int leftPointer;
+		while (rightFlag[rightPointer] == 0)
+		{
+			rightFlag[rightPointer] = 2;
+			leftPointer = indices[rightPointer];
+			leftFlag[leftPointer] = 2;
+			if (odd && leftPointer == size - 1)
+				break;
+			leftPointer = leftPointer & 1 ? leftPointer - 1 : leftPointer + 1;
+			leftFlag[leftPointer] = 1;
+			rightPointer = inv[leftPointer];
+			rightFlag[rightPointer] = 1;
+			rightPointer = rightPointer & 1 ? rightPointer - 1 : rightPointer + 1;
+		}
+		for (int i = 0; i < size - 1; i++)
+		{
+			rightPointer = i;
+			while (rightFlag[rightPointer] == 0)
+			{
+				rightFlag[rightPointer] = 2;
+				leftPointer = indices[rightPointer];
+				leftFlag[leftPointer] = 2;
+				leftPointer = leftPointer & 1 ? leftPointer - 1 : leftPointer + 1;
+				leftFlag[leftPointer] = 1;
+				rightPointer = inv[leftPointer];
+
+				rightFlag[rightPointer] = 1;
+				rightPointer = rightPointer & 1 ? rightPointer - 1 : rightPointer + 1;
+			}
+		}
+
+		// Determine bits on left gates
+		int halfSize = size / 2;
+		for (int i = 0; i < halfSize; i++)
+			bits[sub.leftGate + i] = leftFlag[2 * i] == 2;
+
+		// Determine bits on right gates
+		auto rightBits = bits + sub.rightGate;
+		for (int i = 0; i < halfSize - 1; i++)
+			rightBits[i] = rightFlag[2 * i] == 2;
+		if (odd)
+			rightBits[halfSize - 1] = rightFlag[size - 2] == 1;
+
+		// Indices of the upper network
+		auto upperIndices = next + sub.offset;
+		for (int i = 0; i < halfSize - 1 + odd; i++)
+			upperIndices[i] = indices[2 * i + rightBits[i]] / 2;
+		if (!odd)
+			upperIndices[halfSize - 1] = indices[size - 2] / 2;
+
+		// Indices of the lower network
+		auto lowerIndices = upperIndices + halfSize;
+		for (int i = 0; i < halfSize - 1 + odd; i++)
+			lowerIndices[i] = indices[2 * i + 1 - rightBits[i]] / 2;
+		if (odd)
+			lowerIndices[halfSize] = indices[size - 1] / 2;
+		else
+			lowerIndices[halfSize - 1] = indices[2 * halfSize - 1] / 2;
+	}
+
+	void WriteLayerLabels(const uint32_t *output1, const uint32_t *output2, uint64_t *msg0, uint64_t *msg1,
+						  uint32_t firstGate, uint32_t n, const uint32_t *in0, const uint32_t *in1, uint32_t *out0, uint32_t *out1)
+	{
+		output1 += firstGate;
+		output2 += firstGate;
+		msg0 += firstGate;
+		msg1 += firstGate;
+		uint32_t j = 0;
+#ifdef __AVX2__
+		for (; j + 8 <= n; j += 8)
+		{
+			__m256i x0 = _mm256_loadu_si256((const __m256i *)(in0 + j)), x1 = _mm256_loadu_si256((const __m256i *)(in1 + j));
+			__m256i r3 = _mm256_loadu_si256((const __m256i *)(output1 + j)), r4 = _mm256_loadu_si256((const __m256i *)(output2 + j));
+			__m256i upper0 = _mm256_sub_epi32(x0, r3), lower0 = _mm256_sub_epi32(x1, r4);
+			__m256i upper1 = _mm256_sub_epi32(x1, r3), lower1 = _mm256_sub_epi32(x0, r4);
+			// Interleaving (lower, upper) gives the 64-bit messages of gates 0, 1, 4, 5 and 2, 3, 6, 7
+			__m256i lo0 = _mm256_unpacklo_epi32(lower0, upper0), hi0 = _mm256_unpackhi_epi32(lower0, upper0);
+			__m256i lo1 = _mm256_unpacklo_epi32(lower1, upper1), hi1 = _mm256_unpackhi_epi32(lower1, upper1);
+			_mm256_storeu_si256((__m256i *)(msg0 + j), _mm256_permute2x128_si256(lo0, hi0, 0x20));
+			_mm256_storeu_si256((__m256i *)(msg0 + j + 4), _mm256_permute2x128_si256(lo0, hi0, 0x31));
+			_mm256_storeu_si256((__m256i *)(msg1 + j), _mm256_permute2x128_si256(lo1, hi1, 0x20));
+			_mm256_storeu_si256((__m256i *)(msg1 + j + 4), _mm256_permute2x128_si256(lo1, hi1, 0x31));
+			_mm256_storeu_si256((__m256i *)(out0 + j), r3);
+			_mm256_storeu_si256((__m256i *)(out1 + j), r4);
+		}
+#endif
+		for (; j < n; j++)
+		{
+			uint32_t x0 = in0[j], x1 = in1[j];
+			msg0[j] = (uint64_t)(x0 - output1[j]) << 32 | (uint32_t)(x1 - output2[j]);
+			msg1[j] = (uint64_t)(x1 - output1[j]) << 32 | (uint32_t)(x0 - output2[j]);
+			out0[j] = output1[j];
+			out1[j] = output2[j];
+		}
+	}
+
+	void EvaluateLayer(const uint32_t *bits, const uint32_t *upper, const uint32_t *lower,
+					   uint32_t firstGate, uint32_t n, const uint32_t *in0, const uint32_t *in1, uint32_t *out0, uint32_t *out1)
+	{
+		bits += firstGate;
+		upper += firstGate;
+		lower += firstGate;
+		uint32_t j = 0;
+#ifdef __AVX2__
+		for (; j + 8 <= n; j += 8)
+		{
+			__m256i v0 = _mm256_loadu_si256((const __m256i *)(in0 + j)), v1 = _mm256_loadu_si256((const __m256i *)(in1 + j));
+			// All ones where the gate swaps
+			__m256i swap = _mm256_sub_epi32(_mm256_setzero_si256(), _mm256_loadu_si256((const __m256i *)(bits + j)));
+			__m256i first = _mm256_blendv_epi8(v0, v1, swap), second = _mm256_blendv_epi8(v1, v0, swap);
+			_mm256_storeu_si256((__m256i *)(out0 + j), _mm256_add_epi32(first, _mm256_loadu_si256((const __m256i *)(upper + j))));
+			_mm256_storeu_si256((__m256i *)(out1 + j), _mm256_add_epi32(second, _mm256_loadu_si256((const __m256i *)(lower + j))));
+		}
+#endif
+		for (; j < n; j++)
+		{
+			uint32_t v0 = in0[j], v1 = in1[j];
+			out0[j] = (bits[j] ? v1 : v0) + upper[j];
+			out1[j] = (bits[j] ? v0 : v1) + lower[j];
+		}
+	}
+} // namespace SECYAN
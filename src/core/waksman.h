@@ -0,0 +1,160 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <algorithm>
+#include "threadpool.h"
+
+namespace SECYAN
+{
+	// sum(ceil(log2(i))) for i=1 to N, the number of gates of a Waksman network of size N
+	uint32_t ComputeGateNum(int N);
+
+	// A Waksman network of any size ("On Arbitrary Waksman Networks and their Vulnerability"), without recursion.
+	// A subnetwork of size s > 2 has s / 2 left gates, an upper subnetwork of size s / 2 on the even wires, a lower one of size
+	// s - s / 2 on the odd wires (and the last wire if s is odd), and s / 2 - 1 + s % 2 right gates. Its gates are numbered
+	// left gates, upper gates, lower gates, right gates, as by the former recursive implementation.
+	// The layout lists the subnetworks level by level, each level passes the values to the next one through a scratch buffer,
+	// and the gate data of the caller and all scratch memory are in one arena allocated by the constructor.
+	class WaksmanNetwork
+	{
+	public:
+		// gateArrays: the number of uint32_t arrays of GateNum() entries the caller needs (see GateArray)
+		WaksmanNetwork(uint32_t size, int gateArrays = 0);
+		uint32_t Size() const { return size; }
+		uint32_t GateNum() const { return gateNum; }
+		uint32_t *GateArray(int k) { return arena.get() + (size_t)k * gateNum; }
+
+		// The selection bits (0 or 1) of the gates that route input permuIndices[i] to output i
+		void GenSelectionBits(const uint32_t *permuIndices, uint32_t *bits);
+		// Pass values through the network a layer at a time. The left gates of a level, then (after the deeper levels) its right
+		// gates form layers of consecutive gate numbers, and layer(firstGate, n, in0, in1, out0, out1) evaluates the gates
+		// firstGate + j for j < n on the values in0[j], in1[j] of their two wires, writing out0[j], out1[j] (which may be in0, in1).
+		// The wires of a layer are gathered from and scattered to the values of the level by the layout (the even and odd wires
+		// of a subnetwork). The subnetworks of a level (or the gates of a large subnetwork) run on gThreadPool, so layer must be
+		// thread-safe
+		template <typename LayerFunc>
+		void Run(uint32_t *values, LayerFunc layer);
+
+		// A subnetwork with fewer gates per layer is not split among threads
+		static const uint32_t parallelCutoff = 1 << 12;
+		// The number of gates a layer function gets at a time
+		static const uint32_t layerChunk = 64;
+
+	private:
+		struct SubNetwork
+		{
+			uint32_t offset, size; // the wires [offset, offset + size) of its level
+			uint32_t leftGate, rightGate; // the first left gate and the first right gate
+		};
+		uint32_t size, gateNum;
+		int gateArrays;
+		// The subnetworks of level d are layout[levelStart[d], levelStart[d + 1])
+		std::vector<SubNetwork> layout;
+		std::vector<uint32_t> levelStart;
+		// gateArrays arrays of gateNum entries, then the scratch memory (not initialized)
+		std::unique_ptr<uint32_t[]> arena;
+		uint32_t *Scratch() { return arena.get() + (size_t)gateArrays * gateNum; }
+		// step(sub, begin, end) for the steps [begin, end) of every subnetwork of level d, in parallel
+		template <typename Step>
+		void ForLevel(int d, Step step);
+		// Route a subnetwork (set the bits of its gates, except those of its children) and write the indices of its children to next
+		void RouteSubNetwork(const SubNetwork &sub, const uint32_t *cur, uint32_t *next, uint32_t *bits);
+	};
+
+	template <typename Step>
+	void WaksmanNetwork::ForLevel(int d, Step step)
+	{
+		auto first = layout.data() + levelStart[d];
+		size_t count = levelStart[d + 1] - levelStart[d];
+		if (count >= gThreadPool.GetNumThreads())
+			gThreadPool.ParallelRange(count, [&](size_t begin, size_t end) {
+				for (auto k = begin; k < end; k++)
+					step(first[k], 0, first[k].size / 2);
+			});
+		else
+			for (size_t k = 0; k < count; k++)
+				gThreadPool.ParallelRange(first[k].size / 2, [&](size_t begin, size_t end) {
+					step(first[k], begin, end);
+				}, parallelCutoff);
+	}
+
+	template <typename LayerFunc>
+	void WaksmanNetwork::Run(uint32_t *values, LayerFunc layer)
+	{
+		// Level d holds its values in buffer d % 2. A subnetwork of size <= 2 is not split, so its wires are not used by
+		// deeper levels and keep its values until they are merged back into the level above.
+		// Step i of a subnetwork (its left gate i and its wires 2i, 2i + 1 in the split, or in the merge and right gate i)
+		// does not depend on the other steps
+		uint32_t *buffers[2] = {values, Scratch()};
+		int numLevels = levelStart.size() - 1;
+		for (int d = 0; d < numLevels; d++)
+		{
+			auto cur = buffers[d % 2], next = buffers[(d + 1) % 2];
+			ForLevel(d, [&](const SubNetwork &sub, uint32_t begin, uint32_t end) {
+				auto v = cur + sub.offset;
+				if (sub.size == 2)
+					layer(sub.leftGate, 1, v, v + 1, v, v + 1);
+				if (sub.size <= 2)
+					return;
+				// The left gates read the even and odd wires and write the upper and lower subnetworks
+				uint32_t halfSize = sub.size / 2;
+				auto upper = next + sub.offset, lower = upper + halfSize;
+				uint32_t in0[layerChunk], in1[layerChunk];
+				for (uint32_t i = begin; i < end; i += layerChunk)
+				{
+					uint32_t n = end - i < layerChunk ? end - i : layerChunk;
+					for (uint32_t j = 0; j < n; j++)
+					{
+						in0[j] = v[2 * (i + j)];
+						in1[j] = v[2 * (i + j) + 1];
+					}
+					layer(sub.leftGate + i, n, in0, in1, upper + i, lower + i);
+				}
+				if ((sub.size & 1) && end == halfSize) // the last element
+					lower[halfSize] = v[sub.size - 1];
+			});
+		}
+		for (int d = numLevels - 1; d >= 0; d--)
+		{
+			auto cur = buffers[d % 2], next = buffers[(d + 1) % 2];
+			ForLevel(d, [&](const SubNetwork &sub, uint32_t begin, uint32_t end) {
+				if (sub.size <= 2)
+					return;
+				// The right gates read the upper and lower subnetworks and write the even and odd wires
+				auto v = cur + sub.offset;
+				uint32_t halfSize = sub.size / 2, odd = sub.size & 1;
+				uint32_t numRightGates = halfSize - 1 + odd, gatesEnd = std::min(end, numRightGates);
+				auto upper = next + sub.offset, lower = upper + halfSize;
+				uint32_t out0[layerChunk], out1[layerChunk];
+				for (uint32_t i = begin; i < gatesEnd; i += layerChunk)
+				{
+					uint32_t n = gatesEnd - i < layerChunk ? gatesEnd - i : layerChunk;
+					layer(sub.rightGate + i, n, upper + i, lower + i, out0, out1);
+					for (uint32_t j = 0; j < n; j++)
+					{
+						v[2 * (i + j)] = out0[j];
+						v[2 * (i + j) + 1] = out1[j];
+					}
+				}
+				for (uint32_t i = std::max(begin, numRightGates); i < end; i++)
+				{
+					v[2 * i] = upper[i];
+					v[2 * i + 1] = lower[i];
+				}
+				if (odd && end == halfSize) // the last element
+					v[sub.size - 1] = lower[halfSize];
+			});
+		}
+	}
+
+	// The layer functions of the OEP, with AVX2 if available. Gate g has inputs x0-r1, x1-r2 and
+	// outputs x0-r3, x1-r4 if bit==0, x1-r3, x0-r4 if bit==1, m0=(r1-r3, r2-r4) and m1=(r2-r3, r1-r4) are its OT messages:
+	// the sender writes the labels r3, r4 (output1[g], output2[g]) on the wires and the messages into msg0[g], msg1[g] as
+	// (upper << 32 | lower), the permutor adds the received message (upper[g], lower[g]) of its selection bit
+	void WriteLayerLabels(const uint32_t *output1, const uint32_t *output2, uint64_t *msg0, uint64_t *msg1,
+						  uint32_t firstGate, uint32_t n, const uint32_t *in0, const uint32_t *in1, uint32_t *out0, uint32_t *out1);
+	void EvaluateLayer(const uint32_t *bits, const uint32_t *upper, const uint32_t *lower,
+					   uint32_t firstGate, uint32_t n, const uint32_t *in0, const uint32_t *in1, uint32_t *out0, uint32_t *out1);
+} // namespace SECYAN
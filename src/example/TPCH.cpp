@@ -3,19 +3,12 @@
 #include "../core/relation.h"
 #include <iostream>
 #include <chrono>
+#include <fstream>
 #include "TPCH.h"
 
 using namespace std;
 using namespace SECYAN;
 
-size_t NumRows[RTOTAL][DTOTAL] = {
-	{150, 450, 1500, 4950, 15000},
-	{1500, 4500, 15000, 49500, 150000},
-	{6005, 17973, 60175, 198344, 595215},
-	{200, 600, 2000, 6600, 20000},
-	{10, 30, 100, 330, 1000},
-	{800, 2400, 8000, 26400, 80000}};
-
 std::vector<std::string> AttrNames[RTOTAL][QTOTAL] = {
 	{{"c_custkey"}, {"c_custkey", "c_name", "c_nationkey"}, {"c_custkey", "c_name"}, {"c_custkey"}, {}},
 	{{"o_custkey", "o_orderkey", "o_orderdate", "o_shippriority"}, {"o_custkey", "o_orderkey"}, {"o_custkey", "o_orderkey", "o_orderdate", "o_totalprice"}, {"o_orderkey", "o_custkey", "o_year"}, {"o_orderkey", "o_year"}},
@@ -54,14 +47,19 @@ inline Relation::RelationInfo GetRI(RelationName rn, QueryName qn, DataSize ds,
 		false,
 		AttrNames[rn][qn],
 		AttrTypes[rn][qn],
-		NumRows[rn][ds],
-		false};
+		0, // counted by LoadData
+		{}}; // sortedBy, set by LoadData
 	return ri;
 }
 
+// The binary snapshot (created by tblconvert) is preferred if it exists
 inline std::string GetFilePath(RelationName rn, DataSize ds)
 {
-	return datapath[ds] + filename[rn];
+	auto filePath = datapath[ds] + filename[rn];
+	auto snapshotPath = filePath.substr(0, filePath.rfind('.')) + ".snap";
+	if (std::ifstream(snapshotPath).good())
+		return snapshotPath;
+	return filePath;
 }
 
 void run_Q3(DataSize ds, bool printResult)
@@ -226,11 +224,10 @@ void run_Q8(DataSize ds, bool printResult)
 
 	auto supp_ri = GetRI(SUPPLIER, Q8, ds, CLIENT);
 	Relation::AnnotInfo supp_ai = {true, true};
-	Relation supplier(supp_ri, supp_ai);
-	auto supplier_copy = supplier;
 	filePath = GetFilePath(SUPPLIER, ds);
-	supplier.LoadData(filePath.c_str(), "q8_annot1");
-	supplier_copy.LoadData(filePath.c_str(), "q8_annot2");
+	vector<string> supp_annotNames = {"q8_annot1", "q8_annot2"};
+	auto suppliers = Relation(supp_ri, supp_ai).LoadData(filePath.c_str(), supp_annotNames);
+	auto &supplier = suppliers[0], &supplier_copy = suppliers[1];
 
 	orders.SemiJoin(customer, "o_custkey", "c_custkey");
 	//orders.PrintTableWithoutRevealing("orders join customer");
@@ -274,11 +271,10 @@ void run_Q9(DataSize ds, bool printResult)
 
 	auto lineitem_ri = GetRI(LINEITEM, Q9, ds, SERVER);
 	Relation::AnnotInfo lineitem_ai = {false, true};
-	Relation lineitem(lineitem_ri, lineitem_ai);
-	auto lineitem_copy = lineitem;
 	filePath = GetFilePath(LINEITEM, ds);
-	lineitem.LoadData(filePath.c_str(), "q9_annot1");
-	lineitem_copy.LoadData(filePath.c_str(), "q9_annot2");
+	vector<string> annotNames = {"q9_annot1", "q9_annot2"};
+	auto lineitems = Relation(lineitem_ri, lineitem_ai).LoadData(filePath.c_str(), annotNames);
+	auto &lineitem = lineitems[0], &lineitem_copy = lineitems[1];
 
 	auto part_ri = GetRI(PART, Q9, ds, CLIENT);
 	Relation::AnnotInfo part_ai = {true, true};
@@ -289,13 +285,10 @@ void run_Q9(DataSize ds, bool printResult)
 
 	auto partsupp_ri = GetRI(PARTSUPP, Q9, ds, CLIENT);
 	Relation::AnnotInfo partsupp_ai = {false, true};
-	Relation partsupp(partsupp_ri, partsupp_ai);
-	Relation::AnnotInfo partsupp_copy_ai = {false, true};
-	Relation partsupp_copy(partsupp_ri, partsupp_copy_ai);
 	filePath = GetFilePath(PARTSUPP, ds);
-	partsupp.LoadData(filePath.c_str(), "q9_annot1");
+	auto partsupps = Relation(partsupp_ri, partsupp_ai).LoadData(filePath.c_str(), annotNames);
+	auto &partsupp = partsupps[0], &partsupp_copy = partsupps[1];
 	partsupp.Aggregate();
-	partsupp_copy.LoadData(filePath.c_str(), "q9_annot2");
 	partsupp_copy.Aggregate();
 
 	vector<string> ps_joinAttrs = {"ps_partkey", "ps_suppkey"};
@@ -321,15 +314,16 @@ void run_Q9(DataSize ds, bool printResult)
 	auto supp_ri = GetRI(SUPPLIER, Q9, ds, CLIENT);
 	Relation::AnnotInfo supp_ai = {true, true};
 	string annotPrefix = "q9_annot";
-	Relation supplier(supp_ri, supp_ai);
+	vector<string> supp_annotNames(numCopies);
+	for (int i = 0; i < numCopies; i++)
+		supp_annotNames[i] = annotPrefix + to_string(i);
 	filePath = GetFilePath(SUPPLIER, ds);
+	auto suppliers = Relation(supp_ri, supp_ai).LoadData(filePath.c_str(), supp_annotNames);
 
 	for (int i = 0; i < numCopies; i++)
 	{
 		//cout << "i=" << i << endl;
-		auto supplier_copy = supplier;
-		string annotName = annotPrefix + to_string(i);
-		supplier_copy.LoadData(filePath.c_str(), annotName.c_str());
+		auto &supplier_copy = suppliers[i];
 		//supplier_copy.Print();
 		lineitem_copy = lineitem;
 		lineitem_copy.SemiJoin(supplier_copy, "l_suppkey", "s_suppkey");
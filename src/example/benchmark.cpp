@@ -4,6 +4,8 @@
 #include <functional>
 #include "ENCRYPTO_utils/parse_options.h"
 #include "TPCH.h"
+#include "../core/spill.h"
+#include "../core/tupleindex.h"
 
 using namespace std;
 function<run_query> query_funcs[QTOTAL] = {run_Q3, run_Q10, run_Q18, run_Q8, run_Q9};
@@ -16,18 +18,28 @@ struct Stat
 };
 
 // Get the average running time and cost of a single query
-Stat SingleQuery(QueryName qn, DataSize ds, uint32_t numRepeat)
+// With numPreprocessedOTs > 0, every run starts with the offline phase (see Party::Preprocess), which is not measured
+Stat SingleQuery(QueryName qn, DataSize ds, uint32_t numRepeat, size_t numPreprocessedOTs)
 {
-    Stat st;
-    gParty.Tick("SingleQuery");
+    Stat st = {0, 0};
     for (uint32_t i = 0; i < numRepeat; i++)
+    {
+        if (numPreprocessedOTs > 0)
+        {
+            gParty.Preprocess(numPreprocessedOTs);
+            gParty.GetCommCostAndResetStats();
+        }
+        gParty.Tick("SingleQuery");
         query_funcs[qn](ds, false);
-    st.time = gParty.Tick("SingleQuery") / numRepeat;
-    st.cost = gParty.GetCommCostAndResetStats() / numRepeat;
+        st.time += gParty.Tick("SingleQuery");
+        st.cost += gParty.GetCommCostAndResetStats();
+    }
+    st.time /= numRepeat;
+    st.cost /= numRepeat;
     return st;
 }
 
-void read_options(int32_t *argcp, char ***argvp, e_role *role, string *address, uint16_t *port, uint32_t *num_reps, uint32_t *qid)
+void read_options(int32_t *argcp, char ***argvp, e_role *role, string *address, uint16_t *port, uint32_t *num_reps, uint32_t *qid, uint32_t *mem_limit, bool *persist_indexes, uint32_t *preprocessed_ots)
 {
 
     uint32_t int_role = 0, int_port = 0;
@@ -37,7 +49,10 @@ void read_options(int32_t *argcp, char ***argvp, e_role *role, string *address,
         {(void *)address, T_STR, "a", "IP-address, default: 127.0.0.1", false, false},
         {(void *)&int_port, T_NUM, "p", "Port (will use port & port+1), default: 7766", false, false},
         {(void *)num_reps, T_NUM, "n", "Number of test runs, default: 3", false, false},
-        {(void *)qid, T_NUM, "q", "Query ID (3,10,18,8,9,0), default: 0, i.e. test all queries. ", false, false}};
+        {(void *)qid, T_NUM, "q", "Query ID (3,10,18,8,9,0), default: 0, i.e. test all queries. ", false, false},
+        {(void *)mem_limit, T_NUM, "m", "Memory budget of each query in MB, default: 0, i.e. unlimited", false, false},
+        {(void *)persist_indexes, T_FLAG, "x", "Save sort and hash indexes next to the data files and reuse them in later runs", false, false},
+        {(void *)preprocessed_ots, T_NUM, "o", "Random OTs (in millions) preprocessed before each run for the oblivious permutations, default: 0", false, false}};
 
     if (!parse_options(argcp, argvp, options, sizeof(options) / sizeof(parsing_ctx)))
     {
@@ -85,7 +100,12 @@ int main(int argc, char **argv)
     string address = "127.0.0.1";
     uint32_t qid = 0;
     uint32_t numreps = 3;
-    read_options(&argc, &argv, &role, &address, &port, &numreps, &qid);
+    uint32_t memLimit = 0;
+    bool persistIndexes = false;
+    uint32_t preprocessedOTs = 0;
+    read_options(&argc, &argv, &role, &address, &port, &numreps, &qid, &memLimit, &persistIndexes, &preprocessedOTs);
+    gMemoryBudget.SetLimit((size_t)memLimit << 20);
+    gPersistIndexes = persistIndexes;
     uint32_t startid = 0, endid = QTOTAL;
     for (uint32_t i = 0; i < QTOTAL; i++)
     {
@@ -111,7 +131,7 @@ int main(int argc, char **argv)
         for (uint32_t j = 0; j < DTOTAL; j++)
         {
             auto ds = (DataSize)j;
-            auto st = SingleQuery(qn, ds, numreps);
+            auto st = SingleQuery(qn, ds, numreps, (size_t)preprocessedOTs << 20);
             times[j] = st.time / 1000.0;
             costs[j] = st.cost / 1024 / 1024.0;
         }
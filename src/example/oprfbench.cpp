@@ -0,0 +1,103 @@
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <iostream>
+#include "ENCRYPTO_utils/parse_options.h"
+#include "../core/party.h"
+#include "../core/threadpool.h"
+#include "../core/RNG.h"
+
+using namespace std;
+using namespace SECYAN;
+
+// OPRF throughput with 1, 2, 4, ... threads, as used by the PSI (see PSI.cpp):
+// the server encodes 3 elements per bin (simple hashing), the client 1 element per bin (cuckoo hashing)
+
+void read_options(int32_t *argcp, char ***argvp, e_role *role, string *address, uint16_t *port, uint32_t *numBins, uint32_t *numThreads, uint32_t *numReps)
+{
+    uint32_t int_role = 0, int_port = 0;
+
+    parsing_ctx options[] = {
+        {(void *)&int_role, T_NUM, "r", "Role: 0/1, default: 0 (SERVER)", true, false},
+        {(void *)address, T_STR, "a", "IP-address, default: 127.0.0.1", false, false},
+        {(void *)&int_port, T_NUM, "p", "Port (will use port & port+1), default: 7766", false, false},
+        {(void *)numBins, T_NUM, "b", "Number of bins, default: 1048576", false, false},
+        {(void *)numThreads, T_NUM, "n", "Maximum number of threads, default: all hardware threads", false, false},
+        {(void *)numReps, T_NUM, "k", "Number of test runs, default: 3", false, false}};
+
+    if (!parse_options(argcp, argvp, options, sizeof(options) / sizeof(parsing_ctx)))
+    {
+        print_usage(*argvp[0], options, sizeof(options) / sizeof(parsing_ctx));
+        exit(EXIT_SUCCESS);
+    }
+
+    if (int_role != 0 && int_role != 1)
+    {
+        cerr << "Role error!" << endl;
+        print_usage(*argvp[0], options, sizeof(options) / sizeof(parsing_ctx));
+        exit(EXIT_SUCCESS);
+    }
+    *role = (e_role)int_role;
+
+    if (int_port != 0)
+    {
+        if (int_port > INT16_MAX)
+        {
+            cerr << "Port error!" << endl;
+            print_usage(*argvp[0], options, sizeof(options) / sizeof(parsing_ctx));
+            exit(EXIT_SUCCESS);
+        }
+        *port = (uint16_t)int_port;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    e_role role = SERVER;
+    uint16_t port = 7766;
+    string address = "127.0.0.1";
+    uint32_t numBins = 1 << 20, numThreads = 0, numReps = 3;
+    read_options(&argc, &argv, &role, &address, &port, &numBins, &numThreads, &numReps);
+    if (numThreads > 0)
+        gThreadPool.SetNumThreads(numThreads);
+
+    gParty.printTickTime = false;
+    gParty.Init(address, port, role);
+    auto maxThreads = gParty.GetOPRFThreads();
+
+    vector<uint64_t> simpleTable(3 * numBins), cuckooTable(numBins);
+    vector<uint32_t> simpleOffsets(numBins + 1);
+    for (uint32_t i = 0; i < numBins; i++)
+    {
+        simpleOffsets[i + 1] = 3 * (i + 1);
+        cuckooTable[i] = gRNG.NextUInt64();
+    }
+    for (auto &x : simpleTable)
+        x = gRNG.NextUInt64();
+
+    cout << "Bins: " << numBins << endl;
+    double baseline = 0;
+    for (uint32_t t = 1;; t = min(2 * t, maxThreads))
+    {
+        gParty.SetOPRFThreads(t);
+        gParty.GetCommCostAndResetStats();
+        gParty.Tick("OPRF");
+        for (uint32_t k = 0; k < numReps; k++)
+        {
+            if (role == SERVER)
+                gParty.OPRFSend(simpleTable, simpleOffsets);
+            else
+                gParty.OPRFRecv(cuckooTable);
+        }
+        double seconds = gParty.Tick("OPRF") / 1000.0 / numReps;
+        double cost = gParty.GetCommCostAndResetStats() / 1024 / 1024.0 / numReps;
+        if (t == 1)
+            baseline = seconds;
+        cout << "Threads: " << t << ", time (s): " << seconds << ", bins/s: " << (uint64_t)(numBins / seconds)
+             << ", speedup: " << baseline / seconds << ", communication (MB): " << cost << endl;
+        if (t == maxThreads)
+            break;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,86 @@
+#include <cstdint>
+#include <vector>
+#include <iostream>
+#include <chrono>
+#include "../core/poly.h"
+#include "../core/RNG.h"
+
+using namespace std;
+using namespace SECYAN;
+
+// Time of the quadratic interpolate and of Interpolator for the mega-bin loads of the PSI,
+// with a third of the points being dummy points (about the share of dummy points in a mega-bin),
+// and time of evaluating a mega-bin polynomial at the bins of the mega-bin: Horner with the former
+// 31-bit split multiplication, poly_eval (one point at a time) and field_eval_batch (see field.h)
+
+// The multiplication used by poly.cpp before field.h, x, y < 2^62
+uint64_t SplitMul(uint64_t x, uint64_t y)
+{
+    uint64_t x1 = x >> 31, x2 = x & 0x7fffffff, y1 = y >> 31, y2 = y & 0x7fffffff;
+    uint64_t ans = x1 * y2 + x2 * y1;
+    ans = (ans >> 30) + ((ans & 0x3fffffff) << 31) + x1 * (y1 << 1) + x2 * y2;
+    return (ans >> 61) + (ans & poly_modulus);
+}
+
+uint64_t SplitMulHorner(const uint64_t *coeff, uint64_t x, int size)
+{
+    uint64_t acc = 0;
+    for (int i = size - 1; i >= 0; i--)
+        acc = SplitMul(acc, x) + coeff[i];
+    return acc >= poly_modulus ? acc - poly_modulus : acc;
+}
+
+template <typename F>
+double MicrosecondsPerCall(F func, int numReps)
+{
+    auto start = chrono::steady_clock::now();
+    for (int r = 0; r < numReps; r++)
+        func();
+    return chrono::duration<double, micro>(chrono::steady_clock::now() - start).count() / numReps;
+}
+
+int main()
+{
+    for (int size : {32, 64, 128, 256, 512, 778, 1024, 2048})
+    {
+        int numReal = size - size / 3;
+        vector<uint64_t> X(size), Y(size), expected(size), coeff(size);
+        for (int k = 0; k < size; k++)
+        {
+            X[k] = k < numReal ? gRNG.NextUInt64() & poly_modulus : poly_modulus - k;
+            Y[k] = gRNG.NextUInt64() & poly_modulus;
+        }
+        Interpolator interpolator(size);
+        int numReps = max(1, 200000 / size / size * 10);
+        auto quadratic = MicrosecondsPerCall([&]() { interpolate(X.data(), Y.data(), size, expected.data()); }, numReps);
+        auto tree = MicrosecondsPerCall([&]() { interpolator.Interpolate(X.data(), Y.data(), numReal, coeff.data()); }, numReps);
+        bool same = true;
+        for (int i = 0; i < size; i++)
+            same = same && expected[i] % poly_modulus == coeff[i] % poly_modulus;
+        cout << "Load: " << size << ", interpolate (us): " << quadratic << ", Interpolator (us): " << tree
+             << ", speedup: " << quadratic / tree << (same ? "" : ", MISMATCH!") << endl;
+    }
+
+    const int numPoints = 32; // about the number of bins in a mega-bin
+    for (int size : {64, 256, 778, 1024})
+    {
+        vector<uint64_t> coeff(size), X(numPoints), expected(numPoints), values(numPoints);
+        for (auto &c : coeff)
+            c = gRNG.NextUInt64() % poly_modulus;
+        for (auto &x : X)
+            x = gRNG.NextUInt64() & poly_modulus;
+        int numReps = max(1, 20000000 / size / numPoints);
+        auto split = MicrosecondsPerCall([&]() {
+            for (int k = 0; k < numPoints; k++)
+                expected[k] = SplitMulHorner(coeff.data(), X[k], size);
+        }, numReps);
+        auto single = MicrosecondsPerCall([&]() {
+            for (int k = 0; k < numPoints; k++)
+                values[k] = poly_eval(coeff.data(), X[k], size);
+        }, numReps);
+        auto batch = MicrosecondsPerCall([&]() { field_eval_batch(coeff.data(), size, X.data(), numPoints, values.data()); }, numReps);
+        cout << "Load: " << size << ", " << numPoints << " points, split multiplication (us): " << split << ", poly_eval (us): " << single
+             << ", field_eval_batch (us): " << batch << ", speedup: " << split / batch << (values == expected ? "" : ", MISMATCH!") << endl;
+    }
+    return 0;
+}
@@ -0,0 +1,173 @@
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include "ENCRYPTO_utils/parse_options.h"
+#include "../core/party.h"
+#include "../core/PSI.h"
+#include "../core/RNG.h"
+#include "../core/relation.h"
+#include "../core/spill.h"
+
+using namespace std;
+using namespace SECYAN;
+
+// Time and communication of the PSI (OPRF and Intersect) with the polynomial and the OKVS backends (see psibackend.h),
+// for balanced set sizes and for skewed ones (one set 64 times larger than the other).
+// With -s 27 the balanced sizes scale up to 2^27 (about 134M) elements per set, the PSI supports up to 2^30 (2^31 - 1 bins).
+// With -m 1, semi-joins of small relations instead: comparing all pairs of rows (see Relation::SmallSemiJoin) against the PSI.
+
+void read_options(int32_t *argcp, char ***argvp, e_role *role, string *address, uint16_t *port, uint32_t *maxLogSize, uint32_t *numReps, uint32_t *mode)
+{
+    uint32_t int_role = 0, int_port = 0;
+
+    parsing_ctx options[] = {
+        {(void *)&int_role, T_NUM, "r", "Role: 0/1, default: 0 (SERVER)", true, false},
+        {(void *)address, T_STR, "a", "IP-address, default: 127.0.0.1", false, false},
+        {(void *)&int_port, T_NUM, "p", "Port (will use port & port+1), default: 7766", false, false},
+        {(void *)maxLogSize, T_NUM, "s", "Log2 of the largest set size (12 to 30), default: 20", false, false},
+        {(void *)numReps, T_NUM, "k", "Number of test runs, default: 3", false, false},
+        {(void *)mode, T_NUM, "m", "Mode: 0: PSI backends, 1: small semi-joins, default: 0", false, false}};
+
+    if (!parse_options(argcp, argvp, options, sizeof(options) / sizeof(parsing_ctx)))
+    {
+        print_usage(*argvp[0], options, sizeof(options) / sizeof(parsing_ctx));
+        exit(EXIT_SUCCESS);
+    }
+
+    if (int_role != 0 && int_role != 1)
+    {
+        cerr << "Role error!" << endl;
+        print_usage(*argvp[0], options, sizeof(options) / sizeof(parsing_ctx));
+        exit(EXIT_SUCCESS);
+    }
+    *role = (e_role)int_role;
+
+    if (int_port != 0)
+    {
+        if (int_port > INT16_MAX)
+        {
+            cerr << "Port error!" << endl;
+            print_usage(*argvp[0], options, sizeof(options) / sizeof(parsing_ctx));
+            exit(EXIT_SUCCESS);
+        }
+        *port = (uint16_t)int_port;
+    }
+}
+
+// A relation with one attribute, whose rows have the keys 0, step, 2 * step, ... and annotation 1 (only the owner reads them)
+Relation KeyRelation(e_role owner, const char *attrName, uint32_t numRows, uint32_t step)
+{
+    string path = gMemoryBudget.GetSpillDir() + "/psibench-" + attrName + ".tbl";
+    bool isOwner = gParty.GetRole() == owner;
+    if (isOwner)
+    {
+        ofstream out(path);
+        out << 2 << endl
+            << attrName << "|annot|" << endl;
+        for (uint32_t i = 0; i < numRows; i++)
+            out << i * step << "|1|" << endl;
+    }
+    Relation::RelationInfo ri = {owner, false, {attrName}, {Relation::INT}, 0, {}};
+    Relation relation(ri, {false, true});
+    relation.LoadData(path.c_str(), "annot");
+    if (isOwner)
+        remove(path.c_str());
+    return relation;
+}
+
+// Time and communication of semi-joins of small relations, comparing all pairs of rows and by the PSI (with the threshold
+// Relation::smallSemiJoinPairs at 0)
+void BenchSmallSemiJoins(uint32_t numReps)
+{
+    // (parent rows, child rows), half of the parent keys match a child key
+    vector<pair<uint32_t, uint32_t>> sizes = {{30, 30}, {30, 64}, {64, 64}, {16, 256}, {256, 16}};
+    for (auto &size : sizes)
+    {
+        auto parent = KeyRelation(SERVER, "p_key", size.first, 2);
+        auto child = KeyRelation(CLIENT, "c_key", size.second, 1);
+        auto smallSemiJoinPairs = Relation::smallSemiJoinPairs;
+        double seconds[2], cost[2];
+        for (int byPSI = 0; byPSI < 2; byPSI++)
+        {
+            Relation::smallSemiJoinPairs = byPSI ? 0 : UINT64_MAX;
+            gParty.GetCommCostAndResetStats();
+            gParty.Tick("Semi-join");
+            for (uint32_t k = 0; k < numReps; k++)
+            {
+                Relation result = parent, childCopy = child;
+                result.SemiJoin(childCopy, "p_key", "c_key");
+            }
+            seconds[byPSI] = gParty.Tick("Semi-join") / 1000.0 / numReps;
+            cost[byPSI] = gParty.GetCommCostAndResetStats() / 1024 / 1024.0 / numReps;
+        }
+        Relation::smallSemiJoinPairs = smallSemiJoinPairs;
+        cout << "Rows: " << size.first << ", " << size.second << ", all pairs time (s): " << seconds[0] << ", communication (MB): " << cost[0]
+             << ", PSI time (s): " << seconds[1] << ", communication (MB): " << cost[1]
+             << ", speedup: " << seconds[1] / seconds[0] << endl;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    e_role role = SERVER;
+    uint16_t port = 7766;
+    string address = "127.0.0.1";
+    uint32_t maxLogSize = 20, numReps = 3, mode = 0;
+    read_options(&argc, &argv, &role, &address, &port, &maxLogSize, &numReps, &mode);
+    // The largest balanced sets within the limits of the PSI (2^31 - 1 bins, see PSI::Fits), 2^30 elements
+    uint32_t maxSupportedLogSize = 12;
+    while (maxSupportedLogSize < 31 && PSI::Fits(1u << (maxSupportedLogSize + 1), 1u << (maxSupportedLogSize + 1)))
+        maxSupportedLogSize++;
+    if (maxLogSize < 12 || maxLogSize > maxSupportedLogSize)
+    {
+        cerr << "Error: set size must be between 2^12 and 2^" << maxSupportedLogSize << "!" << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    gParty.printTickTime = false;
+    gParty.Init(address, port, role);
+    if (mode == 1)
+    {
+        BenchSmallSemiJoins(numReps);
+        return EXIT_SUCCESS;
+    }
+
+    // (Alice's set size, Bob's set size)
+    vector<pair<uint32_t, uint32_t>> sizes;
+    for (uint32_t logSize = 12; logSize < maxLogSize; logSize += 4)
+        sizes.push_back({1 << logSize, 1 << logSize});
+    sizes.push_back({1 << maxLogSize, 1 << maxLogSize});
+    sizes.push_back({1 << (maxLogSize - 6), 1 << maxLogSize});
+    sizes.push_back({1 << maxLogSize, 1 << (maxLogSize - 6)});
+
+    for (auto &size : sizes)
+    {
+        // Half of the smaller set is in the intersection
+        uint32_t M = size.first, N = size.second;
+        vector<uint64_t> set(role == SERVER ? M : N);
+        for (uint32_t i = 0; i < set.size(); i++)
+            set[i] = role == SERVER ? 2 * i : 3 * i;
+        double seconds[2], cost[2];
+        for (auto backend : {PSI::Polynomial, PSI::OKVS})
+        {
+            gParty.GetCommCostAndResetStats();
+            gParty.Tick("PSI");
+            for (uint32_t k = 0; k < numReps; k++)
+            {
+                PSI psi(set, M, N, role == SERVER ? PSI::Alice : PSI::Bob, 0, backend);
+                psi.Intersect();
+            }
+            seconds[backend] = gParty.Tick("PSI") / 1000.0 / numReps;
+            cost[backend] = gParty.GetCommCostAndResetStats() / 1024 / 1024.0 / numReps;
+        }
+        cout << "Sizes: " << M << ", " << N << ", polynomial time (s): " << seconds[PSI::Polynomial] << ", communication (MB): " << cost[PSI::Polynomial]
+             << ", OKVS time (s): " << seconds[PSI::OKVS] << ", communication (MB): " << cost[PSI::OKVS]
+             << ", speedup: " << seconds[PSI::Polynomial] / seconds[PSI::OKVS]
+             << ", OKVS elements/s: " << (uint64_t)(max(M, N) / seconds[PSI::OKVS]) << endl;
+    }
+
+    return EXIT_SUCCESS;
+}
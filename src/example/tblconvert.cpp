@@ -0,0 +1,177 @@
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <numeric>
+#include <algorithm>
+#include <memory>
+#include "ENCRYPTO_utils/parse_options.h"
+#include "../core/tblfile.h"
+#include "../core/snapshot.h"
+#include "../core/dictionary.h"
+#include "../core/threadpool.h"
+
+using namespace std;
+using namespace SECYAN;
+
+// Convert a pipe-delimited data file (see relation.h) to a binary columnar snapshot (see snapshot.h)
+// Column types are detected from the data unless given by -t, columns whose names contain "annot" are annotations
+
+const char *typeNames[] = {"int", "decimal", "date", "string", "annot"};
+
+vector<string> Split(const string &s)
+{
+    vector<string> ret;
+    size_t begin = 0;
+    while (begin < s.size())
+    {
+        auto end = s.find(',', begin);
+        if (end == string::npos)
+            end = s.size();
+        if (end > begin)
+            ret.push_back(s.substr(begin, end - begin));
+        begin = end + 1;
+    }
+    return ret;
+}
+
+void read_options(int32_t *argcp, char ***argvp, string *input, string *output, string *sortBy, string *typeSpec, uint32_t *numThreads)
+{
+    parsing_ctx options[] = {
+        {(void *)input, T_STR, "i", "Input data file (.tbl)", true, false},
+        {(void *)output, T_STR, "o", "Output snapshot file, default: the input file with extension .snap", false, false},
+        {(void *)sortBy, T_STR, "s", "Sort the rows by these columns, e.g. o_custkey,o_orderkey", false, false},
+        {(void *)typeSpec, T_STR, "t", "Column types overriding the detected ones, e.g. o_year:int,c_name:string", false, false},
+        {(void *)numThreads, T_NUM, "n", "Number of threads, default: all hardware threads", false, false}};
+
+    if (!parse_options(argcp, argvp, options, sizeof(options) / sizeof(parsing_ctx)))
+    {
+        print_usage(*argvp[0], options, sizeof(options) / sizeof(parsing_ctx));
+        exit(EXIT_SUCCESS);
+    }
+    if (output->empty())
+    {
+        auto dot = input->rfind('.');
+        auto slash = input->rfind('/');
+        if (dot == string::npos || (slash != string::npos && dot < slash))
+            dot = input->size();
+        *output = input->substr(0, dot) + ".snap";
+    }
+}
+
+int main(int argc, char **argv)
+{
+    string input, output, sortBy, typeSpec;
+    uint32_t numThreads = 0;
+    read_options(&argc, &argv, &input, &output, &sortBy, &typeSpec, &numThreads);
+    if (numThreads > 0)
+        gThreadPool.SetNumThreads(numThreads);
+
+    TblFile file(input.c_str());
+    auto &names = file.ColumnNames();
+    auto numColumns = names.size();
+    auto numRows = file.NumRows();
+
+    vector<TblFile::FieldType> types(numColumns);
+    vector<bool> typeGiven(numColumns, false);
+    for (auto &spec : Split(typeSpec))
+    {
+        auto colon = spec.find(':');
+        int col = colon == string::npos ? -1 : file.FindColumn(spec.substr(0, colon));
+        auto typeName = colon == string::npos ? "" : spec.substr(colon + 1);
+        auto type = find(begin(typeNames), end(typeNames), typeName) - begin(typeNames);
+        if (col < 0 || type == end(typeNames) - begin(typeNames))
+        {
+            cerr << "Type error: " << spec << "!" << endl;
+            exit(1);
+        }
+        types[col] = (TblFile::FieldType)type;
+        typeGiven[col] = true;
+    }
+    for (size_t j = 0; j < numColumns; j++)
+        if (!typeGiven[j])
+            types[j] = names[j].find("annot") != string::npos ? TblFile::ANNOT : file.GuessType(j);
+
+    vector<vector<uint64_t>> values(numColumns);
+    vector<vector<uint32_t>> annots(numColumns);
+    vector<shared_ptr<const Dictionary>> dictionaries(numColumns);
+    vector<TblFile::Field> fields;
+    for (size_t j = 0; j < numColumns; j++)
+    {
+        if (types[j] == TblFile::ANNOT)
+        {
+            annots[j].resize(numRows);
+            fields.push_back({(int)j, types[j], annots[j].data()});
+        }
+        else
+        {
+            values[j].resize(numRows);
+            fields.push_back({(int)j, types[j], values[j].data()});
+            if (types[j] == TblFile::STRING)
+            {
+                dictionaries[j] = file.BuildDictionary(j, numRows);
+                fields.back().dictionary = dictionaries[j].get();
+            }
+        }
+    }
+    file.Parse(fields, numRows);
+
+    vector<uint32_t> sortColumns;
+    for (auto &name : Split(sortBy))
+    {
+        int col = file.FindColumn(name);
+        if (col < 0 || types[col] == TblFile::ANNOT)
+        {
+            cerr << "Sort column error: " << name << "!" << endl;
+            exit(1);
+        }
+        sortColumns.push_back(col);
+    }
+    if (!sortColumns.empty())
+    {
+        // the same order as Relation::Sort, ties keep the file order
+        vector<uint32_t> indices(numRows);
+        iota(indices.begin(), indices.end(), 0);
+        stable_sort(indices.begin(), indices.end(), [&](uint32_t a, uint32_t b) {
+            for (auto col : sortColumns)
+                if (values[col][a] != values[col][b])
+                    return values[col][a] < values[col][b];
+            return false;
+        });
+        gThreadPool.ParallelFor(numColumns, [&](size_t j) {
+            if (types[j] == TblFile::ANNOT)
+            {
+                vector<uint32_t> sorted(numRows);
+                for (size_t i = 0; i < numRows; i++)
+                    sorted[i] = annots[j][indices[i]];
+                annots[j].swap(sorted);
+            }
+            else
+            {
+                vector<uint64_t> sorted(numRows);
+                for (size_t i = 0; i < numRows; i++)
+                    sorted[i] = values[j][indices[i]];
+                values[j].swap(sorted);
+            }
+        });
+    }
+
+    vector<const void *> data(numColumns);
+    vector<const Dictionary *> dictionaryPtrs(numColumns);
+    for (size_t j = 0; j < numColumns; j++)
+    {
+        data[j] = types[j] == TblFile::ANNOT ? (const void *)annots[j].data() : (const void *)values[j].data();
+        dictionaryPtrs[j] = dictionaries[j].get();
+    }
+    Snapshot::Write(output.c_str(), names, types, data, dictionaryPtrs, numRows, sortColumns);
+
+    cout << output << ": " << numRows << " rows" << endl;
+    for (size_t j = 0; j < numColumns; j++)
+    {
+        cout << "  " << names[j] << ": " << typeNames[types[j]];
+        if (dictionaries[j])
+            cout << " (" << dictionaries[j]->Size() << " distinct values)";
+        cout << endl;
+    }
+    return 0;
+}
@@ -0,0 +1,65 @@
+#include <cstdint>
+#include <vector>
+#include <iostream>
+#include <chrono>
+#include <algorithm>
+#include "../core/waksman.h"
+#include "../core/threadpool.h"
+#include "../core/RNG.h"
+
+using namespace std;
+using namespace SECYAN;
+
+// Local time of a Waksman network of the OEP (see OEP.cpp) with 1, 2, 4, ... threads:
+// routing a random permutation (the permutor) and evaluating the network with blinders layer by layer (the permutor, see EvaluateLayer)
+
+template <typename F>
+double Milliseconds(F func)
+{
+    auto start = chrono::steady_clock::now();
+    func();
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+int main()
+{
+    auto maxThreads = gThreadPool.GetNumThreads();
+    for (uint32_t size : {1 << 16, 1 << 20, 1 << 22})
+    {
+        vector<uint32_t> indices(size), values(size);
+        for (uint32_t i = 0; i < size; i++)
+            indices[i] = i;
+        shuffle(indices.begin(), indices.end(), gRNG.stdrng);
+        for (auto &v : values)
+            v = gRNG.NextUInt32();
+        WaksmanNetwork network(size, 2);
+        uint32_t gateNum = network.GateNum();
+        vector<uint32_t> bits(gateNum);
+        uint32_t *upper = network.GateArray(0), *lower = network.GateArray(1);
+        for (uint32_t i = 0; i < gateNum; i++)
+        {
+            upper[i] = gRNG.NextUInt32();
+            lower[i] = gRNG.NextUInt32();
+        }
+
+        double baseline = 0;
+        for (uint32_t t = 1;; t = min(2 * t, maxThreads))
+        {
+            gThreadPool.SetNumThreads(t);
+            auto route = Milliseconds([&]() { network.GenSelectionBits(indices.data(), bits.data()); });
+            auto evaluate = Milliseconds([&]() {
+                network.Run(values.data(), [&](uint32_t firstGate, uint32_t n, const uint32_t *in0, const uint32_t *in1, uint32_t *out0, uint32_t *out1) {
+                    EvaluateLayer(bits.data(), upper, lower, firstGate, n, in0, in1, out0, out1);
+                });
+            });
+            if (t == 1)
+                baseline = route + evaluate;
+            cout << "Size: " << size << ", threads: " << t << ", routing (ms): " << route << ", evaluation (ms): " << evaluate
+                 << ", speedup: " << baseline / (route + evaluate) << endl;
+            if (t == maxThreads)
+                break;
+        }
+        gThreadPool.SetNumThreads(maxThreads);
+    }
+    return 0;
+}
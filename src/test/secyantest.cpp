@@ -3,14 +3,25 @@
 #include <vector>
 #include <string>
 #include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <numeric>
 #include <stdlib.h>
+#include <stdio.h>
 #include <time.h>
 
 #include "../core/OEP.h"
+#include "../core/waksman.h"
+#include "../core/threadpool.h"
 #include "../core/relation.h"
 #include "../core/PSI.h"
 #include "../core/party.h"
 #include "../core/RNG.h"
+#include "../core/columnstore.h"
+#include "../core/spill.h"
+#include "../core/tblfile.h"
+#include "../core/snapshot.h"
+#include "../core/tupleindex.h"
 
 using namespace std;
 using namespace SECYAN;
@@ -91,8 +102,128 @@ void test_oep(int M, int N)
 	delete[] real_out;
 }
 
+// A random permutation of [0, size), drawn alike on both parties
+vector<uint32_t> random_permutation(uint32_t size)
+{
+	vector<uint32_t> permutation(size);
+	iota(permutation.begin(), permutation.end(), 0);
+	for (uint32_t i = 1; i < size; i++)
+		swap(permutation[i], permutation[rand() % (i + 1)]);
+	return permutation;
+}
+
+// Route values through the Waksman network of a permutation in plain (a gate swaps its values if its selection bit is 1),
+// return the selection bits
+vector<uint32_t> waksman_route(const vector<uint32_t> &permutation, vector<uint32_t> &values)
+{
+	WaksmanNetwork network(permutation.size());
+	vector<uint32_t> bits(network.GateNum());
+	network.GenSelectionBits(permutation.data(), bits.data());
+	network.Run(values.data(), [&](uint32_t firstGate, uint32_t n, const uint32_t *in0, const uint32_t *in1, uint32_t *out0, uint32_t *out1) {
+		for (uint32_t j = 0; j < n; j++)
+		{
+			uint32_t value0 = in0[j], value1 = in1[j]; // the outputs may be the inputs
+			out0[j] = bits[firstGate + j] ? value1 : value0;
+			out1[j] = bits[firstGate + j] ? value0 : value1;
+		}
+	});
+	return bits;
+}
+
+// The network routes input permutation[i] to output i
+void test_waksman(uint32_t size)
+{
+	auto permutation = random_permutation(size);
+	vector<uint32_t> values(size);
+	iota(values.begin(), values.end(), 0);
+	waksman_route(permutation, values);
+	if (values != permutation)
+	{
+		cerr << "Waksman network test fail when size=" << size << endl;
+		exit(EXIT_FAILURE);
+	}
+}
+
+// The selection bits and the outputs of a network are the same on one thread and on several threads (which split the
+// subnetworks of a level, or the gates of a large subnetwork)
+void test_waksman_threads(uint32_t size, uint32_t numThreads)
+{
+	auto permutation = random_permutation(size);
+	vector<uint32_t> serialValues(size), parallelValues(size);
+	for (uint32_t i = 0; i < size; i++)
+		serialValues[i] = parallelValues[i] = rand();
+	auto maxThreads = gThreadPool.GetNumThreads();
+	gThreadPool.SetNumThreads(1);
+	auto serialBits = waksman_route(permutation, serialValues);
+	gThreadPool.SetNumThreads(numThreads);
+	auto parallelBits = waksman_route(permutation, parallelValues);
+	gThreadPool.SetNumThreads(maxThreads);
+	if (serialBits != parallelBits || serialValues != parallelValues)
+	{
+		cerr << "Parallel Waksman network test fail when size=" << size << " and numThreads=" << numThreads << endl;
+		exit(EXIT_FAILURE);
+	}
+}
+
+// The layer functions of the OEP (with AVX2 if available) in plain: after the OTs (the permutor gets the message of its
+// selection bit) the labels of the sender and the values of the permutor add up to the permuted sums of their inputs
+void test_waksman_layers(uint32_t size)
+{
+	auto permutation = random_permutation(size);
+	WaksmanNetwork sender(size, 2), permutor(size, 2);
+	uint32_t gateNum = sender.GateNum();
+	uint32_t *output1 = sender.GateArray(0), *output2 = sender.GateArray(1);
+	for (uint32_t g = 0; g < gateNum; g++)
+	{
+		output1[g] = rand();
+		output2[g] = rand();
+	}
+	vector<uint32_t> senderValues(size), permutorValues(size), expected(size);
+	for (uint32_t i = 0; i < size; i++)
+	{
+		senderValues[i] = rand();
+		permutorValues[i] = rand();
+	}
+	for (uint32_t i = 0; i < size; i++)
+		expected[i] = senderValues[permutation[i]] + permutorValues[permutation[i]];
+
+	vector<uint64_t> msg0(gateNum), msg1(gateNum);
+	sender.Run(senderValues.data(), [&](uint32_t firstGate, uint32_t n, const uint32_t *in0, const uint32_t *in1, uint32_t *out0, uint32_t *out1) {
+		WriteLayerLabels(output1, output2, msg0.data(), msg1.data(), firstGate, n, in0, in1, out0, out1);
+	});
+	vector<uint32_t> bits(gateNum);
+	permutor.GenSelectionBits(permutation.data(), bits.data());
+	uint32_t *upper = permutor.GateArray(0), *lower = permutor.GateArray(1);
+	for (uint32_t g = 0; g < gateNum; g++)
+	{
+		auto msg = bits[g] ? msg1[g] : msg0[g];
+		upper[g] = msg >> 32;
+		lower[g] = (uint32_t)msg;
+	}
+	permutor.Run(permutorValues.data(), [&](uint32_t firstGate, uint32_t n, const uint32_t *in0, const uint32_t *in1, uint32_t *out0, uint32_t *out1) {
+		EvaluateLayer(bits.data(), upper, lower, firstGate, n, in0, in1, out0, out1);
+	});
+	for (uint32_t i = 0; i < size; i++)
+		if (senderValues[i] + permutorValues[i] != expected[i])
+		{
+			cerr << "Waksman layer test fail when size=" << size << endl;
+			exit(EXIT_FAILURE);
+		}
+}
+
 void test_oeps()
 {
+	for (uint32_t size = 1; size <= 70; size++)
+	{
+		test_waksman(size);
+		test_waksman_layers(size);
+	}
+	test_waksman(1000);
+	test_waksman(4099);
+	test_waksman_layers(1000);
+	test_waksman_threads(1000, 3);
+	test_waksman_threads(50000, 3);
+	test_waksman_threads(50000, 8);
 	test_op(10);
 	test_op(200);
 	test_op(3000);
@@ -102,6 +233,65 @@ void test_oeps()
 	cout << "All OP and OEP tests passed!" << endl;
 }
 
+// n OTs from sender to the other party, with messages and selection bits drawn alike on both parties
+// Return false if the receiver does not get the messages of its selection bits
+bool check_ot(e_role sender, size_t n)
+{
+	vector<uint64_t> msg0(n), msg1(n);
+	vector<uint32_t> bits(n);
+	for (size_t i = 0; i < n; i++)
+	{
+		msg0[i] = (uint64_t)rand() << 32 | rand();
+		msg1[i] = (uint64_t)rand() << 32 | rand();
+		bits[i] = rand() % 2;
+	}
+	if (gParty.GetRole() == sender)
+	{
+		gParty.OTSend(msg0, msg1);
+		return true;
+	}
+	auto msg = gParty.OTRecv(bits);
+	for (size_t i = 0; i < n; i++)
+		if (msg[i] != (bits[i] ? msg1[i] : msg0[i]))
+			return false;
+	return true;
+}
+
+// The pooled OTs (see Party::Preprocess) give the same messages as the OT extension, which takes over while the pool is
+// short of OTs for a call, and the OEP takes its OTs from the pool
+void test_ot_pool()
+{
+	auto role = gParty.GetRole();
+	bool pass = gParty.PooledSendOTs() == 0 && gParty.PooledRecvOTs() == 0;
+	pass &= check_ot(SERVER, 300);
+	pass &= check_ot(CLIENT, 300);
+	gParty.Preprocess(1000);
+	pass &= gParty.PooledSendOTs() == 1000 && gParty.PooledRecvOTs() == 1000;
+	pass &= check_ot(SERVER, 600);
+	pass &= check_ot(CLIENT, 600);
+	pass &= gParty.PooledSendOTs() == 400 && gParty.PooledRecvOTs() == 400;
+	// The pool of the server's OTs is short, the client's OTs take 300 of the 400 left
+	pass &= check_ot(SERVER, 600);
+	pass &= check_ot(CLIENT, 300);
+	pass &= gParty.PooledSendOTs() == (role == SERVER ? 400 : 100) && gParty.PooledRecvOTs() == (role == SERVER ? 100 : 400);
+	gParty.Preprocess(1000);
+	pass &= gParty.PooledSendOTs() == 1000 && gParty.PooledRecvOTs() == 1000;
+	// The client is the sender of test_op
+	test_op(100);
+	pass &= (role == CLIENT ? gParty.PooledSendOTs() : gParty.PooledRecvOTs()) == 1000 - ComputeGateNum(100);
+	if (!pass)
+	{
+		cerr << "OT pool test fail" << endl;
+		exit(EXIT_FAILURE);
+	}
+}
+
+void test_ots()
+{
+	test_ot_pool();
+	cout << "All OT tests passed!" << endl;
+}
+
 void test_one_relation(Relation &r, vector<string> &projectAttrNames)
 {
 	cout << "Original relation: " << endl;
@@ -141,6 +331,462 @@ void test_semi_join(Relation &p, Relation &c, vector<string> pAttrs, vector<stri
 	p.Print();
 }
 
+// Write a data file with one attribute and an annotation column "annot"
+void write_tbl(const string &path, const string &attrName, const vector<vector<uint32_t>> &rows)
+{
+	ofstream out(path);
+	out << 2 << endl
+		<< attrName << "|annot|" << endl;
+	for (auto &row : rows)
+		out << row[0] << "|" << row[1] << "|" << endl;
+}
+
+// Draw the data of a semi-join test alike on both parties: the parent rows have random keys, the child rows have the
+// distinct keys 3i
+void draw_semi_join_data(int parentRows, int childRows, uint32_t childAnnotRange, vector<vector<uint32_t>> &parentData, vector<vector<uint32_t>> &childData)
+{
+	parentData.resize(parentRows);
+	childData.resize(childRows);
+	for (auto &row : parentData)
+		row = {(uint32_t)(rand() % (4 * childRows)), (uint32_t)(rand() % 5)};
+	for (int i = 0; i < childRows; i++)
+		childData[i] = {(uint32_t)(3 * i), (uint32_t)(rand() % childAnnotRange)};
+}
+
+// Load a relation with one attribute from the data (only its owner reads it)
+Relation load_relation(e_role owner, const string &attrName, const vector<vector<uint32_t>> &data, Relation::AnnotInfo ai)
+{
+	string path = gMemoryBudget.GetSpillDir() + "/secyan-test-" + attrName + ".tbl";
+	bool isOwner = gParty.GetRole() == owner;
+	if (isOwner)
+		write_tbl(path, attrName, data);
+	Relation::RelationInfo ri = {owner, false, {attrName}, {Relation::INT}, 0, {}};
+	Relation relation(ri, ai);
+	relation.LoadData(path.c_str(), "annot");
+	if (isOwner)
+		remove(path.c_str());
+	return relation;
+}
+
+// Reveal the annotations of the parent (owned by SERVER) and compare them with the semi-join in plain
+bool check_semi_join(Relation &parent, const vector<vector<uint32_t>> &parentData, const vector<vector<uint32_t>> &childData)
+{
+	parent.RevealAnnotToOwner();
+	if (gParty.GetRole() != SERVER)
+		return true;
+	for (size_t i = 0; i < parentData.size(); i++)
+	{
+		auto key = parentData[i][0];
+		uint32_t expected = key % 3 == 0 && key / 3 < childData.size() ? parentData[i][1] * childData[key / 3][1] : 0;
+		if (parent.GetAnnot()[i] != expected)
+			return false;
+	}
+	return true;
+}
+
+// The same semi-join without and with a tiny memory budget of the SERVER only, which splits it into partitions
+void test_partitioned_semi_join(int parentRows, int childRows, bool sharedChildAnnot)
+{
+	vector<vector<uint32_t>> parentData, childData;
+	draw_semi_join_data(parentRows, childRows, 7, parentData, childData);
+	auto parent = load_relation(SERVER, "p_key", parentData, {false, true});
+	auto child = load_relation(CLIENT, "c_key", childData, {false, !sharedChildAnnot});
+
+	Relation unpartitioned = parent, partitioned = parent;
+	Relation child_copy = child;
+	unpartitioned.SemiJoin(child_copy, "p_key", "c_key");
+	if (gParty.GetRole() == SERVER)
+		gMemoryBudget.SetLimit(1 << 20);
+	child_copy = child;
+	partitioned.SemiJoin(child_copy, "p_key", "c_key");
+	gMemoryBudget.SetLimit(0);
+	if (!check_semi_join(unpartitioned, parentData, childData) || !check_semi_join(partitioned, parentData, childData))
+	{
+		cerr << "Partitioned semi-join test fail when parentRows=" << parentRows << " and childRows=" << childRows << endl;
+		exit(EXIT_FAILURE);
+	}
+}
+
+// A semi-join that compares all pairs of rows (see Relation::SmallSemiJoin), and the same semi-join by the PSI if it can run
+void test_small_semi_join(int parentRows, int childRows, bool booleanChildAnnot, bool sharedChildAnnot)
+{
+	vector<vector<uint32_t>> parentData, childData;
+	draw_semi_join_data(parentRows, childRows, booleanChildAnnot ? 2 : 7, parentData, childData);
+	auto parent = load_relation(SERVER, "p_key", parentData, {false, true});
+	auto child = load_relation(CLIENT, "c_key", childData, {booleanChildAnnot, !sharedChildAnnot});
+
+	Relation small = parent, child_copy = child;
+	small.SemiJoin(child_copy, "p_key", "c_key");
+	bool pass = check_semi_join(small, parentData, childData);
+	if (max(parentRows, childRows) >= (int)PSI::minSetSize)
+	{
+		auto smallSemiJoinPairs = Relation::smallSemiJoinPairs;
+		Relation::smallSemiJoinPairs = 0;
+		Relation bypsi = parent;
+		child_copy = child;
+		bypsi.SemiJoin(child_copy, "p_key", "c_key");
+		Relation::smallSemiJoinPairs = smallSemiJoinPairs;
+		pass &= check_semi_join(bypsi, parentData, childData);
+	}
+	if (!pass)
+	{
+		cerr << "Small semi-join test fail when parentRows=" << parentRows << " and childRows=" << childRows << endl;
+		exit(EXIT_FAILURE);
+	}
+}
+
+void test_small_semi_joins()
+{
+	vector<int> sizes = {1, 2, 5, 16, 29, 30, 64};
+	for (auto parentRows : sizes)
+		for (auto childRows : sizes)
+		{
+			test_small_semi_join(parentRows, childRows, false, false);
+			test_small_semi_join(parentRows, childRows, false, true);
+			test_small_semi_join(parentRows, childRows, true, true);
+		}
+	cout << "All small semi-join tests passed!" << endl;
+}
+
+// The external merge sort (several runs) orders the rows as SortIndices
+void test_external_sort(size_t numRows, size_t runRows)
+{
+	ColumnStore store(2, numRows);
+	auto column0 = store.MutableColumn(0), column1 = store.MutableColumn(1);
+	for (size_t i = 0; i < numRows; i++)
+	{
+		column0[i] = rand() % 100;
+		column1[i] = rand();
+	}
+	for (size_t i = 0; i < numRows; i++)
+		if (rand() % 10 == 0)
+			store.ToDummy(i);
+	auto sorted = store.SortIndices(0, numRows);
+	ColumnStore externalSorted = store;
+	auto permutation = externalSorted.ExternalSort(runRows);
+	for (size_t k = 0; k < numRows; k++)
+	{
+		size_t i = sorted[k], j = permutation[k];
+		bool fail = store.IsDummy(i) != store.IsDummy(j) || externalSorted.IsDummy(k) != store.IsDummy(j);
+		if (!fail && !store.IsDummy(j))
+			for (size_t c = 0; c < 2; c++)
+				fail |= store.Get(i, c) != store.Get(j, c) || externalSorted.Get(k, c) != store.Get(j, c);
+		if (fail)
+		{
+			cerr << "External sort test fail when numRows=" << numRows << " and runRows=" << runRows << endl;
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+void test_spills()
+{
+	test_external_sort(10000, 10000);
+	test_external_sort(10000, 999);
+	test_external_sort(10000, 1);
+	test_partitioned_semi_join(20000, 12000, false);
+	test_partitioned_semi_join(20000, 12000, true);
+	cout << "All spill tests passed!" << endl;
+}
+
+// SortIndices (the radix sort, or std::stable_sort for few rows) orders the rows [begin, numRows) as std::stable_sort,
+// except the dummy rows, which may be in any order after the others if dummiesLast
+void test_sort_indices(size_t numRows, size_t begin, bool dummiesLast)
+{
+	ColumnStore store(2, numRows);
+	auto column0 = store.MutableColumn(0), column1 = store.MutableColumn(1);
+	for (size_t i = 0; i < numRows; i++)
+	{
+		column0[i] = rand() % 8;
+		column1[i] = (uint64_t)rand() << 40 ^ rand();
+	}
+	store.AddColumn(5);
+	for (size_t i = 0; i < numRows; i++)
+		if (rand() % 10 == 0)
+			store.ToDummy(i);
+	auto sorted = store.SortIndices(begin, numRows, dummiesLast);
+	vector<uint32_t> expected(numRows - begin);
+	for (size_t i = begin; i < numRows; i++)
+		expected[i - begin] = i;
+	stable_sort(expected.begin(), expected.end(), [&](uint32_t i, uint32_t j) {
+		if (dummiesLast && (store.IsDummy(i) || store.IsDummy(j)))
+			return !store.IsDummy(i);
+		if (column0[i] != column0[j])
+			return column0[i] < column0[j];
+		return column1[i] < column1[j];
+	});
+	if (dummiesLast)
+	{
+		auto firstDummy = sorted.begin() + (find_if(expected.begin(), expected.end(), [&](uint32_t i) { return store.IsDummy(i); }) - expected.begin());
+		sort(firstDummy, sorted.end());
+	}
+	if (sorted != expected)
+	{
+		cerr << "Sort indices test fail when numRows=" << numRows << " and begin=" << begin << endl;
+		exit(EXIT_FAILURE);
+	}
+}
+
+// A store of a STRING column (strings[i] for row i, coded by the dictionary) and an INT column
+ColumnStore string_store(shared_ptr<const Dictionary> dictionary, const vector<string> &strings, const vector<uint64_t> &ints)
+{
+	ColumnStore store(2, strings.size());
+	auto codes = store.MutableColumn(0), column1 = store.MutableColumn(1);
+	for (size_t i = 0; i < strings.size(); i++)
+	{
+		codes[i] = dictionary->Find(strings[i].data(), strings[i].size());
+		column1[i] = ints[i];
+	}
+	store.SetDictionary(0, dictionary);
+	return store;
+}
+
+// The strings of the rows survive appending a store with the same dictionary and one with another dictionary, shrinking
+// the dictionary and serializing it, and the codes sort like the strings
+void test_dictionary(size_t numRows)
+{
+	vector<string> strings(3 * numRows);
+	vector<uint64_t> ints(3 * numRows);
+	for (size_t i = 0; i < 3 * numRows; i++)
+	{
+		// the second part takes strings of the first part, the strings of the third part overlap them
+		if (i < numRows || i >= 2 * numRows)
+			strings[i] = "string " + to_string(rand() % 300 + (i < numRows ? 0 : 150)) + string(rand() % 20, '~');
+		else
+			strings[i] = strings[rand() % numRows];
+		ints[i] = rand();
+	}
+	auto stringPart = [&](size_t k) { return vector<string>(strings.begin() + k * numRows, strings.begin() + (k + 1) * numRows); };
+	auto intPart = [&](size_t k) { return vector<uint64_t>(ints.begin() + k * numRows, ints.begin() + (k + 1) * numRows); };
+	auto dictionary = make_shared<const Dictionary>(stringPart(0));
+	auto store = string_store(dictionary, stringPart(0), intPart(0));
+	store.Append(string_store(dictionary, stringPart(1), intPart(1)));
+	store.Append(string_store(make_shared<const Dictionary>(stringPart(2)), stringPart(2), intPart(2)));
+	for (size_t i = 0; i < 3 * numRows; i++)
+		if (rand() % 3 == 0)
+			store.ToDummy(i);
+	store.ShrinkDictionaries();
+	auto shrunk = store.GetDictionary(0);
+	vector<string> used;
+	for (size_t i = 0; i < 3 * numRows; i++)
+		if (!store.IsDummy(i))
+			used.push_back(strings[i]);
+	sort(used.begin(), used.end());
+	bool pass = store.NumRows() == 3 * numRows && shrunk->Size() == (size_t)(unique(used.begin(), used.end()) - used.begin());
+	for (size_t i = 0; i < 3 * numRows; i++)
+		if (!store.IsDummy(i))
+			pass &= shrunk->Get(store.Get(i, 0)) == strings[i] && store.Get(i, 1) == ints[i];
+	auto serialized = shrunk->Serialize();
+	Dictionary restored(serialized.data(), serialized.size());
+	pass &= restored.Size() == shrunk->Size();
+	for (uint64_t code = 0; pass && code < shrunk->Size(); code++)
+		pass &= restored.Get(code) == shrunk->Get(code) && restored.Hash(code) == shrunk->Hash(code);
+	auto sorted = store.SortIndices(0, 3 * numRows);
+	for (size_t k = 1; k < sorted.size() && !store.IsDummy(sorted[k]); k++)
+		pass &= strings[sorted[k - 1]] <= strings[sorted[k]];
+	if (!pass)
+	{
+		cerr << "Dictionary test fail when numRows=" << numRows << endl;
+		exit(EXIT_FAILURE);
+	}
+}
+
+void test_columns()
+{
+	for (size_t numRows : {100, 5000, 100000})
+	{
+		test_sort_indices(numRows, 0, true);
+		test_sort_indices(numRows, 0, false);
+		test_sort_indices(numRows, numRows / 3, true);
+	}
+	test_dictionary(100);
+	test_dictionary(3000);
+	cout << "All column store tests passed!" << endl;
+}
+
+// Write a data file with an attribute of each type and an annotation, return the values as the parser stores them
+// (except the strings) in values[0..2], the last row has no newline
+void write_typed_tbl(const string &path, size_t numRows, vector<vector<uint64_t>> &values, vector<string> &strings, vector<uint32_t> &annots)
+{
+	values.assign(3, vector<uint64_t>(numRows));
+	strings.resize(numRows);
+	annots.resize(numRows);
+	ofstream out(path);
+	out << 5 << endl
+		<< "t_int|t_decimal|t_date|t_string|t_annot|";
+	for (size_t i = 0; i < numRows; i++)
+	{
+		int intValue = rand() % 2000001 - 1000000, cents = rand() % 2000001 - 1000000;
+		uint32_t year = 1992 + rand() % 7, month = 1 + rand() % 12, day = 1 + rand() % 28;
+		strings[i] = "name#" + to_string(rand() % 1000) + (rand() % 2 ? " with spaces" : "");
+		annots[i] = rand();
+		values[0][i] = (uint64_t)intValue;
+		values[1][i] = (uint64_t)cents;
+		values[2][i] = year * 10000 + month * 100 + day;
+		char decimal[32], date[16];
+		snprintf(decimal, sizeof(decimal), "%s%d.%02d", cents < 0 ? "-" : "", abs(cents) / 100, abs(cents) % 100);
+		snprintf(date, sizeof(date), "%04u-%02u-%02u", year, month, day);
+		out << endl
+			<< intValue << "|" << decimal << "|" << date << "|" << strings[i] << "|" << annots[i] << "|";
+	}
+}
+
+// The path of a local test file, which differs between the parties
+string local_test_path(const string &name)
+{
+	return gMemoryBudget.GetSpillDir() + "/secyan-test-" + to_string(gParty.GetRole()) + "-" + name;
+}
+
+// The parser (in several chunks) detects the types and reads the values of a data file, also the first rows only and
+// chunk by chunk
+void test_tbl_file(size_t numRows)
+{
+	auto path = local_test_path("typed.tbl");
+	vector<vector<uint64_t>> values;
+	vector<string> strings;
+	vector<uint32_t> annots;
+	write_typed_tbl(path, numRows, values, strings, annots);
+	bool pass;
+	{
+		TblFile file(path.c_str());
+		vector<TblFile::FieldType> types = {TblFile::INT, TblFile::DECIMAL, TblFile::DATE, TblFile::STRING};
+		pass = file.NumRows() == numRows && file.ColumnNames().size() == 5 && file.FindColumn("t_string") == 3;
+		for (int j = 0; j < 4; j++)
+			pass &= file.GuessType(j) == types[j];
+		for (size_t prefixRows : {numRows, numRows / 2})
+		{
+			vector<vector<uint64_t>> parsed(4, vector<uint64_t>(prefixRows));
+			vector<uint32_t> parsedAnnots(prefixRows);
+			auto dictionary = file.BuildDictionary(3, prefixRows);
+			vector<TblFile::Field> fields;
+			for (int j = 0; j < 4; j++)
+				fields.push_back({j, types[j], parsed[j].data(), j == 3 ? dictionary.get() : nullptr});
+			fields.push_back({4, TblFile::ANNOT, parsedAnnots.data()});
+			file.Parse(fields, prefixRows);
+			for (size_t i = 0; i < prefixRows; i++)
+			{
+				for (int j = 0; j < 3; j++)
+					pass &= parsed[j][i] == values[j][i];
+				pass &= dictionary->Get(parsed[3][i]) == strings[i] && parsedAnnots[i] == annots[i];
+			}
+		}
+		vector<uint64_t> parsed(numRows);
+		for (size_t k = 0; k < file.NumChunks(); k++)
+			file.Parse({{0, TblFile::INT, parsed.data() + file.ChunkFirstRow(k)}}, numRows, k, k + 1);
+		pass &= file.NumChunks() > 1 && parsed == values[0];
+	}
+	remove(path.c_str());
+	if (!pass)
+	{
+		cerr << "Data file test fail when numRows=" << numRows << endl;
+		exit(EXIT_FAILURE);
+	}
+}
+
+// A snapshot written from the parsed columns of a data file (as by tblconvert) loads the same values
+void test_snapshot(size_t numRows)
+{
+	auto tblPath = local_test_path("typed.tbl"), snapPath = local_test_path("typed.snap");
+	vector<vector<uint64_t>> values;
+	vector<string> strings;
+	vector<uint32_t> annots;
+	write_typed_tbl(tblPath, numRows, values, strings, annots);
+	vector<TblFile::FieldType> types = {TblFile::INT, TblFile::DECIMAL, TblFile::DATE, TblFile::STRING, TblFile::ANNOT};
+	bool pass = !Snapshot::IsSnapshot(tblPath.c_str());
+	{
+		TblFile file(tblPath.c_str());
+		vector<vector<uint64_t>> parsed(4, vector<uint64_t>(numRows));
+		vector<uint32_t> parsedAnnots(numRows);
+		auto dictionary = file.BuildDictionary(3, numRows);
+		vector<TblFile::Field> fields;
+		for (int j = 0; j < 4; j++)
+			fields.push_back({j, types[j], parsed[j].data(), j == 3 ? dictionary.get() : nullptr});
+		fields.push_back({4, TblFile::ANNOT, parsedAnnots.data()});
+		file.Parse(fields, numRows);
+		Snapshot::Write(snapPath.c_str(), file.ColumnNames(), types, {parsed[0].data(), parsed[1].data(), parsed[2].data(), parsed[3].data(), parsedAnnots.data()},
+						{nullptr, nullptr, nullptr, dictionary.get(), nullptr}, numRows, {});
+	}
+	remove(tblPath.c_str());
+	{
+		pass &= Snapshot::IsSnapshot(snapPath.c_str());
+		Snapshot snapshot(snapPath.c_str());
+		pass &= snapshot.NumRows() == numRows && snapshot.FindColumn("t_annot") == 4 && snapshot.SortColumns().empty();
+		for (int j = 0; j < 5; j++)
+			pass &= snapshot.ColumnType(j) == types[j];
+		vector<Column> columns;
+		for (int j = 0; j < 4; j++)
+			columns.push_back(snapshot.GetColumn(j, numRows));
+		auto dictionary = snapshot.GetDictionary(3);
+		auto snapAnnots = snapshot.GetAnnot(4);
+		for (size_t i = 0; i < numRows; i++)
+		{
+			for (int j = 0; j < 3; j++)
+				pass &= columns[j][i] == values[j][i];
+			pass &= dictionary->Get(columns[3][i]) == strings[i] && snapAnnots[i] == annots[i];
+		}
+	}
+	remove(snapPath.c_str());
+	if (!pass)
+	{
+		cerr << "Snapshot test fail when numRows=" << numRows << endl;
+		exit(EXIT_FAILURE);
+	}
+}
+
+// The indexes persisted next to a data file are reused by another TupleIndex bound to it, and ignored once the file
+// changes or other rows are loaded
+void test_tuple_index(size_t numRows)
+{
+	auto path = local_test_path("indexed.tbl");
+	vector<vector<uint64_t>> values;
+	vector<string> strings;
+	vector<uint32_t> annots;
+	write_typed_tbl(path, numRows, values, strings, annots);
+	vector<uint32_t> permutation(numRows);
+	for (size_t i = 0; i < numRows; i++)
+		permutation[i] = numRows - 1 - i;
+	HashIndex hashIndex;
+	hashIndex.keys = {14131, 7766};
+	for (size_t i = 0; i < numRows; i++)
+		hashIndex.groups.push_back(i % 2);
+	vector<string> keys = {"t_int", "t_date"};
+	gPersistIndexes = true;
+	TupleIndex writer;
+	writer.Bind(path, numRows);
+	writer.AddSortPermutation(keys, permutation);
+	writer.AddHashIndex(keys, hashIndex);
+
+	TupleIndex reader, otherRows;
+	reader.Bind(path, numRows);
+	otherRows.Bind(path, numRows - 1);
+	auto sortIndex = reader.FindSortPermutation(keys);
+	auto readHashIndex = reader.FindHashIndex(keys);
+	bool pass = sortIndex && *sortIndex == permutation && readHashIndex && readHashIndex->keys == hashIndex.keys &&
+				readHashIndex->groups == hashIndex.groups && !reader.FindSortPermutation({"t_int"}) &&
+				!otherRows.FindSortPermutation(keys) && !otherRows.FindHashIndex(keys);
+	write_typed_tbl(path, numRows + 1, values, strings, annots);
+	TupleIndex stale;
+	stale.Bind(path, numRows);
+	pass &= !stale.FindSortPermutation(keys) && !stale.FindHashIndex(keys);
+	gPersistIndexes = false;
+	remove(path.c_str());
+	remove((path + ".sort.t_int,t_date.idx").c_str());
+	remove((path + ".hash.t_int,t_date.idx").c_str());
+	if (!pass)
+	{
+		cerr << "Tuple index test fail when numRows=" << numRows << endl;
+		exit(EXIT_FAILURE);
+	}
+}
+
+void test_data_files()
+{
+	test_tbl_file(50000);
+	test_snapshot(1000);
+	test_tuple_index(1000);
+	cout << "All data file tests passed!" << endl;
+}
+
 void test_join(Relation &p, Relation &c, vector<string> pAttrs, vector<string> cAttrs)
 {
 	cout << "Parent relation: " << endl;
@@ -174,7 +820,7 @@ void test_relations()
 		customer_attrs,
 		customer_attrtypes,
 		18,
-		true};
+		customer_attrs};
 	Relation::AnnotInfo customer_ai = {false, false};
 	Relation customer(customer_ri, customer_ai);
 	customer.LoadData("../../../data/small/customer.tbl", "q3_annot");
@@ -190,7 +836,7 @@ void test_relations()
 		orders_attrs,
 		orders_attrtypes,
 		48,
-		true};
+		orders_attrs};
 	Relation::AnnotInfo orders_ai = {false, false};
 	Relation orders(orders_ri, orders_ai);
 	orders.LoadData("../../../data/small/orders.tbl", "q3_annot");
@@ -207,7 +853,7 @@ void test_relations()
 	test_join(customer_copy, orders_copy, atc, ato);
 }
 
-void test_one_psi(int M, int N)
+void test_one_psi(int M, int N, PSI::Backend backend = PSI::Polynomial)
 {
 	auto role = gParty.GetRole();
 	auto bc = gParty.GetCircuit(S_BOOL);
@@ -219,9 +865,9 @@ void test_one_psi(int M, int N)
 		BobSet[i] = N - i;
 	PSI *psi;
 	if (role == SERVER)
-		psi = new PSI(AliceSet, M, N, PSI::Alice);
+		psi = new PSI(AliceSet, M, N, PSI::Alice, 0, backend);
 	else
-		psi = new PSI(BobSet, M, N, PSI::Bob);
+		psi = new PSI(BobSet, M, N, PSI::Bob, 0, backend);
 	auto out = psi->Intersect();
 	auto s_in = bc->PutSharedSIMDINGate(out.size(), out.data(), 1);
 	auto s_out = bc->PutOUTGate(s_in, ALL);
@@ -242,6 +888,42 @@ void test_one_psi(int M, int N)
 	delete psi;
 }
 
+void test_shared_psis(int M, int N)
+{
+	// Two PSIs (sets of sizes M, N and N, M) with their equality tests in one execution
+	auto role = gParty.GetRole();
+	auto bc = gParty.GetCircuit(S_BOOL);
+	vector<uint64_t> AliceSet(M), BobSet(N);
+	for (int i = 0; i < M; i++)
+		AliceSet[i] = i;
+	for (int i = 0; i < N; i++)
+		BobSet[i] = N - i;
+	PSI psi1(role == SERVER ? AliceSet : BobSet, M, N, role == SERVER ? PSI::Alice : PSI::Bob);
+	PSI psi2(role == SERVER ? BobSet : AliceSet, N, M, role == SERVER ? PSI::Alice : PSI::Bob);
+	EqualityTester tester;
+	psi1.QueueIntersect(tester);
+	psi2.QueueIntersect(tester);
+	tester.Execute();
+	for (auto out : {psi1.IntersectResult(tester), psi2.IntersectResult(tester)})
+	{
+		auto s_out = bc->PutOUTGate(bc->PutSharedSIMDINGate(out.size(), out.data(), 1), ALL);
+		uint32_t *a;
+		uint32_t b, c;
+		gParty.ExecCircuit();
+		s_out->get_clear_value_vec(&a, &b, &c);
+		gParty.Reset();
+		int num = 0;
+		for (int i = 0; i < (int)out.size(); i++)
+			num += a[i];
+		delete[] a;
+		if (num != min(M - 1, N))
+		{
+			cout << "test shared psis fail when M=" << M << " and N=" << N << endl;
+			exit(1);
+		}
+	}
+}
+
 void test_psi_payload(int M, int N)
 {
 	auto role = gParty.GetRole();
@@ -322,14 +1004,73 @@ void test_psi_payload(int M, int N)
 	delete psi;
 }
 
+void test_psi_payloads(int M, int N, bool shared)
+{
+	// Two payloads (Bob's or shared) in one fused PSI
+	auto role = gParty.GetRole();
+	auto ac = gParty.GetCircuit(S_ARITH);
+	vector<uint64_t> AliceSet(M);
+	vector<uint64_t> BobSet(N);
+	vector<vector<uint32_t>> BobPayloads(2, vector<uint32_t>(N)), shares(2, vector<uint32_t>(N));
+	for (int i = 0; i < M; i++)
+		AliceSet[i] = i;
+	for (int i = 0; i < N; i++)
+	{
+		BobSet[i] = i + 1;
+		for (int t = 0; t < 2; t++)
+		{
+			// Both parties draw the same payloads and the same shares of the SERVER
+			BobPayloads[t][i] = rand() % 4209;
+			uint32_t share1 = rand();
+			shares[t][i] = !shared ? BobPayloads[t][i] : role == SERVER ? share1 : BobPayloads[t][i] - share1;
+		}
+	}
+	PSI *psi;
+	if (role == SERVER)
+		psi = new PSI(AliceSet, M, N, PSI::Alice, PSI::NumPayloadOutputs(2, shared));
+	else
+		psi = new PSI(BobSet, M, N, PSI::Bob, PSI::NumPayloadOutputs(2, shared));
+	vector<vector<uint32_t>> results;
+	vector<vector<uint32_t> *> payloads{&shares[0], &shares[1]};
+	if (role == SERVER && !shared)
+		payloads.assign(2, nullptr);
+	psi->IntersectWithPayloads(payloads, shared, results);
+	for (int t = 0; t < 2; t++)
+	{
+		auto s_in = ac->PutSharedSIMDINGate(results[t].size(), results[t].data(), 32);
+		auto s_out = ac->PutOUTGate(s_in, ALL);
+		gParty.ExecCircuit();
+		uint32_t *out, b, c;
+		s_out->get_clear_value_vec(&out, &b, &c);
+		gParty.Reset();
+		if (role == SERVER)
+		{
+			auto permutedIndices = psi->CuckooToAliceArray();
+			for (int i = 1; i < min(M, N); i++)
+				if (out[permutedIndices[i]] != BobPayloads[t][i - 1])
+				{
+					cout << "test fused psi fail when M=" << M << " and N=" << N << endl;
+					exit(1);
+				}
+		}
+		delete[] out;
+	}
+	delete psi;
+}
+
 void test_psis()
 {
 	test_one_psi(40, 40);
 	test_one_psi(40, 4000);
 	test_one_psi(4000, 400);
+	test_one_psi(40, 4000, PSI::OKVS);
+	test_one_psi(4000, 400, PSI::OKVS);
+	test_shared_psis(40, 400);
 	test_psi_payload(40, 40);
 	test_psi_payload(40, 400);
 	test_psi_payload(400, 40);
+	test_psi_payloads(40, 400, false);
+	test_psi_payloads(400, 40, true);
 	cout << "All PSI tests passed!" << endl;
 }
 
@@ -533,8 +1274,13 @@ int main(int argc, char **)
 		role = (e_role)(1 - role);
 
 	gParty.Init(address, port, role);
+	test_ots();
 	test_oeps();
 	test_psis();
+	test_small_semi_joins();
+	test_spills();
+	test_columns();
+	test_data_files();
 	test_relations();
 	//test_aby_func();
 